@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../src/simulator.h"
+#include "mipsEncoder.h"
+#include "workloads.h"
+
+/*
+ * gsim-bench: run the generated workloads through the simulator and report
+ * guest MIPS (millions of simulated instructions per second) for each.
+ */
+
+#define DEFAULT_REPS 5
+#define DEFAULT_WARMUP 1
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+extern CPU_LOCAL uint64_t instCount;
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg hi;
+extern CPU_LOCAL reg lo;
+extern byte* data;
+extern size_t dataSize;
+
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: gsim-bench [-r reps] [-w warmup] [-e dir] [workload...]\n"
+                    "  -r reps    Timed runs per workload (default %d)\n"
+                    "  -w warmup  Untimed runs before timing (default %d)\n"
+                    "  -e dir     Write the workload executables to dir and exit\n"
+                    "Workloads:\n", DEFAULT_REPS, DEFAULT_WARMUP);
+    for(int i=0; i<numWorkloads; i++) {
+        fprintf(stderr, "  %-12s %s\n", workloads[i].name, workloads[i].description);
+    }
+}
+
+static int emit(const workload* w, const char* dir) {
+    mips_prog prog;
+    size_t len;
+    char path[4096];
+
+    enc_init(&prog);
+    w->build(&prog);
+    uint8_t* image = enc_image(&prog, &len);
+    enc_free(&prog);
+
+    snprintf(path, sizeof(path), "%s/%s.out", dir, w->name);
+    FILE* file = fopen(path, "wb");
+    int failed = file == NULL || fwrite(image, 1, len, file) != len;
+    if(file != NULL) {
+        failed |= fclose(file);
+    }
+    free(image);
+    if(failed) {
+        fprintf(stderr, "Could not write \"%s\"\n", path);
+    }
+    return failed ? -1 : 0;
+}
+
+static uint64_t hash(uint64_t h, const void* bytes, size_t len) {
+    const byte* p = bytes;
+    for(size_t i=0; i<len; i++) {
+        h = (h ^ p[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+/**
+ * Hash of the instruction count, registers and data segment at the end of
+ * a run, so a faster simulator that computes the wrong thing fails.
+ */
+static uint64_t state_checksum() {
+    uint64_t h = hash(FNV_OFFSET, &instCount, sizeof(instCount));
+    h = hash(h, registers, NUM_REGISTERS * sizeof(reg));
+    h = hash(h, &hi, sizeof(hi));
+    h = hash(h, &lo, sizeof(lo));
+    return hash(h, data, dataSize);
+}
+
+/**
+ * Run one workload reps times after warmup untimed runs.
+ * @return 0 on success, -1 if it could not be loaded or ended in the wrong
+ *          state
+ */
+static int run(const workload* w, int reps, int warmup, FILE* report) {
+    mips_prog prog;
+    size_t len;
+    char* args[] = {"gsim-bench", (char*) w->name, NULL};
+
+    enc_init(&prog);
+    w->build(&prog);
+    uint8_t* image = enc_image(&prog, &len);
+    enc_free(&prog);
+
+    double* mips = malloc(reps * sizeof(double));
+    double totalSec = 0;
+    uint64_t insts = 0;
+    for(int r=-warmup; r<reps; r++) {
+        if(sim_init(image, 2, args) != 0) {
+            fprintf(stderr, "Could not load workload \"%s\"\n", w->name);
+            free(mips);
+            free(image);
+            return -1;
+        }
+        double start = now_sec();
+        sim_run();
+        double elapsed = now_sec() - start;
+        insts = instCount;
+        uint64_t checksum = state_checksum();
+        sim_exit();
+        if(checksum != w->checksum) {
+            fprintf(stderr, "Workload \"%s\" ended in the wrong state (checksum %016llx, expected %016llx)\n",
+                    w->name, (unsigned long long) checksum, (unsigned long long) w->checksum);
+            free(mips);
+            free(image);
+            return -1;
+        }
+        if(r >= 0) {
+            mips[r] = insts / elapsed / 1e6;
+            totalSec += elapsed;
+        }
+    }
+    fflush(stdout);
+
+    double mean = 0;
+    double min = mips[0];
+    double max = mips[0];
+    for(int r=0; r<reps; r++) {
+        mean += mips[r];
+        min = mips[r] < min ? mips[r] : min;
+        max = mips[r] > max ? mips[r] : max;
+    }
+    mean /= reps;
+    double var = 0;
+    for(int r=0; r<reps; r++) {
+        var += (mips[r] - mean) * (mips[r] - mean);
+    }
+    double stddev = reps > 1 ? sqrt(var / (reps - 1)) : 0;
+
+    fprintf(report, "%-12s %12llu %10.2f %10.2f %10.2f %10.2f %8.2f\n", w->name,
+            (unsigned long long) insts, totalSec / reps * 1e3, mean, min, max, stddev);
+    fflush(report);
+    free(mips);
+    free(image);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int reps = DEFAULT_REPS;
+    int warmup = DEFAULT_WARMUP;
+    const char* emitDir = NULL;
+
+    int argi = 1;
+    while(argi < argc && argv[argi][0] == '-') {
+        if(strcmp(argv[argi], "-r") == 0 && argi + 1 < argc && atoi(argv[argi + 1]) > 0) {
+            reps = atoi(argv[++argi]);
+        } else if(strcmp(argv[argi], "-w") == 0 && argi + 1 < argc && atoi(argv[argi + 1]) >= 0) {
+            warmup = atoi(argv[++argi]);
+        } else if(strcmp(argv[argi], "-e") == 0 && argi + 1 < argc) {
+            emitDir = argv[++argi];
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+        argi++;
+    }
+
+    const workload* selected[64];
+    int numSelected = 0;
+    for(; argi < argc; argi++) {
+        const workload* w = find_workload(argv[argi]);
+        if(w == NULL) {
+            fprintf(stderr, "Unknown workload \"%s\"\n", argv[argi]);
+            usage();
+            return EXIT_FAILURE;
+        }
+        if(numSelected < 64) {
+            selected[numSelected++] = w;
+        }
+    }
+    if(numSelected == 0) {
+        for(int i=0; i<numWorkloads && i<64; i++) {
+            selected[numSelected++] = &workloads[i];
+        }
+    }
+
+    if(emitDir != NULL) {
+        for(int i=0; i<numSelected; i++) {
+            if(emit(selected[i], emitDir) != 0) {
+                return EXIT_FAILURE;
+            }
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Keep the report on the real stdout and discard the guests' output
+    FILE* report = fdopen(dup(STDOUT_FILENO), "w");
+    int devNull = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+
+    fprintf(report, "%-12s %12s %10s %10s %10s %10s %8s\n", "workload", "guest insts",
+            "mean ms", "MIPS", "min", "max", "stddev");
+    int failed = 0;
+    for(int i=0; i<numSelected && !failed; i++) {
+        failed = run(selected[i], reps, warmup, report) != 0;
+    }
+    fclose(report);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
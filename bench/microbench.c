@@ -0,0 +1,311 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/simulator.h"
+#include "../src/hostCounters.h"
+#include "mipsEncoder.h"
+
+/*
+ * gsim-microbench: time each instruction handler and the fetch, decode and
+ * address translation path in isolation, over a fixed synthetic machine
+ * state. Reports ns per operation and, when the host allows it, cycles,
+ * instructions and branch mispredicts per operation.
+ *
+ * A result file written with -o can be given back with -b; the run then
+ * fails if any operation got slower than the baseline by more than the
+ * threshold, which makes it usable as a regression gate.
+ */
+
+#define MIN_SAMPLE_SEC 0.01
+#define SAMPLES 3
+#define DEFAULT_THRESHOLD 10.0
+#define LOOP_LEN 1024
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL uint64_t instCount;
+
+typedef struct micro_op {
+    const char* name;
+    void (*run)(long n);
+} micro_op;
+
+static uint32_t dataBase;
+static volatile uint32_t sink;
+
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Load a program of LOOP_LEN - 1 nops followed by a jump back to the start,
+ * with a data segment for the memory handlers, and set up the registers.
+ * @return 0 on success, -1 if the program could not be loaded
+ */
+static int setup(uint8_t** image) {
+    mips_prog prog;
+    size_t len;
+    char* args[] = {"gsim-microbench", "microbench", NULL};
+
+    enc_init(&prog);
+    dataBase = enc_space(&prog, 65536);
+    for(int i=0; i<LOOP_LEN - 1; i++) {
+        SLL(&prog, ZERO, ZERO, 0);
+    }
+    J(&prog, 0);
+    *image = enc_image(&prog, &len);
+    enc_free(&prog);
+    if(sim_init(*image, 2, args) != 0) {
+        free(*image);
+        return -1;
+    }
+
+    registers[S0] = 12345;
+    registers[S1] = 678;
+    registers[S2] = dataBase + 256;
+    registers[S3] = 5;
+    return 0;
+}
+
+__attribute__((noinline)) static void empty() {
+    __asm__ volatile("");
+}
+
+static void run_baseline(long n) {
+    for(long i=0; i<n; i++) {
+        empty();
+    }
+}
+
+static void run_translate_data(long n) {
+    for(long i=0; i<n; i++) {
+        sink = (uintptr_t) getRealAddr(dataBase + (i & 0xFFFC));
+    }
+}
+
+static void run_translate_stack(long n) {
+    for(long i=0; i<n; i++) {
+        sink = (uintptr_t) getRealAddr(0x7fffffff - (i & 0xFFC));
+    }
+}
+
+static void run_translate_text(long n) {
+    for(long i=0; i<n; i++) {
+        sink = (uintptr_t) getRealAddr(0x400000 + (i & 0xFFC));
+    }
+}
+
+static void run_decode_dispatch(long n) {
+    inst word = 0x02114021;     // addu $t0, $s0, $s1
+    for(long i=0; i<n; i++) {
+        exec_func(word);
+    }
+}
+
+static void run_step(long n) {
+    pc = 0x400000;
+    sim_execute(instCount + n);
+}
+
+#define R3_OP(fn) static void run_##fn(long n) { for(long i=0; i<n; i++) fn(S0, S1, T0); }
+#define SHIFT_OP(fn) static void run_##fn(long n) { for(long i=0; i<n; i++) fn(S0, T0, 3); }
+#define IMM_OP(fn) static void run_##fn(long n) { for(long i=0; i<n; i++) fn(S0, T0, 1234); }
+#define MEM_OP(fn) static void run_##fn(long n) { for(long i=0; i<n; i++) fn(S2, T0, 16); }
+#define HILO_OP(fn) static void run_##fn(long n) { for(long i=0; i<n; i++) fn(S0, S1); }
+#define ONE_OP(fn) static void run_##fn(long n) { for(long i=0; i<n; i++) fn(T0); }
+
+R3_OP(add) R3_OP(addu) R3_OP(sub) R3_OP(subu) R3_OP(and) R3_OP(or) R3_OP(xor) R3_OP(nor)
+R3_OP(slt) R3_OP(sltu) R3_OP(sllv) R3_OP(srlv) R3_OP(srav)
+SHIFT_OP(sll) SHIFT_OP(srl) SHIFT_OP(sra)
+IMM_OP(addi) IMM_OP(addiu) IMM_OP(slti) IMM_OP(sltiu) IMM_OP(andi) IMM_OP(ori)
+MEM_OP(lb) MEM_OP(lbu) MEM_OP(lh) MEM_OP(lhu) MEM_OP(lw) MEM_OP(sb) MEM_OP(sh) MEM_OP(sw)
+HILO_OP(mult) HILO_OP(multu) HILO_OP(div_) HILO_OP(divu)
+ONE_OP(mfhi) ONE_OP(mflo) ONE_OP(mthi) ONE_OP(mtlo)
+
+static void run_lui(long n) { for(long i=0; i<n; i++) lui(ZERO, T0, 0x1234); }
+static void run_beq(long n) { for(long i=0; i<n; i++) beq(S0, S1, 4); }
+static void run_bne(long n) { for(long i=0; i<n; i++) bne(S0, S1, 4); }
+static void run_j(long n) { for(long i=0; i<n; i++) j(0x100000); }
+static void run_jal(long n) { for(long i=0; i<n; i++) jal(0x100000); }
+static void run_jr(long n) { for(long i=0; i<n; i++) jr(S2); }
+static void run_jalr(long n) { for(long i=0; i<n; i++) jalr(S2, T0); }
+
+static const micro_op ops[] = {
+    {"baseline", run_baseline},
+    {"translate-data", run_translate_data},
+    {"translate-stack", run_translate_stack},
+    {"translate-text", run_translate_text},
+    {"decode-dispatch", run_decode_dispatch},
+    {"step", run_step},
+    {"add", run_add}, {"addu", run_addu}, {"sub", run_sub}, {"subu", run_subu},
+    {"and", run_and}, {"or", run_or}, {"xor", run_xor}, {"nor", run_nor},
+    {"slt", run_slt}, {"sltu", run_sltu},
+    {"sll", run_sll}, {"srl", run_srl}, {"sra", run_sra},
+    {"sllv", run_sllv}, {"srlv", run_srlv}, {"srav", run_srav},
+    {"addi", run_addi}, {"addiu", run_addiu}, {"slti", run_slti}, {"sltiu", run_sltiu},
+    {"andi", run_andi}, {"ori", run_ori}, {"lui", run_lui},
+    {"lb", run_lb}, {"lbu", run_lbu}, {"lh", run_lh}, {"lhu", run_lhu}, {"lw", run_lw},
+    {"sb", run_sb}, {"sh", run_sh}, {"sw", run_sw},
+    {"mult", run_mult}, {"multu", run_multu}, {"div", run_div_}, {"divu", run_divu},
+    {"mfhi", run_mfhi}, {"mflo", run_mflo}, {"mthi", run_mthi}, {"mtlo", run_mtlo},
+    {"beq", run_beq}, {"bne", run_bne}, {"j", run_j}, {"jal", run_jal},
+    {"jr", run_jr}, {"jalr", run_jalr},
+};
+
+static const int numOps = sizeof(ops) / sizeof(ops[0]);
+
+static void usage() {
+    fprintf(stderr, "Usage: gsim-microbench [-o file] [-b file] [-t percent] [op...]\n"
+                    "  -o file     Save the results to file\n"
+                    "  -b file     Fail if an op is slower than in this saved result file\n"
+                    "  -t percent  Allowed slowdown against the baseline (default %.0f)\n",
+            DEFAULT_THRESHOLD);
+}
+
+/**
+ * Time one operation: grow the iteration count until a sample takes long
+ * enough, then keep the fastest of several samples.
+ */
+static double measure(const micro_op* op, host_counters* hc, double perOp[HC_NUM_COUNTERS]) {
+    long n = 1 << 14;
+    while(1) {
+        double start = now_sec();
+        op->run(n);
+        if(now_sec() - start >= MIN_SAMPLE_SEC) {
+            break;
+        }
+        n *= 2;
+    }
+
+    double best = -1;
+    for(int s=0; s<SAMPLES; s++) {
+        uint64_t values[HC_NUM_COUNTERS];
+        hostcounters_start(hc);
+        double start = now_sec();
+        op->run(n);
+        double elapsed = now_sec() - start;
+        hostcounters_stop(hc);
+        hostcounters_read(hc, values);
+
+        double ns = elapsed * 1e9 / n;
+        if(best < 0 || ns < best) {
+            best = ns;
+            for(int c=0; c<HC_NUM_COUNTERS; c++) {
+                perOp[c] = values[c] == UINT64_MAX ? -1 : (double) values[c] / n;
+            }
+        }
+    }
+    return best;
+}
+
+static double baseline_ns(FILE* file, const char* name) {
+    char line[256];
+    char opName[128];
+    double ns;
+    rewind(file);
+    while(fgets(line, sizeof(line), file) != NULL) {
+        if(sscanf(line, "%127s %lf", opName, &ns) == 2 && strcmp(opName, name) == 0) {
+            return ns;
+        }
+    }
+    return -1;
+}
+
+static void print_count(double value) {
+    if(value < 0) {
+        printf(" %10s", "-");
+    } else {
+        printf(" %10.2f", value);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    const char* outName = NULL;
+    const char* baseName = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+
+    int argi = 1;
+    while(argi < argc && argv[argi][0] == '-') {
+        if(strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            outName = argv[++argi];
+        } else if(strcmp(argv[argi], "-b") == 0 && argi + 1 < argc) {
+            baseName = argv[++argi];
+        } else if(strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+            threshold = atof(argv[++argi]);
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+        argi++;
+    }
+
+    FILE* out = NULL;
+    FILE* base = NULL;
+    if(outName != NULL && (out = fopen(outName, "w")) == NULL) {
+        fprintf(stderr, "Could not create \"%s\"\n", outName);
+        return EXIT_FAILURE;
+    }
+    if(baseName != NULL && (base = fopen(baseName, "r")) == NULL) {
+        fprintf(stderr, "File \"%s\" does not exist!\n", baseName);
+        return EXIT_FAILURE;
+    }
+
+    uint8_t* image;
+    if(setup(&image) != 0) {
+        fprintf(stderr, "Could not load the benchmark program\n");
+        return EXIT_FAILURE;
+    }
+
+    host_counters hc;
+    if(hostcounters_open(&hc) == 0) {
+        fprintf(stderr, "Host performance counters unavailable, reporting time only\n");
+    }
+
+    printf("%-16s %10s %10s %10s %10s\n", "op", "ns/op", "cycles", "insts", "br-miss");
+    int regressions = 0;
+    for(int i=0; i<numOps; i++) {
+        int selected = argi == argc;
+        for(int a=argi; a<argc; a++) {
+            selected |= strcmp(argv[a], ops[i].name) == 0;
+        }
+        if(!selected) {
+            continue;
+        }
+
+        double perOp[HC_NUM_COUNTERS];
+        double ns = measure(&ops[i], &hc, perOp);
+        printf("%-16s %10.2f", ops[i].name, ns);
+        print_count(perOp[HC_CYCLES]);
+        print_count(perOp[HC_INSTRUCTIONS]);
+        print_count(perOp[HC_BRANCH_MISSES]);
+        if(out != NULL) {
+            fprintf(out, "%s %.3f\n", ops[i].name, ns);
+        }
+        if(base != NULL) {
+            double baseNs = baseline_ns(base, ops[i].name);
+            if(baseNs > 0 && ns > baseNs * (1 + threshold / 100)) {
+                printf("  REGRESSION (baseline %.2f)", baseNs);
+                regressions++;
+            }
+        }
+        printf("\n");
+    }
+
+    hostcounters_close(&hc);
+    sim_exit();
+    free(image);
+    if(out != NULL) {
+        fclose(out);
+    }
+    if(base != NULL) {
+        fclose(base);
+    }
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
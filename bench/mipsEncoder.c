@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "mipsEncoder.h"
+
+#define HEADER_SIZE 0x34
+#define R2K_MAGIC 0xface
+#define R2K_VERSION 0x2000
+#define ENTRY_LOC 0x8
+#define TEXT_SIZE_LOC 0xc
+#define DATA_SIZE_LOC 0x14
+
+
+static void put32(uint8_t* dest, uint32_t i) {
+    dest[0] = i >> 24 & 0xFF;
+    dest[1] = i >> 16 & 0xFF;
+    dest[2] = i >> 8 & 0xFF;
+    dest[3] = i & 0xFF;
+}
+
+static size_t emit(mips_prog* prog, uint32_t word) {
+    if(prog->textLen == prog->textCap) {
+        prog->textCap = prog->textCap ? prog->textCap * 2 : 256;
+        prog->text = realloc(prog->text, prog->textCap * sizeof(uint32_t));
+    }
+    prog->text[prog->textLen] = word;
+    return prog->textLen++;
+}
+
+void enc_init(mips_prog* prog) {
+    memset(prog, 0, sizeof(mips_prog));
+}
+
+void enc_free(mips_prog* prog) {
+    free(prog->text);
+    free(prog->data);
+    enc_init(prog);
+}
+
+size_t enc_here(mips_prog* prog) {
+    return prog->textLen;
+}
+
+uint32_t enc_data(mips_prog* prog, const void* bytes, size_t len) {
+    if(prog->dataLen + len > prog->dataCap) {
+        while(prog->dataLen + len > prog->dataCap) {
+            prog->dataCap = prog->dataCap ? prog->dataCap * 2 : 256;
+        }
+        prog->data = realloc(prog->data, prog->dataCap);
+    }
+    uint32_t addr = ENC_DATA_ADDRESS + prog->dataLen;
+    if(bytes != NULL) {
+        memcpy(&prog->data[prog->dataLen], bytes, len);
+    } else {
+        memset(&prog->data[prog->dataLen], 0, len);
+    }
+    prog->dataLen += len;
+    return addr;
+}
+
+uint32_t enc_space(mips_prog* prog, size_t len) {
+    if(prog->dataLen % 4) {
+        enc_data(prog, NULL, 4 - prog->dataLen % 4);
+    }
+    return enc_data(prog, NULL, len);
+}
+
+size_t enc_r(mips_prog* prog, int funct, int rd, int rs, int rt, int shamt) {
+    return emit(prog, (uint32_t) rs << 21 | (uint32_t) rt << 16 | (uint32_t) rd << 11 |
+                      (uint32_t) shamt << 6 | (uint32_t) funct);
+}
+
+size_t enc_i(mips_prog* prog, int opcode, int rt, int rs, int32_t imm) {
+    return emit(prog, (uint32_t) opcode << 26 | (uint32_t) rs << 21 | (uint32_t) rt << 16 |
+                      ((uint32_t) imm & 0xFFFF));
+}
+
+size_t enc_j(mips_prog* prog, int opcode, size_t target) {
+    return emit(prog, (uint32_t) opcode << 26 | (((ENC_TEXT_ADDRESS >> 2) + target) & 0x3FFFFFF));
+}
+
+void enc_patch(mips_prog* prog, size_t at, size_t target) {
+    uint32_t word = prog->text[at];
+    uint32_t opcode = word >> 26;
+    if(opcode == 2 || opcode == 3) {
+        prog->text[at] = (word & 0xFC000000) | (((ENC_TEXT_ADDRESS >> 2) + target) & 0x3FFFFFF);
+    } else {
+        prog->text[at] = (word & 0xFFFF0000) | ((uint32_t) ((int32_t) target - (int32_t) at - 1) & 0xFFFF);
+    }
+}
+
+uint8_t* enc_image(mips_prog* prog, size_t* len) {
+    size_t textBytes = prog->textLen * sizeof(uint32_t);
+    *len = HEADER_SIZE + textBytes + prog->dataLen;
+    uint8_t* image = calloc(*len, 1);
+
+    image[0] = R2K_MAGIC >> 8;
+    image[1] = R2K_MAGIC & 0xFF;
+    image[2] = R2K_VERSION >> 8;
+    image[3] = R2K_VERSION & 0xFF;
+    put32(&image[ENTRY_LOC], ENC_TEXT_ADDRESS);
+    put32(&image[TEXT_SIZE_LOC], textBytes);
+    put32(&image[DATA_SIZE_LOC], prog->dataLen);
+    for(size_t i=0; i<prog->textLen; i++) {
+        put32(&image[HEADER_SIZE + 4 * i], prog->text[i]);
+    }
+    if(prog->dataLen) {
+        memcpy(&image[HEADER_SIZE + textBytes], prog->data, prog->dataLen);
+    }
+    return image;
+}
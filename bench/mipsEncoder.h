@@ -0,0 +1,133 @@
+#ifndef GSIM_MIPSENCODER_H
+#define GSIM_MIPSENCODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Minimal R2K program builder, used to generate benchmark programs without
+ * depending on rasm and rlink.
+ *
+ * Instructions are appended to the text section and data bytes to the data
+ * section. Positions in the text section are instruction indexes; branch
+ * and jump helpers take the index of their target, and branches to code not
+ * emitted yet are fixed up with enc_patch() once the target is known.
+ *
+ * enc_image() produces an executable with the header layout sim_init()
+ * reads: a 0x34 byte header holding the magic number, entry point and the
+ * size of each section, followed by the text and data sections.
+ */
+
+#define ENC_TEXT_ADDRESS 0x400000
+#define ENC_DATA_ADDRESS 0x10000000
+
+enum {
+    ZERO, AT, V0, V1, A0, A1, A2, A3,
+    T0, T1, T2, T3, T4, T5, T6, T7,
+    S0, S1, S2, S3, S4, S5, S6, S7,
+    T8, T9, K0, K1, GP, SP, FP, RA
+};
+
+typedef struct mips_prog {
+    uint32_t* text;
+    size_t textLen;
+    size_t textCap;
+    uint8_t* data;
+    size_t dataLen;
+    size_t dataCap;
+} mips_prog;
+
+/**
+ * Initialize an empty program.
+ */
+void enc_init(mips_prog* prog);
+
+/**
+ * Release the sections of a program.
+ */
+void enc_free(mips_prog* prog);
+
+/**
+ * @return Index of the next instruction to be emitted
+ */
+size_t enc_here(mips_prog* prog);
+
+/**
+ * Append raw bytes to the data section.
+ * @return Address of the first byte in the simulated data segment
+ */
+uint32_t enc_data(mips_prog* prog, const void* bytes, size_t len);
+
+/**
+ * Append zeroed bytes to the data section, aligned on a word boundary.
+ * @return Address of the first byte in the simulated data segment
+ */
+uint32_t enc_space(mips_prog* prog, size_t len);
+
+/**
+ * Point the branch or jump emitted at index at to the instruction at
+ * index target.
+ */
+void enc_patch(mips_prog* prog, size_t at, size_t target);
+
+/**
+ * Build the executable image.
+ * @param len - Set to the size of the image
+ * @return Image allocated with malloc
+ */
+uint8_t* enc_image(mips_prog* prog, size_t* len);
+
+// Raw encodings, each returning the index of the emitted instruction
+size_t enc_r(mips_prog* prog, int funct, int rd, int rs, int rt, int shamt);
+size_t enc_i(mips_prog* prog, int opcode, int rt, int rs, int32_t imm);
+size_t enc_j(mips_prog* prog, int opcode, size_t target);
+
+#define ADD(p, rd, rs, rt)      enc_r(p, 0x20, rd, rs, rt, 0)
+#define ADDU(p, rd, rs, rt)     enc_r(p, 0x21, rd, rs, rt, 0)
+#define SUBU(p, rd, rs, rt)     enc_r(p, 0x23, rd, rs, rt, 0)
+#define AND(p, rd, rs, rt)      enc_r(p, 0x24, rd, rs, rt, 0)
+#define OR(p, rd, rs, rt)       enc_r(p, 0x25, rd, rs, rt, 0)
+#define XOR(p, rd, rs, rt)      enc_r(p, 0x26, rd, rs, rt, 0)
+#define NOR(p, rd, rs, rt)      enc_r(p, 0x27, rd, rs, rt, 0)
+#define SLT(p, rd, rs, rt)      enc_r(p, 0x2A, rd, rs, rt, 0)
+#define SLTU(p, rd, rs, rt)     enc_r(p, 0x2B, rd, rs, rt, 0)
+#define SLL(p, rd, rt, sa)      enc_r(p, 0x00, rd, 0, rt, sa)
+#define SRL(p, rd, rt, sa)      enc_r(p, 0x02, rd, 0, rt, sa)
+#define SRA(p, rd, rt, sa)      enc_r(p, 0x03, rd, 0, rt, sa)
+#define SLLV(p, rd, rt, rs)     enc_r(p, 0x04, rd, rs, rt, 0)
+#define JR(p, rs)               enc_r(p, 0x08, 0, rs, 0, 0)
+#define JALR(p, rd, rs)         enc_r(p, 0x09, rd, rs, 0, 0)
+#define SYSCALL(p)              enc_r(p, 0x0C, 0, 0, 0, 0)
+#define MFHI(p, rd)             enc_r(p, 0x10, rd, 0, 0, 0)
+#define MFLO(p, rd)             enc_r(p, 0x12, rd, 0, 0, 0)
+#define MULT(p, rs, rt)         enc_r(p, 0x18, 0, rs, rt, 0)
+#define MULTU(p, rs, rt)        enc_r(p, 0x19, 0, rs, rt, 0)
+#define DIV(p, rs, rt)          enc_r(p, 0x1A, 0, rs, rt, 0)
+#define DIVU(p, rs, rt)         enc_r(p, 0x1B, 0, rs, rt, 0)
+
+#define BEQ(p, rs, rt, target)  enc_i(p, 0x04, rt, rs, (int32_t) (target) - (int32_t) enc_here(p) - 1)
+#define BNE(p, rs, rt, target)  enc_i(p, 0x05, rt, rs, (int32_t) (target) - (int32_t) enc_here(p) - 1)
+#define ADDI(p, rt, rs, imm)    enc_i(p, 0x08, rt, rs, imm)
+#define ADDIU(p, rt, rs, imm)   enc_i(p, 0x09, rt, rs, imm)
+#define SLTI(p, rt, rs, imm)    enc_i(p, 0x0A, rt, rs, imm)
+#define ANDI(p, rt, rs, imm)    enc_i(p, 0x0C, rt, rs, imm)
+#define ORI(p, rt, rs, imm)     enc_i(p, 0x0D, rt, rs, imm)
+#define LUI(p, rt, imm)         enc_i(p, 0x0F, rt, 0, imm)
+#define LB(p, rt, off, rs)      enc_i(p, 0x20, rt, rs, off)
+#define LH(p, rt, off, rs)      enc_i(p, 0x21, rt, rs, off)
+#define LW(p, rt, off, rs)      enc_i(p, 0x23, rt, rs, off)
+#define LBU(p, rt, off, rs)     enc_i(p, 0x24, rt, rs, off)
+#define LHU(p, rt, off, rs)     enc_i(p, 0x25, rt, rs, off)
+#define SB(p, rt, off, rs)      enc_i(p, 0x28, rt, rs, off)
+#define SH(p, rt, off, rs)      enc_i(p, 0x29, rt, rs, off)
+#define SW(p, rt, off, rs)      enc_i(p, 0x2B, rt, rs, off)
+
+#define J(p, target)            enc_j(p, 0x02, target)
+#define JAL(p, target)          enc_j(p, 0x03, target)
+
+/**
+ * Load a 32 bit constant with lui and ori, the way rlink builds addresses.
+ */
+#define LI(p, rt, value)        (LUI(p, rt, (uint32_t) (value) >> 16), ORI(p, rt, rt, (value) & 0xFFFF))
+
+#endif // GSIM_MIPSENCODER_H
@@ -0,0 +1,187 @@
+#include <string.h>
+
+#include "workloads.h"
+
+#define ARITH_ITERATIONS 1000000
+#define FIB_N 24
+#define STREAM_WORDS 4096
+#define STREAM_PASSES 100
+#define STRING_LEN 4000
+#define STRING_PASSES 100
+#define MULDIV_ITERATIONS 500000
+#define PRINT_ITERATIONS 100000
+
+
+static void exit_program(mips_prog* p) {
+    ADDIU(p, V0, ZERO, 10);
+    SYSCALL(p);
+}
+
+/**
+ * Register to register ALU operations in a counted loop.
+ */
+static void build_arith(mips_prog* p) {
+    LI(p, S0, ARITH_ITERATIONS);
+    ADDIU(p, T0, ZERO, 1);
+    ADDIU(p, T1, ZERO, 3);
+    size_t loop = enc_here(p);
+    ADDU(p, T2, T0, T1);
+    XOR(p, T3, T2, T0);
+    SLL(p, T4, T3, 3);
+    SUBU(p, T0, T4, T1);
+    SRA(p, T5, T0, 2);
+    OR(p, T1, T5, T2);
+    ADDIU(p, S0, S0, -1);
+    BNE(p, S0, ZERO, loop);
+    exit_program(p);
+}
+
+/**
+ * Naive recursive Fibonacci: calls, returns and stack frames.
+ */
+static void build_recursive(mips_prog* p) {
+    ADDIU(p, A0, ZERO, FIB_N);
+    size_t call = JAL(p, 0);
+    exit_program(p);
+
+    size_t fib = enc_here(p);
+    enc_patch(p, call, fib);
+    SLTI(p, T0, A0, 2);
+    size_t toRec = BEQ(p, T0, ZERO, 0);
+    ADDU(p, V0, A0, ZERO);
+    JR(p, RA);
+
+    enc_patch(p, toRec, enc_here(p));
+    ADDIU(p, SP, SP, -12);
+    SW(p, RA, 8, SP);
+    SW(p, A0, 4, SP);
+    ADDIU(p, A0, A0, -1);
+    JAL(p, fib);
+    SW(p, V0, 0, SP);
+    LW(p, A0, 4, SP);
+    ADDIU(p, A0, A0, -2);
+    JAL(p, fib);
+    LW(p, T1, 0, SP);
+    ADDU(p, V0, V0, T1);
+    LW(p, RA, 8, SP);
+    ADDIU(p, SP, SP, 12);
+    JR(p, RA);
+}
+
+/**
+ * Read-modify-write passes over a word array.
+ */
+static void build_memstream(mips_prog* p) {
+    uint32_t array = enc_space(p, STREAM_WORDS * 4);
+    LI(p, S0, STREAM_PASSES);
+    LI(p, S2, array + STREAM_WORDS * 4);
+    ADDIU(p, T1, ZERO, 7);
+    size_t pass = enc_here(p);
+    LI(p, S1, array);
+    size_t loop = enc_here(p);
+    LW(p, T0, 0, S1);
+    ADDU(p, T0, T0, T1);
+    SW(p, T0, 0, S1);
+    ADDIU(p, S1, S1, 4);
+    BNE(p, S1, S2, loop);
+    ADDIU(p, S0, S0, -1);
+    BNE(p, S0, ZERO, pass);
+    exit_program(p);
+}
+
+/**
+ * String length and upper-casing copy loops over a byte string.
+ */
+static void build_bytestring(mips_prog* p) {
+    char str[STRING_LEN + 1];
+    for(int i=0; i<STRING_LEN; i++) {
+        str[i] = "the quick brown fox jumps over the lazy dog "[i % 44];
+    }
+    str[STRING_LEN] = '\0';
+    uint32_t src = enc_data(p, str, sizeof(str));
+    uint32_t dest = enc_space(p, sizeof(str));
+
+    LI(p, S0, STRING_PASSES);
+    size_t pass = enc_here(p);
+    // strlen
+    LI(p, S1, src);
+    size_t len = enc_here(p);
+    LBU(p, T0, 0, S1);
+    ADDIU(p, S1, S1, 1);
+    BNE(p, T0, ZERO, len);
+    // Upper-case copy
+    LI(p, S1, src);
+    LI(p, S2, dest);
+    size_t copy = enc_here(p);
+    LBU(p, T0, 0, S1);
+    size_t toDone = BEQ(p, T0, ZERO, 0);
+    ANDI(p, T0, T0, 0xDF);
+    SB(p, T0, 0, S2);
+    ADDIU(p, S1, S1, 1);
+    ADDIU(p, S2, S2, 1);
+    J(p, copy);
+    enc_patch(p, toDone, enc_here(p));
+    ADDIU(p, S0, S0, -1);
+    BNE(p, S0, ZERO, pass);
+    exit_program(p);
+}
+
+/**
+ * Multiplications and divisions through hi and lo.
+ */
+static void build_muldiv(mips_prog* p) {
+    LI(p, S0, MULDIV_ITERATIONS);
+    ADDIU(p, T0, ZERO, 12345);
+    ADDIU(p, T1, ZERO, 31);
+    ADDIU(p, T4, ZERO, 7);
+    size_t loop = enc_here(p);
+    MULT(p, T0, T1);
+    MFLO(p, T2);
+    MFHI(p, T3);
+    ADDU(p, T0, T2, T3);
+    DIV(p, T0, T4);
+    MFLO(p, T5);
+    MFHI(p, T6);
+    ADDU(p, T0, T5, T6);
+    ADDIU(p, T0, T0, 12345);
+    ADDIU(p, S0, S0, -1);
+    BNE(p, S0, ZERO, loop);
+    exit_program(p);
+}
+
+/**
+ * print_int and print_char syscalls.
+ */
+static void build_print(mips_prog* p) {
+    LI(p, S0, PRINT_ITERATIONS);
+    size_t loop = enc_here(p);
+    ADDU(p, A0, S0, ZERO);
+    ADDIU(p, V0, ZERO, 1);
+    SYSCALL(p);
+    ADDIU(p, A0, ZERO, '\n');
+    ADDIU(p, V0, ZERO, 11);
+    SYSCALL(p);
+    ADDIU(p, S0, S0, -1);
+    BNE(p, S0, ZERO, loop);
+    exit_program(p);
+}
+
+const workload workloads[] = {
+    {"arith", "register ALU operations in a counted loop", build_arith, 0xb544b37341d38147ULL},
+    {"recursive", "recursive Fibonacci with stack frames", build_recursive, 0x0cf89729e606b70bULL},
+    {"memstream", "lw/sw read-modify-write over a word array", build_memstream, 0xe82222f34d82fba5ULL},
+    {"bytestring", "lbu/sb strlen and upper-case copy loops", build_bytestring, 0x92d7b292170b6a74ULL},
+    {"muldiv", "mult/div with mfhi/mflo", build_muldiv, 0xc7500a34e1b45da4ULL},
+    {"print", "print_int and print_char syscalls", build_print, 0x846bcf2e2573beceULL},
+};
+
+const int numWorkloads = sizeof(workloads) / sizeof(workloads[0]);
+
+const workload* find_workload(const char* name) {
+    for(int i=0; i<numWorkloads; i++) {
+        if(strcmp(workloads[i].name, name) == 0) {
+            return &workloads[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,25 @@
+#ifndef GSIM_WORKLOADS_H
+#define GSIM_WORKLOADS_H
+
+#include "mipsEncoder.h"
+
+/**
+ * Benchmark programs, each exercising one part of the simulator.
+ */
+typedef struct workload {
+    const char* name;
+    const char* description;
+    void (*build)(mips_prog* prog);
+    uint64_t checksum;      // Final state, as hashed by gsim-bench
+} workload;
+
+extern const workload workloads[];
+extern const int numWorkloads;
+
+/**
+ * Find a workload by name.
+ * @return The workload, or NULL if there is none with that name
+ */
+const workload* find_workload(const char* name);
+
+#endif // GSIM_WORKLOADS_H
@@ -0,0 +1,165 @@
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "aflCoverage.h"
+#include "decode.h"
+
+
+extern byte* text;
+extern byte* data;
+extern CPU_LOCAL byte* stack;
+
+extern size_t textSize;
+extern size_t dataSize;
+extern CPU_LOCAL size_t stackSize;
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL reg hi;
+extern CPU_LOCAL reg lo;
+
+extern CPU_LOCAL uint64_t instCount;
+
+byte* aflArea;
+uint32_t aflPrev;
+
+// afl-fuzz looks for this in the binary to turn persistent mode on
+const char aflPersistentSig[] = "##SIG_AFL_PERSISTENT##";
+
+// Machine state right after loading, restored between persistent runs
+static byte* loadedText;
+static byte* loadedData;
+static byte* loadedStack;
+static reg loadedRegs[NUM_REGISTERS];
+static reg loadedPc;
+
+
+static void save_loaded() {
+    loadedText = malloc(textSize);
+    loadedData = malloc(dataSize);
+    loadedStack = malloc(stackSize);
+    memcpy(loadedText, text, textSize);
+    memcpy(loadedData, data, dataSize);
+    memcpy(loadedStack, stack, stackSize);
+    memcpy(loadedRegs, registers, sizeof(loadedRegs));
+    loadedPc = pc;
+}
+
+static void restore_loaded() {
+    if(memcmp(text, loadedText, textSize) != 0) {
+        memcpy(text, loadedText, textSize);
+        decode_init();
+    }
+    memcpy(data, loadedData, dataSize);
+    memcpy(stack, loadedStack, stackSize);
+    memcpy(registers, loadedRegs, sizeof(loadedRegs));
+    pc = loadedPc;
+    hi = 0;
+    lo = 0;
+    instCount = 0;
+}
+
+/**
+ * Run inputs in a child of the fork server until it is done.
+ */
+static void run_child(int persistent) {
+    for(int run=1; ; run++) {
+        // A stream of its own each time, since AFL rewinds stdin under it
+        int fd = dup(STDIN_FILENO);
+        FILE* in = fd >= 0 ? fdopen(fd, "r") : NULL;
+        syscall_streams(in, NULL);
+        aflPrev = 0;
+        err_code err;
+        do {
+            err = sim_execute(UINT64_MAX);
+        } while(err_continues(err));
+        syscall_streams(NULL, NULL);
+        if(in != NULL) {
+            fclose(in);
+        }
+        fflush(stdout);
+        if(err != EXIT) {
+            sim_report_error(err);
+            fprintf(stderr, "\n");
+            abort();
+        }
+        if(!persistent || run == AFL_PERSISTENT_RUNS) {
+            _exit(EXIT_SUCCESS);
+        }
+        restore_loaded();
+        raise(SIGSTOP);
+    }
+}
+
+/**
+ * Serve AFL's requests for runs until it goes away.
+ */
+static void fork_server(int persistent) {
+    pid_t child = -1;
+    int childStopped = 0;
+    for(;;) {
+        uint32_t wasKilled;
+        int status;
+        if(read(AFL_FORKSRV_FD, &wasKilled, 4) != 4) {
+            return;
+        }
+        // AFL killed a stopped child on a timeout
+        if(childStopped && wasKilled) {
+            childStopped = 0;
+            waitpid(child, &status, 0);
+        }
+        if(!childStopped) {
+            child = fork();
+            if(child < 0) {
+                return;
+            } else if(child == 0) {
+                close(AFL_FORKSRV_FD);
+                close(AFL_FORKSRV_FD + 1);
+                run_child(persistent);
+            }
+        } else {
+            kill(child, SIGCONT);
+            childStopped = 0;
+        }
+        if(write(AFL_FORKSRV_FD + 1, &child, 4) != 4
+           || waitpid(child, &status, persistent ? WUNTRACED : 0) < 0) {
+            return;
+        }
+        childStopped = WIFSTOPPED(status);
+        if(write(AFL_FORKSRV_FD + 1, &status, 4) != 4) {
+            return;
+        }
+    }
+}
+
+void afl_run() {
+    const char* shmId = getenv("__AFL_SHM_ID");
+    void* shared = shmId != NULL ? shmat(atoi(shmId), NULL, 0) : (void*) -1;
+    aflArea = shared != (void*) -1 ? shared : calloc(AFL_MAP_SIZE, 1);
+
+    // Children inherit the decoded text instead of decoding it again
+    decode_all();
+    save_loaded();
+
+    uint32_t hello = 0;
+    if(write(AFL_FORKSRV_FD + 1, &hello, 4) == 4) {
+        fork_server(getenv("__AFL_PERSISTENT") != NULL);
+    } else {
+        sim_run();
+    }
+
+    if(shared == (void*) -1) {
+        free(aflArea);
+    }
+    aflArea = NULL;
+    free(loadedText);
+    free(loadedData);
+    free(loadedStack);
+}
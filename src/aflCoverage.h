@@ -0,0 +1,43 @@
+#ifndef GSIM_AFLCOVERAGE_H
+#define GSIM_AFLCOVERAGE_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+
+/**
+ * Edge coverage and fork server for fuzzing guest programs with AFL
+ * (gsim --afl).
+ *
+ * Every taken branch or jump of the guest counts the edge from the block it
+ * leaves to the block it enters in AFL's shared memory map, found through
+ * the __AFL_SHM_ID environment variable: a multiplicative hash of the
+ * target slot, xored with the shifted hash of the previous target, as AFL's
+ * own instrumentation does. The run loop is compiled twice, with and
+ * without the counting, so runs without --afl do not pay for it. Spin and
+ * bulk loops skipped by the run loop count as one pass.
+ *
+ * Once the program is loaded, gsim answers AFL's fork server protocol: for
+ * each input it forks a child holding the loaded, fully decoded program,
+ * which reads the input from stdin. When AFL asks for persistent mode, the
+ * child runs up to AFL_PERSISTENT_RUNS inputs, resetting the registers and
+ * the segments to their loaded state in between, and stops itself after
+ * each one as AFL expects. Any stop other than exit or exit2 aborts the
+ * child, so AFL sees it as a crash. Without AFL, the program just runs
+ * once with its coverage counted in a private map.
+ */
+
+#define AFL_MAP_BITS 16
+#define AFL_MAP_SIZE (1 << AFL_MAP_BITS)
+#define AFL_FORKSRV_FD 198          // Control pipe from AFL, the status pipe follows it
+#define AFL_PERSISTENT_RUNS 1000    // Inputs a child runs before a fresh one is forked
+
+extern byte* aflArea;       // Hit counts of the edges, NULL when not counting
+extern uint32_t aflPrev;    // Hash of the last target, shifted
+
+/**
+ * Run the loaded program under AFL, instead of sim_run().
+ */
+void afl_run();
+
+#endif // GSIM_AFLCOVERAGE_H
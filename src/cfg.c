@@ -0,0 +1,587 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "decode.h"
+
+#define PC_INIT_LOC 0x8
+#define TEXT_SIZE_LOC 0xc
+#define TEXT_START_LOC 0x34
+#define TEXT_ADDRESS 0x400000
+
+#define REG_RA 31
+
+
+static uint32_t get32(const byte* src) {
+    return ((uint32_t) src[0] << 24) | ((uint32_t) src[1] << 16) | ((uint32_t) src[2] << 8) | src[3];
+}
+
+/**
+ * @return Slot of a target address, or CFG_NONE if it is not an
+ *          instruction of the text segment
+ */
+static long slot_of(const cfg* g, uint32_t addr) {
+    uint32_t offset = addr - TEXT_ADDRESS;
+    if(offset % 4 != 0 || offset / 4 >= g->numSlots) {
+        return CFG_NONE;
+    }
+    return offset / 4;
+}
+
+/**
+ * Slot a jump or branch in slot i goes to.
+ * @return Target slot, or CFG_NONE if not an instruction of the text segment
+ */
+static long target_of(const cfg* g, size_t i, const dinst* d) {
+    switch(d->base) {
+        case OP_BEQ:
+        case OP_BNE:
+            return slot_of(g, TEXT_ADDRESS + 4 * (i + 1) + ((uint32_t) d->imm << 2));
+        case OP_J:
+        case OP_JAL:
+            return slot_of(g, (uint32_t) d->imm << 2);
+        default:
+            return CFG_NONE;
+    }
+}
+
+/**
+ * Find the targets of jr and jalr built from constants. Register values
+ * are tracked from each leader to the next, through lui, ori and addiu.
+ * @param targets - Filled with the resolved target slot of each jr and
+ *                  jalr, CFG_NONE for the others
+ */
+static void resolve_indirect(cfg* g, const dinst* insts, const uint8_t* leader, long* targets) {
+    uint32_t value[NUM_REGISTERS];
+    uint32_t known = 1;     // Bit per register, $zero is always 0
+    value[0] = 0;
+
+    for(size_t i=0; i<g->numSlots; i++) {
+        const dinst* d = &insts[i];
+        if(leader[i]) {
+            known = 1;
+        }
+        targets[i] = CFG_NONE;
+
+        int dest = -1;
+        uint32_t result = 0;
+        int isKnown = 0;
+        switch(d->base) {
+            case OP_LUI:
+                dest = d->rt;
+                result = (uint32_t) d->imm << 16;
+                isKnown = 1;
+                break;
+            case OP_ORI:
+            case OP_ADDIU:
+            case OP_ADDI:
+                dest = d->rt;
+                isKnown = known >> d->rs & 1;
+                result = d->base == OP_ORI ? value[d->rs] | (d->imm & 0xFFFF) : value[d->rs] + d->imm;
+                break;
+            case OP_JR:
+            case OP_JALR:
+                if(known >> d->rs & 1) {
+                    targets[i] = slot_of(g, value[d->rs]);
+                    g->numResolved += targets[i] != CFG_NONE;
+                }
+                if(d->base == OP_JALR) {
+                    dest = d->rd;
+                }
+                break;
+            case OP_JAL:
+                dest = REG_RA;
+                break;
+            case OP_MFHI:
+            case OP_MFLO:
+                dest = d->rd;
+                break;
+            case OP_SYSCALL:
+                known &= ~(3u << 2);    // $v0 and $v1
+                break;
+            default:
+                if(d->dest != REG_SINK) {
+                    dest = d->dest;
+                }
+                break;
+        }
+        if(dest > 0) {
+            if(isKnown) {
+                value[dest] = result;
+                known |= 1u << dest;
+            } else {
+                known &= ~(1u << dest);
+            }
+        }
+    }
+}
+
+/**
+ * Fill in the successors and exit kind of every block from its last
+ * instruction.
+ */
+static void link_blocks(cfg* g, const dinst* insts, const long* targets) {
+    for(int b=0; b<g->numBlocks; b++) {
+        cfg_block* block = &g->blocks[b];
+        size_t last = (block->end - TEXT_ADDRESS) / 4 - 1;
+        const dinst* d = &insts[last];
+        int next = last + 1 < g->numSlots ? g->blockOf[last + 1] : CFG_NONE;
+        long target = targets[last] != CFG_NONE ? targets[last] : target_of(g, last, d);
+        int targetBlock = target != CFG_NONE ? g->blockOf[target] : CFG_NONE;
+
+        block->succ[0] = CFG_NONE;
+        block->succ[1] = CFG_NONE;
+        block->callee = CFG_NONE;
+        switch(d->base) {
+            case OP_BEQ:
+            case OP_BNE:
+                block->exit = CFG_BRANCH;
+                if(d->rs == d->rt) {
+                    // beq r, r always branches and bne r, r never does
+                    block->exit = CFG_JUMP;
+                    block->succ[0] = d->base == OP_BEQ ? targetBlock : next;
+                } else {
+                    block->succ[0] = next;
+                    block->succ[1] = targetBlock != next ? targetBlock : CFG_NONE;
+                }
+                break;
+            case OP_J:
+                block->exit = CFG_JUMP;
+                block->succ[0] = targetBlock;
+                break;
+            case OP_JAL:
+            case OP_JALR:
+                block->exit = CFG_CALL;
+                block->succ[0] = next;
+                block->callee = targetBlock;
+                break;
+            case OP_JR:
+                if(targetBlock != CFG_NONE) {
+                    block->exit = CFG_JUMP;
+                    block->succ[0] = targetBlock;
+                } else {
+                    block->exit = d->rs == REG_RA ? CFG_RETURN : CFG_INDIRECT;
+                }
+                break;
+            case OP_BREAK:
+            case OP_INVALID:
+                block->exit = CFG_STOP;
+                break;
+            default:
+                block->exit = CFG_FALLTHROUGH;
+                block->succ[0] = next;
+                break;
+        }
+    }
+}
+
+/**
+ * Predecessors of every block, packed: those of block b are
+ * preds[first[b]] to preds[first[b + 1] - 1].
+ */
+typedef struct pred_lists {
+    int* first;
+    int* preds;
+} pred_lists;
+
+static int build_preds(const cfg* g, pred_lists* p) {
+    int n = g->numBlocks;
+    p->first = calloc(n + 1, sizeof(int));
+    p->preds = malloc((2 * n + 1) * sizeof(int));
+    if(p->first == NULL || p->preds == NULL) {
+        return -1;
+    }
+    for(int b=0; b<n; b++) {
+        for(int s=0; s<2; s++) {
+            if(g->blocks[b].succ[s] != CFG_NONE) {
+                p->first[g->blocks[b].succ[s] + 1]++;
+            }
+        }
+    }
+    for(int b=0; b<n; b++) {
+        p->first[b + 1] += p->first[b];
+    }
+    int* fill = malloc((n + 1) * sizeof(int));
+    if(fill == NULL) {
+        return -1;
+    }
+    memcpy(fill, p->first, (n + 1) * sizeof(int));
+    for(int b=0; b<n; b++) {
+        for(int s=0; s<2; s++) {
+            int succ = g->blocks[b].succ[s];
+            if(succ != CFG_NONE) {
+                p->preds[fill[succ]++] = b;
+            }
+        }
+    }
+    free(fill);
+    return 0;
+}
+
+/**
+ * Number the blocks reachable from the roots in postorder.
+ * @param isRoot - Nonzero for the entry block and call targets
+ * @param order - Filled with the reachable blocks in reverse postorder
+ * @param postNum - Filled with the postorder number of each block
+ * @return Number of reachable blocks
+ */
+static int number_blocks(cfg* g, const uint8_t* isRoot, int* order, int* postNum) {
+    int n = g->numBlocks;
+    int* stack = malloc(n * sizeof(int));
+    uint8_t* nextSucc = calloc(n, 1);
+    int count = 0;
+    if(stack == NULL || nextSucc == NULL) {
+        free(stack);
+        free(nextSucc);
+        return -1;
+    }
+
+    for(int r=0; r<n; r++) {
+        if(!isRoot[r] || g->blocks[r].reachable) {
+            continue;
+        }
+        int depth = 0;
+        stack[depth++] = r;
+        g->blocks[r].reachable = 1;
+        while(depth > 0) {
+            int b = stack[depth - 1];
+            if(nextSucc[b] < 2) {
+                int succ = g->blocks[b].succ[nextSucc[b]++];
+                if(succ != CFG_NONE && !g->blocks[succ].reachable) {
+                    g->blocks[succ].reachable = 1;
+                    stack[depth++] = succ;
+                }
+            } else {
+                postNum[b] = count;
+                order[n - 1 - count] = b;
+                count++;
+                depth--;
+            }
+        }
+    }
+    // Shift the reverse postorder to the start of order
+    memmove(order, &order[n - count], count * sizeof(int));
+    free(stack);
+    free(nextSucc);
+    return count;
+}
+
+/**
+ * Compute immediate dominators with the iterative algorithm of Cooper,
+ * Harvey and Kennedy. All roots hang off a virtual root, numbered
+ * numBlocks and last in postorder.
+ */
+static int compute_dominators(cfg* g, const uint8_t* isRoot, const pred_lists* p) {
+    int n = g->numBlocks;
+    int root = n;
+    int* order = malloc(n * sizeof(int));
+    int* postNum = malloc((n + 1) * sizeof(int));
+    int* idom = malloc((n + 1) * sizeof(int));
+    if(order == NULL || postNum == NULL || idom == NULL) {
+        free(order);
+        free(postNum);
+        free(idom);
+        return -1;
+    }
+
+    int count = number_blocks(g, isRoot, order, postNum);
+    if(count < 0) {
+        free(order);
+        free(postNum);
+        free(idom);
+        return -1;
+    }
+    postNum[root] = count;
+    for(int b=0; b<=n; b++) {
+        idom[b] = CFG_NONE;
+    }
+    idom[root] = root;
+
+    int changed = 1;
+    while(changed) {
+        changed = 0;
+        for(int i=0; i<count; i++) {
+            int b = order[i];
+            int newIdom = isRoot[b] ? root : CFG_NONE;
+            for(int j=p->first[b]; j<p->first[b + 1]; j++) {
+                int pred = p->preds[j];
+                if(idom[pred] == CFG_NONE) {
+                    continue;
+                }
+                if(newIdom == CFG_NONE) {
+                    newIdom = pred;
+                    continue;
+                }
+                int f1 = pred;
+                int f2 = newIdom;
+                while(f1 != f2) {
+                    while(postNum[f1] < postNum[f2]) {
+                        f1 = idom[f1];
+                    }
+                    while(postNum[f2] < postNum[f1]) {
+                        f2 = idom[f2];
+                    }
+                }
+                newIdom = f1;
+            }
+            if(idom[b] != newIdom) {
+                idom[b] = newIdom;
+                changed = 1;
+            }
+        }
+    }
+
+    for(int b=0; b<n; b++) {
+        g->blocks[b].idom = idom[b] == root ? CFG_NONE : idom[b];
+    }
+    free(order);
+    free(postNum);
+    free(idom);
+    return 0;
+}
+
+/**
+ * Find the natural loops: the body of the loop headed by h is h plus every
+ * block reaching the source of a back edge to h without going through h.
+ */
+static int find_loops(cfg* g, const pred_lists* p) {
+    int n = g->numBlocks;
+    int* work = malloc(n * sizeof(int));
+    int* mark = malloc(n * sizeof(int));
+    int* size = calloc(n, sizeof(int));
+    if(work == NULL || mark == NULL || size == NULL) {
+        free(work);
+        free(mark);
+        free(size);
+        return -1;
+    }
+    for(int b=0; b<n; b++) {
+        mark[b] = CFG_NONE;
+        g->blocks[b].loop = CFG_NONE;
+        g->blocks[b].depth = 0;
+    }
+
+    for(int h=0; h<n; h++) {
+        int count = 0;
+        for(int j=p->first[h]; j<p->first[h + 1]; j++) {
+            int src = p->preds[j];
+            if(g->blocks[src].reachable && cfg_dominates(g, h, src) && mark[src] != h) {
+                mark[src] = h;
+                work[count++] = src;
+            }
+        }
+        if(count == 0) {
+            continue;
+        }
+        g->numLoops++;
+
+        // Walk back from the back edge sources, collecting the body in work
+        mark[h] = h;
+        int body = count;
+        for(int i=0; i<body; i++) {
+            int b = work[i];
+            if(b == h) {
+                continue;
+            }
+            for(int j=p->first[b]; j<p->first[b + 1]; j++) {
+                int pred = p->preds[j];
+                if(g->blocks[pred].reachable && mark[pred] != h) {
+                    mark[pred] = h;
+                    work[body++] = pred;
+                }
+            }
+        }
+        int hasHeader = 0;
+        for(int i=0; i<body; i++) {
+            hasHeader |= work[i] == h;
+        }
+        if(!hasHeader) {
+            work[body++] = h;
+        }
+
+        // Natural loops with distinct headers nest, so the smallest loop
+        // containing a block is its innermost one
+        size[h] = body;
+        for(int i=0; i<body; i++) {
+            cfg_block* block = &g->blocks[work[i]];
+            block->depth++;
+            if(block->loop == CFG_NONE || size[block->loop] > body) {
+                block->loop = h;
+            }
+        }
+    }
+    free(work);
+    free(mark);
+    free(size);
+    return 0;
+}
+
+int cfg_build(cfg* g, const byte* text, size_t textSize, uint32_t entry) {
+    memset(g, 0, sizeof(*g));
+    g->numSlots = textSize / 4;
+    g->text = text;
+    g->entry = entry;
+    size_t n = g->numSlots ? g->numSlots : 1;
+
+    dinst* insts = malloc(n * sizeof(dinst));
+    uint8_t* leader = calloc(n, 1);
+    uint8_t* called = calloc(n, 1);
+    long* targets = malloc(n * sizeof(long));
+    g->blockOf = malloc(n * sizeof(int));
+    int err = insts == NULL || leader == NULL || called == NULL || targets == NULL || g->blockOf == NULL;
+
+    if(!err) {
+        // Leaders: the entry, targets and whatever follows a control transfer
+        long entrySlot = slot_of(g, entry);
+        if(entrySlot != CFG_NONE) {
+            leader[entrySlot] = 1;
+        }
+        leader[0] = 1;
+        for(size_t i=0; i<g->numSlots; i++) {
+            dinst* d = &insts[i];
+            decode_word(get32(&text[4 * i]), d);
+            long target = target_of(g, i, d);
+            if(target != CFG_NONE) {
+                leader[target] = 1;
+                called[target] |= d->base == OP_JAL;
+            }
+            switch(d->base) {
+                case OP_BEQ: case OP_BNE: case OP_J: case OP_JAL:
+                case OP_JR: case OP_JALR: case OP_BREAK: case OP_INVALID:
+                    if(i + 1 < g->numSlots) {
+                        leader[i + 1] = 1;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        resolve_indirect(g, insts, leader, targets);
+        for(size_t i=0; i<g->numSlots; i++) {
+            if(targets[i] != CFG_NONE) {
+                leader[targets[i]] = 1;
+                called[targets[i]] |= insts[i].base == OP_JALR;
+            }
+        }
+
+        for(size_t i=0; i<g->numSlots; i++) {
+            g->numBlocks += leader[i];
+        }
+        g->blocks = calloc(g->numBlocks ? g->numBlocks : 1, sizeof(cfg_block));
+        err = g->blocks == NULL;
+    }
+
+    if(!err) {
+        int b = -1;
+        for(size_t i=0; i<g->numSlots; i++) {
+            if(leader[i]) {
+                g->blocks[++b].start = TEXT_ADDRESS + 4 * i;
+            }
+            g->blocks[b].end = TEXT_ADDRESS + 4 * (i + 1);
+            g->blockOf[i] = b;
+        }
+        link_blocks(g, insts, targets);
+
+        // Roots: the entry point and every function called
+        uint8_t* isRoot = calloc(g->numBlocks ? g->numBlocks : 1, 1);
+        pred_lists p = {NULL, NULL};
+        err = isRoot == NULL || build_preds(g, &p) != 0;
+        if(!err && g->numBlocks > 0) {
+            long entrySlot = slot_of(g, entry);
+            if(entrySlot != CFG_NONE) {
+                isRoot[g->blockOf[entrySlot]] = 1;
+            }
+            for(size_t i=0; i<g->numSlots; i++) {
+                if(called[i]) {
+                    isRoot[g->blockOf[i]] = 1;
+                }
+            }
+            err = compute_dominators(g, isRoot, &p) != 0 || find_loops(g, &p) != 0;
+        }
+        free(isRoot);
+        free(p.first);
+        free(p.preds);
+    }
+
+    free(insts);
+    free(leader);
+    free(called);
+    free(targets);
+    if(err) {
+        cfg_free(g);
+        return -1;
+    }
+    return 0;
+}
+
+int cfg_load(cfg* g, const byte* execFile) {
+    return cfg_build(g, &execFile[TEXT_START_LOC], get32(&execFile[TEXT_SIZE_LOC]),
+                     get32(&execFile[PC_INIT_LOC]));
+}
+
+int cfg_block_at(const cfg* g, uint32_t addr) {
+    uint32_t offset = addr - TEXT_ADDRESS;
+    return offset / 4 < g->numSlots ? g->blockOf[offset / 4] : CFG_NONE;
+}
+
+int cfg_dominates(const cfg* g, int a, int b) {
+    while(b != CFG_NONE && b != a) {
+        b = g->blocks[b].idom;
+    }
+    return b == a;
+}
+
+void cfg_write_dot(const cfg* g, FILE* out) {
+    static const char* exits[] = {
+        "", "", "", "call", "return", "indirect", "stop"
+    };
+
+    fprintf(out, "digraph cfg {\n");
+    fprintf(out, "    label=\"%d blocks, %d loops, %d indirect jumps resolved\";\n",
+            g->numBlocks, g->numLoops, g->numResolved);
+    fprintf(out, "    node [shape=box fontname=\"monospace\"];\n");
+    for(int b=0; b<g->numBlocks; b++) {
+        const cfg_block* block = &g->blocks[b];
+        if(block->start == g->entry) {
+            fprintf(out, "    entry [shape=plaintext];\n    entry -> b%d;\n", b);
+        }
+        fprintf(out, "    b%d [label=\"", b);
+        if(block->loop == b) {
+            fprintf(out, "loop header, depth %d\\l", block->depth);
+        } else if(block->loop != CFG_NONE) {
+            fprintf(out, "in loop b%d, depth %d\\l", block->loop, block->depth);
+        }
+        for(uint32_t addr=block->start; addr<block->end; addr+=4) {
+            char disasm[64];
+            decode_disasm(get32(&g->text[addr - TEXT_ADDRESS]), addr, disasm, sizeof(disasm));
+            fprintf(out, "0x%08X  %s\\l", addr, disasm);
+        }
+        fprintf(out, "%s\"%s];\n", exits[block->exit], block->reachable ? "" : " style=dashed");
+
+        for(int s=0; s<2; s++) {
+            int succ = block->succ[s];
+            if(succ == CFG_NONE) {
+                continue;
+            }
+            if(cfg_dominates(g, succ, b)) {
+                fprintf(out, "    b%d -> b%d [color=red];\n", b, succ);
+            } else {
+                fprintf(out, "    b%d -> b%d%s;\n", b, succ,
+                        block->exit == CFG_BRANCH && s == 1 ? " [label=taken]" : "");
+            }
+        }
+        if(block->callee != CFG_NONE) {
+            fprintf(out, "    b%d -> b%d [style=dotted];\n", b, block->callee);
+        }
+    }
+    fprintf(out, "}\n");
+}
+
+void cfg_free(cfg* g) {
+    free(g->blocks);
+    free(g->blockOf);
+    g->blocks = NULL;
+    g->blockOf = NULL;
+    g->numBlocks = 0;
+    g->numSlots = 0;
+}
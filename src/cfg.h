@@ -0,0 +1,107 @@
+#ifndef GSIM_CFG_H
+#define GSIM_CFG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "simulator.h"
+
+/**
+ * Static control-flow graph of a program's text segment.
+ *
+ * Built at load time, before anything executes. Block leaders are the
+ * entry point, branch and jump targets and the instructions following a
+ * control transfer. A jr or jalr whose register was built from constants
+ * by lui, ori and addiu earlier in the same block gets its target resolved;
+ * jr $ra is a return and any other jr is left indirect. Calls fall through
+ * to their return site and record the block they call, so each function
+ * body stays a separate region rooted at its entry.
+ *
+ * Dominators are computed over all roots, the entry point and every call
+ * target, and natural loops are found from the back edges to a block
+ * dominating their source. Engines can use the graph to build blocks ahead
+ * of time or hoist checks out of loops, and gsim --cfg-dot writes it out
+ * for inspecting guest hot loops.
+ */
+
+#define CFG_NONE -1
+
+typedef enum cfg_exit {
+    CFG_FALLTHROUGH,    // Last instruction does not transfer control
+    CFG_BRANCH,         // Conditional branch, fall-through then target
+    CFG_JUMP,           // j, or jr with a resolved target
+    CFG_CALL,           // jal or jalr, continues at the return site
+    CFG_RETURN,         // jr $ra
+    CFG_INDIRECT,       // jr with an unknown target
+    CFG_STOP            // break or an invalid instruction
+} cfg_exit;
+
+typedef struct cfg_block {
+    uint32_t start;     // Address of the first instruction
+    uint32_t end;       // Address past the last instruction
+    int succ[2];        // Successors, CFG_NONE when absent
+    int callee;         // Block called by a CFG_CALL, CFG_NONE if unknown
+    int idom;           // Immediate dominator, CFG_NONE for roots and unreachable blocks
+    int loop;           // Header of the innermost loop containing the block
+    int depth;          // Number of loops containing the block
+    uint8_t exit;       // cfg_exit
+    uint8_t reachable;
+} cfg_block;
+
+typedef struct cfg {
+    cfg_block* blocks;
+    int numBlocks;
+    int* blockOf;       // Block of each instruction of the text segment
+    size_t numSlots;
+    const byte* text;   // Instructions it was built from, not owned
+    uint32_t entry;
+    int numLoops;
+    int numResolved;    // jr and jalr targets resolved from constants
+} cfg;
+
+/**
+ * Build the graph of a text segment.
+ * @param g - Filled with the graph
+ * @param text - Instructions, in the file's byte order. Must stay valid
+ *                  for cfg_write_dot().
+ * @param textSize - Size of the text segment in bytes
+ * @param entry - Address execution starts at
+ * @return 0 on success, -1 if out of memory
+ */
+int cfg_build(cfg* g, const byte* text, size_t textSize, uint32_t entry);
+
+/**
+ * Build the graph of an executable, reading the text segment and entry
+ * point from the same header fields as sim_init().
+ * @param g - Filled with the graph
+ * @param execFile - Contents of the executable file
+ * @return 0 on success, -1 if out of memory
+ */
+int cfg_load(cfg* g, const byte* execFile);
+
+/**
+ * @return Block containing addr, or CFG_NONE if it is outside the text
+ *          segment
+ */
+int cfg_block_at(const cfg* g, uint32_t addr);
+
+/**
+ * @return Nonzero if every path from a root to block b goes through block a
+ */
+int cfg_dominates(const cfg* g, int a, int b);
+
+/**
+ * Write the graph in Graphviz DOT format, one node per block listing its
+ * disassembled instructions.
+ * @param g - Graph
+ * @param out - Destination
+ */
+void cfg_write_dot(const cfg* g, FILE* out);
+
+/**
+ * Free the graph.
+ */
+void cfg_free(cfg* g);
+
+#endif // GSIM_CFG_H
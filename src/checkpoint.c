@@ -0,0 +1,240 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "simulator.h"
+#include "checkpoint.h"
+#include "decode.h"
+
+#define HEADER_COUNT_LOC 0x10
+#define HEADER_REGS_LOC 0x18
+#define HEADER_SIZES_LOC 0xa4
+#define HEADER_PAGES_LOC 0xb0
+#define HEADER_SIZE 0xb4
+#define PAGE_ENTRY_SIZE 8
+
+
+extern byte* text;
+extern byte* data;
+extern CPU_LOCAL byte* stack;
+
+extern size_t textSize;
+extern size_t dataSize;
+extern CPU_LOCAL size_t stackSize;
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL reg hi;
+extern CPU_LOCAL reg lo;
+
+extern CPU_LOCAL uint64_t instCount;
+
+static uint64_t ckptAt;
+static uint64_t ckptEvery;
+static const char* ckptPrefix = "gsim";
+
+
+static uint32_t get32(byte* src) {
+    return ((uint32_t) src[0] << 24) + ((uint32_t) src[1] << 16) +
+            ((uint32_t) src[2] << 8) + src[3];
+}
+
+static void put32(byte* dest, uint32_t i) {
+    dest[0] = i >> 24 & 0xFF;
+    dest[1] = i >> 16 & 0xFF;
+    dest[2] = i >> 8 & 0xFF;
+    dest[3] = i & 0xFF;
+}
+
+static int page_is_zero(byte* page, size_t len) {
+    // Each byte equals the next one and the first is zero
+    return len == 0 || (page[0] == 0 && memcmp(page, page + 1, len - 1) == 0);
+}
+
+void checkpoint_at(uint64_t count) {
+    ckptAt = count;
+}
+
+void checkpoint_every(uint64_t interval) {
+    ckptEvery = interval;
+}
+
+void checkpoint_prefix(const char* prefix) {
+    ckptPrefix = prefix;
+}
+
+uint64_t checkpoint_next(uint64_t now) {
+    uint64_t next = UINT64_MAX;
+    if(ckptAt > now) {
+        next = ckptAt;
+    }
+    if(ckptEvery != 0 && now / ckptEvery * ckptEvery + ckptEvery < next) {
+        next = now / ckptEvery * ckptEvery + ckptEvery;
+    }
+    return next;
+}
+
+int checkpoint_save() {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    byte* segs[3] = {text, data, stack};
+    size_t sizes[3] = {textSize, dataSize, stackSize};
+
+    // Count pages worth storing
+    uint32_t pageCount = 0;
+    for(int s=0; s<3; s++) {
+        for(size_t off=0; off<sizes[s]; off+=pageSize) {
+            size_t len = sizes[s] - off < pageSize ? sizes[s] - off : pageSize;
+            pageCount += !page_is_zero(&segs[s][off], len);
+        }
+    }
+
+    size_t tableEnd = HEADER_SIZE + (size_t) pageCount * PAGE_ENTRY_SIZE;
+    size_t headerLen = ((tableEnd - 1) | (pageSize - 1)) + 1;
+    byte* header = calloc(headerLen, 1);
+
+    memcpy(header, CHECKPOINT_MAGIC, 8);
+    put32(&header[0x08], CHECKPOINT_VERSION);
+    put32(&header[0x0c], pageSize);
+    put32(&header[HEADER_COUNT_LOC], instCount >> 32);
+    put32(&header[HEADER_COUNT_LOC + 4], instCount & 0xFFFFFFFF);
+    for(int i=0; i<NUM_REGISTERS; i++) {
+        put32(&header[HEADER_REGS_LOC + 4 * i], registers[i]);
+    }
+    put32(&header[HEADER_REGS_LOC + 4 * NUM_REGISTERS], pc);
+    put32(&header[HEADER_REGS_LOC + 4 * NUM_REGISTERS + 4], hi);
+    put32(&header[HEADER_REGS_LOC + 4 * NUM_REGISTERS + 8], lo);
+    for(int s=0; s<3; s++) {
+        put32(&header[HEADER_SIZES_LOC + 4 * s], sizes[s]);
+    }
+    put32(&header[HEADER_PAGES_LOC], pageCount);
+
+    byte* entry = &header[HEADER_SIZE];
+    for(int s=0; s<3; s++) {
+        for(size_t off=0; off<sizes[s]; off+=pageSize) {
+            size_t len = sizes[s] - off < pageSize ? sizes[s] - off : pageSize;
+            if(!page_is_zero(&segs[s][off], len)) {
+                put32(entry, s);
+                put32(entry + 4, off / pageSize);
+                entry += PAGE_ENTRY_SIZE;
+            }
+        }
+    }
+
+    char fileName[4096];
+    snprintf(fileName, sizeof(fileName), "%s.%llu.ckpt", ckptPrefix, (unsigned long long) instCount);
+    FILE* file = fopen(fileName, "wb");
+    if(file == NULL) {
+        fprintf(stderr, "Could not create checkpoint \"%s\"\n", fileName);
+        free(header);
+        return -1;
+    }
+    fwrite(header, 1, headerLen, file);
+
+    // Segments are allocated in whole pages, so a full page can always be written
+    for(int s=0; s<3; s++) {
+        for(size_t off=0; off<sizes[s]; off+=pageSize) {
+            size_t len = sizes[s] - off < pageSize ? sizes[s] - off : pageSize;
+            if(!page_is_zero(&segs[s][off], len)) {
+                fwrite(&segs[s][off], 1, pageSize, file);
+            }
+        }
+    }
+
+    int failed = ferror(file);
+    failed |= fclose(file);
+    free(header);
+    if(failed) {
+        fprintf(stderr, "Could not write checkpoint \"%s\"\n", fileName);
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_restore(const char* fileName) {
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+
+    byte fixed[HEADER_SIZE];
+    if(pread(fd, fixed, HEADER_SIZE, 0) != HEADER_SIZE
+       || memcmp(fixed, CHECKPOINT_MAGIC, 8) != 0
+       || get32(&fixed[0x08]) != CHECKPOINT_VERSION) {
+        close(fd);
+        return -1;
+    }
+
+    size_t filePageSize = get32(&fixed[0x0c]);
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    uint32_t pageCount = get32(&fixed[HEADER_PAGES_LOC]);
+    size_t sizes[3];
+    for(int s=0; s<3; s++) {
+        sizes[s] = get32(&fixed[HEADER_SIZES_LOC + 4 * s]);
+    }
+    if(filePageSize == 0 || (filePageSize & (filePageSize - 1)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t tableLen = (size_t) pageCount * PAGE_ENTRY_SIZE;
+    size_t headerLen = ((HEADER_SIZE + tableLen - 1) | (filePageSize - 1)) + 1;
+    byte* table = malloc(tableLen + 1);
+    if(pread(fd, table, tableLen, HEADER_SIZE) != (ssize_t) tableLen) {
+        free(table);
+        close(fd);
+        return -1;
+    }
+
+    byte* segs[3];
+    for(int s=0; s<3; s++) {
+        segs[s] = sim_alloc_segment(sizes[s]);
+    }
+
+    // Map pages in place when the page sizes agree, copy them otherwise
+    int failed = 0;
+    for(uint32_t p=0; p<pageCount && !failed; p++) {
+        uint32_t s = get32(&table[p * PAGE_ENTRY_SIZE]);
+        size_t off = (size_t) get32(&table[p * PAGE_ENTRY_SIZE + 4]) * filePageSize;
+        off_t fileOff = headerLen + (off_t) p * filePageSize;
+        if(s > 2 || off >= sizes[s] || segs[s] == NULL) {
+            failed = 1;
+        } else if(filePageSize == pageSize) {
+            failed = mmap(&segs[s][off], pageSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, fileOff) == MAP_FAILED;
+        } else {
+            size_t len = sizes[s] - off < filePageSize ? sizes[s] - off : filePageSize;
+            failed = pread(fd, &segs[s][off], len, fileOff) != (ssize_t) len;
+        }
+    }
+    free(table);
+    close(fd);
+
+    if(failed) {
+        for(int s=0; s<3; s++) {
+            sim_free_segment(segs[s], sizes[s]);
+        }
+        return -1;
+    }
+
+    text = segs[CHECKPOINT_SEG_TEXT];
+    data = segs[CHECKPOINT_SEG_DATA];
+    stack = segs[CHECKPOINT_SEG_STACK];
+    textSize = sizes[CHECKPOINT_SEG_TEXT];
+    dataSize = sizes[CHECKPOINT_SEG_DATA];
+    stackSize = sizes[CHECKPOINT_SEG_STACK];
+    decode_init();
+
+    instCount = ((uint64_t) get32(&fixed[HEADER_COUNT_LOC]) << 32) | get32(&fixed[HEADER_COUNT_LOC + 4]);
+    for(int i=0; i<NUM_REGISTERS; i++) {
+        registers[i] = get32(&fixed[HEADER_REGS_LOC + 4 * i]);
+    }
+    pc = get32(&fixed[HEADER_REGS_LOC + 4 * NUM_REGISTERS]);
+    hi = get32(&fixed[HEADER_REGS_LOC + 4 * NUM_REGISTERS + 4]);
+    lo = get32(&fixed[HEADER_REGS_LOC + 4 * NUM_REGISTERS + 8]);
+    return 0;
+}
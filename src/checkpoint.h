@@ -0,0 +1,72 @@
+#ifndef GSIM_CHECKPOINT_H
+#define GSIM_CHECKPOINT_H
+
+#include <stdint.h>
+
+/**
+ * Checkpoint file layout. All header fields are big-endian, like the R2K
+ * executables themselves.
+ *
+ * 0x00  magic "GSIMCKPT"
+ * 0x08  version
+ * 0x0c  page size the file was written with
+ * 0x10  instructions executed (64 bit)
+ * 0x18  registers $0 - $31, then pc, hi and lo
+ * 0xa4  text, data and stack segment sizes
+ * 0xb0  number of stored pages
+ * 0xb4  page table: one { segment, page index } pair of words per page
+ *
+ * Page contents follow the header, each one aligned on a page boundary of
+ * the file so it can be mapped straight into the restored segment. Pages
+ * containing only zeroes are not stored.
+ */
+
+#define CHECKPOINT_MAGIC "GSIMCKPT"
+#define CHECKPOINT_VERSION 1
+
+#define CHECKPOINT_SEG_TEXT 0
+#define CHECKPOINT_SEG_DATA 1
+#define CHECKPOINT_SEG_STACK 2
+
+/**
+ * Schedule a single checkpoint.
+ * @param count - Number of executed instructions to checkpoint after
+ */
+void checkpoint_at(uint64_t count);
+
+/**
+ * Schedule periodic checkpoints.
+ * @param interval - Number of instructions between checkpoints
+ */
+void checkpoint_every(uint64_t interval);
+
+/**
+ * Set the prefix of checkpoint file names. Files are named
+ * PREFIX.COUNT.ckpt where COUNT is the number of executed instructions.
+ * @param prefix - File name prefix, "gsim" by default
+ */
+void checkpoint_prefix(const char* prefix);
+
+/**
+ * Instruction count at which the next checkpoint is due.
+ * @param now - Instructions executed so far
+ * @return Count of the next checkpoint after now, or UINT64_MAX if none
+ */
+uint64_t checkpoint_next(uint64_t now);
+
+/**
+ * Write the current machine state to a new checkpoint file.
+ * @return 0 on success, -1 on failure
+ */
+int checkpoint_save();
+
+/**
+ * Replace the machine state with the contents of a checkpoint file.
+ * Stored pages are mapped copy-on-write from the file when its page size
+ * matches the host's, and read into the segments otherwise.
+ * @param fileName - Path of the checkpoint file
+ * @return 0 on success, -1 if the file is missing or invalid
+ */
+int checkpoint_restore(const char* fileName);
+
+#endif // GSIM_CHECKPOINT_H
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "fileReader.h"
+
+#define CACHE_ENTRIES 32
+#define POLL_INTERVAL (1 << 20)     // Instructions between checks that the client is still there
+#define INPUT_CHUNK 65536
+
+
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL uint64_t instCount;
+
+/**
+ * Executable kept in memory by a worker.
+ */
+typedef struct cached_exec {
+    char* path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    byte* file;
+    size_t fileSize;
+} cached_exec;
+
+/**
+ * Standard output of the running job.
+ */
+typedef struct job_output {
+    int conn;
+    uint64_t written;
+    uint64_t max;
+    int exceeded;
+    int gone;           // The client went away
+} job_output;
+
+/**
+ * Standard input of a running job streamed by its client.
+ */
+typedef struct job_input {
+    int conn;
+    uint32_t left;      // Bytes of the current DAEMON_INPUT frame not read yet
+    int ended;
+    job_output* output;
+    FILE* out;
+} job_input;
+
+static cached_exec cache[CACHE_ENTRIES];
+static int nextEvicted;
+static volatile sig_atomic_t stopping;
+
+
+static int read_full(int fd, void* buf, size_t len) {
+    byte* p = buf;
+    while(len > 0) {
+        ssize_t n = read(fd, p, len);
+        if(n <= 0 && !(n < 0 && errno == EINTR)) {
+            return -1;
+        }
+        p += n > 0 ? n : 0;
+        len -= n > 0 ? n : 0;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void* buf, size_t len) {
+    const byte* p = buf;
+    while(len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n < 0 && errno != EINTR) {
+            return -1;
+        }
+        p += n > 0 ? n : 0;
+        len -= n > 0 ? n : 0;
+    }
+    return 0;
+}
+
+static int send_frame(int conn, daemon_frame_type type, const void* payload, uint32_t len) {
+    daemon_frame frame = {type, len};
+    return write_full(conn, &frame, sizeof(frame)) != 0 || write_full(conn, payload, len) != 0 ? -1 : 0;
+}
+
+/**
+ * Contents of an executable, read again only when the file changed.
+ * @param fileSize - Set to the length of the contents
+ * @return Contents, owned by the cache, or NULL if it cannot be read
+ */
+static byte* cached_file(char* path, size_t* fileSize) {
+    struct stat st;
+    if(stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return NULL;
+    }
+    cached_exec* c = NULL;
+    for(int i=0; i<CACHE_ENTRIES && c == NULL; i++) {
+        if(cache[i].path != NULL && strcmp(cache[i].path, path) == 0) {
+            c = &cache[i];
+        }
+    }
+    if(c != NULL && c->dev == st.st_dev && c->ino == st.st_ino && c->size == st.st_size
+       && c->mtime.tv_sec == st.st_mtim.tv_sec && c->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        *fileSize = c->fileSize;
+        return c->file;
+    }
+    if(c == NULL) {
+        c = &cache[nextEvicted];
+        nextEvicted = (nextEvicted + 1) % CACHE_ENTRIES;
+    }
+    free(c->path);
+    free(c->file);
+    c->path = strdup(path);
+    c->file = readFile(path, &c->fileSize);
+    c->dev = st.st_dev;
+    c->ino = st.st_ino;
+    c->size = st.st_size;
+    c->mtime = st.st_mtim;
+    *fileSize = c->fileSize;
+    return c->file;
+}
+
+/**
+ * Write function of a job's standard output, sending it to the client.
+ */
+static ssize_t write_output(void* cookie, const char* buf, size_t size) {
+    job_output* o = cookie;
+    size_t len = size;
+    if(o->max != 0 && o->written + len > o->max) {
+        len = o->max - o->written;
+        o->exceeded = 1;
+    }
+    if(len > 0 && !o->gone && send_frame(o->conn, DAEMON_OUTPUT, buf, len) != 0) {
+        o->gone = 1;
+    }
+    o->written += len;
+    // What goes past the limit is dropped
+    return size;
+}
+
+/**
+ * Read function of a job's streamed standard input.
+ */
+static ssize_t read_input(void* cookie, char* buf, size_t size) {
+    job_input* in = cookie;
+    while(in->left == 0 && !in->ended) {
+        // The program waits for the client, which must see its prompt first
+        fflush(in->out);
+        daemon_frame frame;
+        if(read_full(in->conn, &frame, sizeof(frame)) != 0 || frame.type != DAEMON_INPUT) {
+            in->output->gone = 1;
+            in->ended = 1;
+        } else {
+            in->left = frame.len;
+            in->ended = frame.len == 0;
+        }
+    }
+    size_t len = size < in->left ? size : in->left;
+    if(len > 0 && read_full(in->conn, buf, len) != 0) {
+        in->output->gone = 1;
+        in->ended = 1;
+        len = 0;
+    }
+    in->left = in->ended ? 0 : in->left - len;
+    return len;
+}
+
+static int client_gone(int conn) {
+    // The client may still send input, only the end of the connection counts
+    struct pollfd p = {conn, POLLRDHUP, 0};
+    return poll(&p, 1, 0) > 0 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0;
+}
+
+/**
+ * Run the loaded job until it stops or hits a limit.
+ */
+static err_code run_job(const daemon_job* job, job_output* o) {
+    uint64_t limit = job->maxInsts != 0 ? job->maxInsts : UINT64_MAX;
+    err_code err;
+    do {
+        err = sim_execute(limit - instCount > POLL_INTERVAL ? instCount + POLL_INTERVAL : limit);
+        o->gone |= client_gone(o->conn);
+    } while(err_continues(err) && instCount < limit && !o->exceeded && !o->gone);
+    return err;
+}
+
+/**
+ * Read a job from a connection, run it and send its output and result.
+ */
+static void serve_job(int conn) {
+    daemon_job job;
+    daemon_result result = {DAEMON_BAD_JOB, SUCCESS, 0};
+    if(read_full(conn, &job, sizeof(job)) != 0) {
+        return;
+    }
+    if(memcmp(job.magic, DAEMON_MAGIC, sizeof(job.magic)) != 0 || job.version != DAEMON_VERSION
+       || job.argc == 0 || job.argLen > DAEMON_MAX_ARGS
+       || (job.inputLen > DAEMON_MAX_INPUT && job.inputLen != DAEMON_STREAMED_INPUT)) {
+        send_frame(conn, DAEMON_RESULT, &result, sizeof(result));
+        return;
+    }
+
+    int streamed = job.inputLen == DAEMON_STREAMED_INPUT;
+    size_t inputLen = streamed ? 0 : job.inputLen;
+    char* args = malloc(job.argLen + 1);
+    char** argv = malloc((job.argc + 1) * sizeof(char*));
+    char* input = malloc(inputLen + 1);
+    if(args == NULL || argv == NULL || input == NULL
+       || read_full(conn, args, job.argLen) != 0 || read_full(conn, input, inputLen) != 0) {
+        free(args);
+        free(argv);
+        free(input);
+        return;
+    }
+    // sim_init() takes the program name as argv[1]
+    args[job.argLen] = '\0';
+    argv[0] = "gsimd";
+    uint32_t argc = 1;
+    for(char* arg = args; arg < args + job.argLen && argc <= job.argc; arg += strlen(arg) + 1) {
+        argv[argc++] = arg;
+    }
+
+    // A malformed executable must not take the worker down with it
+    size_t fileSize = 0;
+    byte* execFile = argc == job.argc + 1 ? cached_file(argv[1], &fileSize) : NULL;
+    const char* problem = NULL;
+    if(execFile == NULL) {
+        problem = "File \"%s\" does not exist!\n";
+    } else if(sim_check_exec(execFile, fileSize) != 0) {
+        problem = "\"%s\" is not a valid executable!\n";
+    } else if(sim_init(execFile, argc, argv) != 0) {
+        problem = "Could not allocate the segments of \"%s\"\n";
+    }
+    if(problem != NULL) {
+        char msg[PATH_MAX + 64];
+        int len = snprintf(msg, sizeof(msg), problem, argc > 1 ? argv[1] : "");
+        send_frame(conn, DAEMON_ERROR, msg, len < (int) sizeof(msg) ? len : (int) sizeof(msg) - 1);
+    } else {
+        job_output o = {conn, 0, job.maxOutput, 0, 0};
+        cookie_io_functions_t io = {NULL, write_output, NULL, NULL};
+        FILE* out = fopencookie(&o, "w", io);
+        job_input i = {conn, 0, 0, &o, out};
+        cookie_io_functions_t inIo = {read_input, NULL, NULL, NULL};
+        FILE* in = streamed ? fopencookie(&i, "r", inIo)
+                   : inputLen > 0 ? fmemopen(input, inputLen, "r") : fopen("/dev/null", "r");
+        syscall_streams(in, out);
+        err_code err = run_job(&job, &o);
+        syscall_streams(NULL, NULL);
+        fclose(out);
+        fclose(in);
+
+        char* msg = NULL;
+        size_t len = 0;
+        FILE* m = open_memstream(&msg, &len);
+        if(!err_continues(err)) {
+            result.status = DAEMON_STOPPED;
+            sim_print_error(m, err);
+        } else if(o.exceeded) {
+            result.status = DAEMON_OUTPUT_LIMIT;
+            fprintf(m, "Output limit of %llu bytes reached. pc=0x%X", (unsigned long long) job.maxOutput, pc);
+        } else {
+            result.status = DAEMON_INST_LIMIT;
+            fprintf(m, "Instruction limit of %llu reached. pc=0x%X", (unsigned long long) job.maxInsts, pc);
+        }
+        fclose(m);
+        if(len > 0) {
+            send_frame(conn, DAEMON_ERROR, msg, len);
+        }
+        free(msg);
+        result.err = err;
+        result.instCount = instCount;
+        sim_exit();
+    }
+    send_frame(conn, DAEMON_RESULT, &result, sizeof(result));
+    free(args);
+    free(argv);
+    free(input);
+}
+
+static void run_worker(int listenFd) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    for(;;) {
+        int conn = accept(listenFd, NULL, NULL);
+        if(conn < 0 && errno != EINTR && errno != ECONNABORTED) {
+            _exit(EXIT_FAILURE);
+        } else if(conn >= 0) {
+            serve_job(conn);
+            close(conn);
+        }
+    }
+}
+
+static void stop(int sig) {
+    (void) sig;
+    stopping = 1;
+}
+
+int daemon_serve(const char* socketPath, int workers) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(socketPath) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if(fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        if(fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    // Without SA_RESTART, so wait() returns on them
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pid_t* pids = calloc(workers, sizeof(pid_t));
+    while(!stopping) {
+        for(int i=0; i<workers && !stopping; i++) {
+            if(pids[i] == 0) {
+                pids[i] = fork();
+                if(pids[i] == 0) {
+                    run_worker(fd);
+                }
+                pids[i] = pids[i] > 0 ? pids[i] : 0;
+            }
+        }
+        pid_t dead = wait(NULL);
+        if(dead < 0 && errno == ECHILD) {
+            // No worker could be started, try again later
+            sleep(1);
+        }
+        for(int i=0; i<workers; i++) {
+            pids[i] = pids[i] == dead ? 0 : pids[i];
+        }
+    }
+
+    for(int i=0; i<workers; i++) {
+        if(pids[i] > 0) {
+            kill(pids[i], SIGTERM);
+            waitpid(pids[i], NULL, 0);
+        }
+    }
+    free(pids);
+    close(fd);
+    unlink(socketPath);
+    return 0;
+}
+
+/**
+ * Read a frame from the worker and print it, or take the result from it.
+ * @return 1 for the result, 0 for other frames, -1 on failure
+ */
+static int receive_frame(int conn, daemon_result* result) {
+    daemon_frame frame;
+    if(read_full(conn, &frame, sizeof(frame)) != 0) {
+        return -1;
+    }
+    char* buf = malloc(frame.len + 1);
+    if(buf == NULL || read_full(conn, buf, frame.len) != 0) {
+        free(buf);
+        return -1;
+    }
+    int got = 0;
+    if(frame.type == DAEMON_OUTPUT) {
+        fwrite(buf, 1, frame.len, stdout);
+        fflush(stdout);
+    } else if(frame.type == DAEMON_ERROR) {
+        fflush(stdout);
+        fwrite(buf, 1, frame.len, stderr);
+    } else if(frame.type == DAEMON_RESULT && frame.len == sizeof(*result)) {
+        memcpy(result, buf, sizeof(*result));
+        got = 1;
+    }
+    free(buf);
+    return got;
+}
+
+int daemon_submit(const char* socketPath, int argc, char* argv[], uint64_t maxInsts, daemon_result* result) {
+    char* path = realpath(argv[0], NULL);
+    if(path == NULL) {
+        fprintf(stderr, "File \"%s\" does not exist!\n", argv[0]);
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(conn < 0 || connect(conn, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Could not connect to gsimd at \"%s\"\n", socketPath);
+        if(conn >= 0) {
+            close(conn);
+        }
+        free(path);
+        return -1;
+    }
+
+    daemon_job job;
+    memset(&job, 0, sizeof(job));
+    memcpy(job.magic, DAEMON_MAGIC, sizeof(job.magic));
+    job.version = DAEMON_VERSION;
+    job.argc = argc;
+    job.argLen = strlen(path) + 1;
+    for(int i=1; i<argc; i++) {
+        job.argLen += strlen(argv[i]) + 1;
+    }
+    // Input goes to the job as it arrives, so interactive programs work
+    job.inputLen = DAEMON_STREAMED_INPUT;
+    job.maxInsts = maxInsts;
+    int failed = write_full(conn, &job, sizeof(job)) != 0 || write_full(conn, path, strlen(path) + 1) != 0;
+    for(int i=1; i<argc && !failed; i++) {
+        failed = write_full(conn, argv[i], strlen(argv[i]) + 1) != 0;
+    }
+    free(path);
+
+    // Never blocks sending input, which would deadlock with a worker
+    // blocked sending output
+    byte* pending = malloc(sizeof(daemon_frame) + INPUT_CHUNK);
+    size_t pendingLen = 0;
+    size_t sent = 0;
+    int inputDone = 0;
+    int done = 0;
+    failed = failed || pending == NULL;
+    while(!failed && !done) {
+        struct pollfd fds[2] = {
+            {conn, POLLIN | (sent < pendingLen ? POLLOUT : 0), 0},
+            {inputDone || sent < pendingLen ? -1 : STDIN_FILENO, POLLIN, 0}
+        };
+        if(poll(fds, 2, -1) < 0) {
+            failed = errno != EINTR;
+            continue;
+        }
+        if(fds[0].revents & POLLOUT) {
+            ssize_t n = send(conn, &pending[sent], pendingLen - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            sent += n > 0 ? n : 0;
+        }
+        if(fds[1].revents != 0) {
+            ssize_t n = read(STDIN_FILENO, &pending[sizeof(daemon_frame)], INPUT_CHUNK);
+            if(n >= 0 || errno != EINTR) {
+                daemon_frame frame = {DAEMON_INPUT, n > 0 ? n : 0};
+                memcpy(pending, &frame, sizeof(frame));
+                pendingLen = sizeof(frame) + frame.len;
+                sent = 0;
+                inputDone = n <= 0;
+            }
+        }
+        if(fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            int got = receive_frame(conn, result);
+            failed = got < 0;
+            done = got > 0;
+        }
+    }
+    free(pending);
+    close(conn);
+    fflush(stdout);
+    if(!done) {
+        fprintf(stderr, "gsimd did not finish the job\n");
+        return -1;
+    }
+    return result->status == DAEMON_BAD_JOB ? -1 : 0;
+}
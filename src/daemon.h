@@ -0,0 +1,104 @@
+#ifndef GSIM_DAEMON_H
+#define GSIM_DAEMON_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+
+/**
+ * Simulation server (gsimd) and its client (gsim --client SOCKET).
+ *
+ * gsimd listens on a Unix domain socket and keeps a pool of worker
+ * processes, each accepting jobs on it in turn. A job is one run of an
+ * executable with its arguments and the whole of its standard input. The
+ * worker keeps the executables it has read in memory, keyed by path and
+ * checked against the file's inode, size and modification time, so a job
+ * costs no process startup and no reading of the executable. Workers that
+ * die are replaced.
+ *
+ * A connection carries a single job, in host byte order since both ends
+ * run on the same host. The client sends:
+ *
+ *       daemon_job
+ *       argc strings, each with its terminating NUL, argv[0] being the
+ *           absolute path of the executable
+ *       inputLen bytes of standard input
+ *
+ * and the worker answers with frames, each a daemon_frame then len bytes:
+ * DAEMON_OUTPUT frames of standard output while the program runs, at most
+ * one DAEMON_ERROR frame with the message gsim would print on stderr, then
+ * a DAEMON_RESULT frame holding a daemon_result, after which it closes the
+ * connection. A job whose client closes its end is stopped.
+ *
+ * A job with inputLen DAEMON_STREAMED_INPUT gets its input while it runs
+ * instead, as DAEMON_INPUT frames from the client ending with an empty
+ * one. Its output is flushed whenever it waits for more, so an interactive
+ * program works as it does under gsim.
+ */
+
+#define DAEMON_MAGIC "GSIMJOB"
+#define DAEMON_VERSION 1
+#define DAEMON_DEFAULT_WORKERS 4
+#define DAEMON_MAX_ARGS 4096        // Bytes of argument strings, which go on the 8 KB stack
+#define DAEMON_MAX_INPUT (64 << 20) // Bytes of standard input sent with the job
+#define DAEMON_STREAMED_INPUT UINT64_MAX
+
+typedef struct daemon_job {
+    char magic[8];
+    uint32_t version;
+    uint32_t argc;
+    uint32_t argLen;        // Bytes of the argument strings
+    uint32_t padding;
+    uint64_t inputLen;
+    uint64_t maxInsts;      // Instructions the job may run, 0 for no limit
+    uint64_t maxOutput;     // Bytes it may print, 0 for no limit
+} daemon_job;
+
+typedef enum daemon_frame_type {
+    DAEMON_OUTPUT,
+    DAEMON_ERROR,
+    DAEMON_RESULT,
+    DAEMON_INPUT            // From the client
+} daemon_frame_type;
+
+typedef struct daemon_frame {
+    uint32_t type;
+    uint32_t len;
+} daemon_frame;
+
+typedef enum daemon_status {
+    DAEMON_STOPPED,         // The program stopped by itself, see err
+    DAEMON_INST_LIMIT,
+    DAEMON_OUTPUT_LIMIT,
+    DAEMON_BAD_JOB          // Malformed job, or unreadable or invalid executable
+} daemon_status;
+
+typedef struct daemon_result {
+    uint32_t status;
+    uint32_t err;           // err_code that stopped the program
+    uint64_t instCount;
+} daemon_result;
+
+/**
+ * Serve jobs until SIGINT or SIGTERM.
+ * @param socketPath - Path of the socket, replaced if it exists
+ * @param workers - Number of worker processes
+ * @return 0 once stopped, -1 if the socket cannot be created
+ */
+int daemon_serve(const char* socketPath, int workers);
+
+/**
+ * Run a job on gsimd as gsim would run it, streaming stdin to it as the
+ * job's input and printing its output and error message on stdout and
+ * stderr.
+ * @param socketPath - Socket gsimd listens on
+ * @param argc - Number of arguments, the executable included
+ * @param argv - Executable then its arguments
+ * @param maxInsts - Instructions the job may run, 0 for no limit
+ * @param result - Filled with the result of the job
+ * @return 0 once the job ran, -1 if gsimd cannot be reached or the
+ *          executable does not exist
+ */
+int daemon_submit(const char* socketPath, int argc, char* argv[], uint64_t maxInsts, daemon_result* result);
+
+#endif // GSIM_DAEMON_H
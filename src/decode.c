@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulator.h"
+#include "decode.h"
+
+#define REG_SP 29
+#define REG_RA 31
+
+#define PAGE_SLOTS 1024     // Slots decoded together, a 4 KiB page of text
+
+extern byte* text;
+extern size_t textSize;
+
+dinst* decoded;
+size_t numSlots;
+
+CPU_LOCAL uint32_t returnSlots[RETURN_STACK_SIZE];
+CPU_LOCAL uint32_t returnTop;
+
+static int attached;    // Slots belong to an image cache mapping
+static uint8_t* pagesDecoded;   // Bit of each page whose slots were decoded
+
+/*
+ * Table operation of each encoding: R type instructions by function at
+ * 0 - 63, the others by opcode at 64 - 127.
+ */
+#define ENCODING(opcode, funct) ((opcode) == 0 ? (funct) : 64 + (opcode))
+#define OP_ENCODING(OP, name, opcode, funct, ...) [ENCODING(opcode, funct)] = OP_##OP,
+static const uint8_t encodings[128] = {
+    ALL_OPS(OP_ENCODING)
+};
+#undef OP_ENCODING
+
+#define OP_NAME(OP, name, ...) [OP_##OP] = #name,
+static const char* names[NUM_OPS] = {
+    ALL_OPS(OP_NAME)
+};
+#undef OP_NAME
+
+#define OP_ARGS(OP, name, opcode, funct, args, ...) [OP_##OP] = args,
+static const uint8_t opArgs[NUM_OPS] = {
+    ALL_OPS(OP_ARGS)
+};
+#undef OP_ARGS
+
+static const char* regNames[NUM_REGISTERS] = {
+    "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+    "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+    "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+
+void decode_word(inst word, dinst* d) {
+    uint8_t opcode = word >> 26 & 0x3F;
+
+    d->rs = word >> 21 & 0x1F;
+    d->rt = word >> 16 & 0x1F;
+    d->rd = word >> 11 & 0x1F;
+    d->shamt = word >> 6 & 0x1F;
+    if(opcode == 2 || opcode == 3) {
+        d->imm = word & 0x3FFFFFF;
+    } else {
+        d->imm = (int16_t) (word & 0xFFFF);
+    }
+    d->val = 0;
+    d->base = encodings[ENCODING(opcode, (uint8_t) (word & 0x3F))];
+    if(d->base == OP_DECODE) {
+        d->base = OP_INVALID;
+    }
+    d->op = d->base;
+
+#define OP_CASE(OP, ...) case OP_##OP:
+    switch(d->base) {
+        ALU_OPS(OP_CASE)
+        SHIFT_OPS(OP_CASE)
+            d->dest = d->rd;
+            break;
+        IMM_OPS(OP_CASE)
+        LOAD_OPS(OP_CASE)
+        case OP_LL:
+        case OP_SC:     // Success flag
+            d->dest = d->rt;
+            break;
+        default:
+            d->dest = 0;
+            break;
+    }
+#undef OP_CASE
+    if(d->dest == 0) {
+        d->dest = REG_SINK;
+    }
+}
+
+/**
+ * Unpack the instruction word of a slot, leaving the operation to dispatch
+ * on undecoded.
+ */
+static void fill(size_t slot) {
+    byte* src = &text[slot * 4];
+    decode_word(((inst) src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3], &decoded[slot]);
+    decoded[slot].op = OP_DECODE;
+}
+
+/**
+ * @return Table operation of a slot, unpacking it if needed
+ */
+static uint8_t base_at(size_t slot) {
+    if(decoded[slot].base == OP_DECODE) {
+        fill(slot);
+    }
+    return decoded[slot].base;
+}
+
+/**
+ * Choose the variant of an unfused instruction for its operands.
+ * @return Operation to dispatch on
+ */
+static uint8_t specialize(dinst* d) {
+    switch(d->base) {
+#define ALU_VARIANT(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            if(d->rd == 0 && !FAULTS_##fault) { \
+                return OP_NOP; \
+            } \
+            if(d->rs == 0 && d->rt == 0 && !FAULTS_##fault) { \
+                d->val = alu_##name(0, 0); \
+                return OP_LI; \
+            } \
+            return d->rt == 0 ? OP_##OP##_RZ : d->rs == 0 ? OP_##OP##_LZ : OP_##OP;
+        ALU_OPS(ALU_VARIANT)
+#undef ALU_VARIANT
+
+#define SHIFT_VARIANT(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            if(d->rd == 0) { \
+                return OP_NOP; \
+            } \
+            if(d->rt == 0) { \
+                d->val = shift_##name(0, d->shamt); \
+                return OP_LI; \
+            } \
+            return d->shamt == 0 ? OP_MOVE : OP_##OP;
+        SHIFT_OPS(SHIFT_VARIANT)
+#undef SHIFT_VARIANT
+
+#define IMM_VARIANT(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            if(d->rt == 0 && !FAULTS_##fault) { \
+                return OP_NOP; \
+            } \
+            if((d->rs == 0 || args == ARGS_TI) && !FAULTS_##fault) { \
+                d->val = imm_##name(0, d->imm); \
+                return OP_LI; \
+            } \
+            return OP_##OP;
+        IMM_OPS(IMM_VARIANT)
+#undef IMM_VARIANT
+
+#define BRANCH_VARIANT(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            d->val = (uint32_t) d->imm << 2; \
+            if(d->rs == d->rt) { \
+                return branch_##name(0, 0) ? OP_B : OP_NOP; \
+            } \
+            return d->rt == 0 ? OP_##OP##_RZ : d->rs == 0 ? OP_##OP##_LZ : OP_##OP;
+        BRANCH_OPS(BRANCH_VARIANT)
+#undef BRANCH_VARIANT
+
+        case OP_JAL:
+            return OP_CALL;
+        case OP_JALR:
+            return OP_CALLR;
+        case OP_JR:
+            return d->rs == REG_RA ? OP_RETURN : OP_JR;
+
+        default:
+            return d->base;
+    }
+}
+
+/**
+ * Recognize a fused idiom starting at slot.
+ * @return Fused operation, or OP_DECODE if none applies
+ */
+static uint8_t fuse(size_t slot) {
+    dinst* d = &decoded[slot];
+    if(slot + 1 >= numSlots) {
+        return OP_DECODE;
+    }
+    dinst* n = &decoded[slot + 1];
+    uint8_t next = base_at(slot + 1);
+
+    switch(d->base) {
+        case OP_LUI:
+            if(next == OP_ORI && n->rs == d->rt) {
+                return OP_LUI_ORI;
+            }
+            if(next == OP_ADDIU && n->rs == d->rt) {
+                return OP_LUI_ADDIU;
+            }
+            break;
+        case OP_SLT:
+        case OP_SLTU:
+            if((next == OP_BEQ || next == OP_BNE)
+               && ((n->rs == d->rd && n->rt == 0) || (n->rs == 0 && n->rt == d->rd))) {
+                if(d->base == OP_SLT) {
+                    return next == OP_BEQ ? OP_SLT_BEQ : OP_SLT_BNE;
+                }
+                return next == OP_BEQ ? OP_SLTU_BEQ : OP_SLTU_BNE;
+            }
+            break;
+        case OP_ADDIU:
+            if(d->rs == REG_SP && d->rt == REG_SP) {
+                if(next == OP_SW && n->rs == REG_SP) {
+                    return OP_ADDIU_SW;
+                }
+                if(next == OP_JR) {
+                    return OP_ADDIU_JR;
+                }
+            }
+            break;
+        case OP_SLL:
+            if(d->shamt == 2 && next == OP_ADDU && (n->rs == d->rd || n->rt == d->rd)
+               && slot + 2 < numSlots && base_at(slot + 2) == OP_LW
+               && decoded[slot + 2].rs == n->rd) {
+                return OP_SLL_ADDU_LW;
+            }
+            break;
+        default:
+            break;
+    }
+    return OP_DECODE;
+}
+
+/**
+ * @return Index of register r among the counters of a loop, -1 if the loop
+ *          does not count it
+ */
+static int find_counter(const spin_loop* loop, uint8_t r) {
+    for(int c=0; c<loop->numCounters; c++) {
+        if(loop->reg[c] == r) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @return What the instructions of a loop seen so far add to register r
+ */
+static reg counted(const spin_loop* loop, uint8_t r) {
+    int c = find_counter(loop, r);
+    return c < 0 ? 0 : loop->inc[c];
+}
+
+/**
+ * Count an addiu r, r, imm of a loop.
+ */
+static void add_counter(spin_loop* loop, uint8_t r, reg imm) {
+    int c = find_counter(loop, r);
+    if(c < 0) {
+        c = loop->numCounters++;
+        loop->reg[c] = r;
+        loop->inc[c] = 0;
+    }
+    loop->inc[c] = (uint32_t) loop->inc[c] + imm;
+}
+
+int decode_spin(size_t slot, spin_loop* loop) {
+    loop->numCounters = 0;
+    for(int len=1; len<=MAX_SPIN_LEN && slot + len <= numSlots; len++) {
+        size_t s = slot + len - 1;
+        uint8_t base = base_at(s);
+        dinst* d = &decoded[s];
+        if(base == OP_BNE && d->imm == -len) {
+            loop->len = len;
+            loop->rs = d->rs;
+            loop->rt = d->rt;
+            return 1;
+        } else if(base == OP_ADDIU && d->rs == d->rt && d->rt != 0) {
+            add_counter(loop, d->rt, d->imm);
+        } else if(base != OP_SLL || d->rd != 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return Bytes accessed by a load or store, 0 for other operations
+ */
+static int load_size(uint8_t op) {
+    switch(op) {
+#define SIZE_CASE(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            return MEM_SIZE_##fault;
+        LOAD_OPS(SIZE_CASE)
+        default:
+            return 0;
+    }
+}
+
+static int store_size(uint8_t op) {
+    switch(op) {
+        STORE_OPS(SIZE_CASE)
+#undef SIZE_CASE
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Check that the registers of a loop body move the way bulk_loop describes
+ * once its closing bne is found, and tell scans from counted loops.
+ * @param loadFirst - Nonzero if the load comes before the store
+ */
+static int check_bulk(bulk_loop* loop, int loadFirst) {
+    const spin_loop* c = &loop->counted;
+    if(loop->load != OP_DECODE) {
+        if(loop->value == 0 || find_counter(c, loop->value) >= 0
+           || counted(c, loop->src) != loop->size) {
+            return 0;
+        }
+        if(c->rs == loop->value || c->rt == loop->value) {
+            if((c->rs == loop->value ? c->rt : c->rs) != 0) {
+                return 0;
+            }
+            loop->scan = 1;
+        }
+    }
+    if(loop->store != OP_DECODE) {
+        if(counted(c, loop->dest) != loop->size) {
+            return 0;
+        }
+        if(loop->load != OP_DECODE && loop->stored == loop->value) {
+            // Storing the value loaded by the previous iteration is no copy
+            return loadFirst;
+        }
+        return find_counter(c, loop->stored) < 0;
+    }
+    return loop->load != OP_DECODE;
+}
+
+int decode_bulk(size_t slot, bulk_loop* loop) {
+    spin_loop* c = &loop->counted;
+    int loadFirst = 0;
+    c->numCounters = 0;
+    loop->load = OP_DECODE;
+    loop->store = OP_DECODE;
+    loop->size = 0;
+    loop->scan = 0;
+    for(int len=1; len<=MAX_SPIN_LEN && slot + len <= numSlots; len++) {
+        size_t s = slot + len - 1;
+        uint8_t base = base_at(s);
+        dinst* d = &decoded[s];
+        int size = load_size(base) | store_size(base);
+        if(size != 0 && loop->size != 0 && loop->size != size) {
+            return 0;
+        }
+        if(base == OP_BNE && d->imm == -len) {
+            c->len = len;
+            c->rs = d->rs;
+            c->rt = d->rt;
+            return check_bulk(loop, loadFirst);
+        } else if(base == OP_ADDIU && d->rs == d->rt && d->rt != 0) {
+            add_counter(c, d->rt, d->imm);
+        } else if(load_size(base) && loop->load == OP_DECODE) {
+            loop->load = base;
+            loop->size = size;
+            loop->value = d->rt;
+            loop->src = d->rs;
+            loop->srcOff = (uint32_t) d->imm + counted(c, d->rs);
+            loadFirst = loop->store == OP_DECODE;
+        } else if(store_size(base) && loop->store == OP_DECODE) {
+            loop->store = base;
+            loop->size = size;
+            loop->stored = d->rt;
+            loop->dest = d->rs;
+            loop->destOff = (uint32_t) d->imm + counted(c, d->rs);
+        } else if(base != OP_SLL || d->rd != 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+void decode_slot(size_t slot) {
+    dinst* d = &decoded[slot];
+    spin_loop loop;
+    bulk_loop bulk;
+    if(d->base == OP_DECODE) {
+        fill(slot);
+    }
+    if(decode_spin(slot, &loop)) {
+        d->op = OP_SPIN;
+        return;
+    }
+    if(decode_bulk(slot, &bulk)) {
+        d->op = OP_BULK;
+        return;
+    }
+    d->op = fuse(slot);
+    if(d->op == OP_DECODE) {
+        d->op = specialize(d);
+    }
+}
+
+/**
+ * Empty the return-address stack. Empty entries predict the sentinel, so
+ * every entry is a valid slot.
+ */
+static void clear_returns() {
+    for(int i=0; i<RETURN_STACK_SIZE; i++) {
+        returnSlots[i] = numSlots;
+    }
+    returnTop = 0;
+}
+
+/**
+ * Replace the page bitmap with one for numSlots slots.
+ * @param set - Value of every bit
+ */
+static void reset_pages(int set) {
+    size_t len = (numSlots + PAGE_SLOTS - 1) / PAGE_SLOTS / 8 + 1;
+    free(pagesDecoded);
+    pagesDecoded = malloc(len);
+    memset(pagesDecoded, set ? 0xFF : 0, len);
+}
+
+void decode_init() {
+    if(!attached) {
+        free(decoded);
+    }
+    attached = 0;
+    numSlots = textSize / 4;
+    // Large allocations come zeroed from the system, so slots that never
+    // get decoded do not even use memory
+    decoded = calloc(numSlots + 1, sizeof(dinst));
+    decoded[numSlots].op = OP_END;
+    decoded[numSlots].base = OP_END;
+    reset_pages(0);
+    clear_returns();
+}
+
+void decode_attach(dinst* slots) {
+    if(!attached) {
+        free(decoded);
+    }
+    attached = 1;
+    numSlots = textSize / 4;
+    decoded = slots;
+    reset_pages(1);
+    clear_returns();
+}
+
+/**
+ * Decode the slots of a page that are not decoded yet.
+ */
+static void decode_page(size_t page) {
+    size_t end = (page + 1) * PAGE_SLOTS;
+    for(size_t s=page * PAGE_SLOTS; s<end && s<numSlots; s++) {
+        if(decoded[s].op == OP_DECODE) {
+            decode_slot(s);
+        }
+    }
+    pagesDecoded[page / 8] |= 1 << page % 8;
+}
+
+void decode_reached(size_t slot) {
+    size_t page = slot / PAGE_SLOTS;
+    if(pagesDecoded[page / 8] & 1 << page % 8) {
+        decode_slot(slot);
+    } else {
+        decode_page(page);
+    }
+}
+
+void decode_all() {
+    for(size_t page=0; page * PAGE_SLOTS < numSlots; page++) {
+        decode_page(page);
+    }
+}
+
+void decode_invalidate(size_t offset, size_t len) {
+    size_t first = offset / 4;
+    size_t last = (offset + len - 1) / 4;
+    // A fused sequence starting up to MAX_FUSED_LEN - 1 slots before the
+    // write may cover it
+    size_t s = first >= MAX_FUSED_LEN - 1 ? first - (MAX_FUSED_LEN - 1) : 0;
+    for(; s <= last && s < numSlots; s++) {
+        decoded[s].op = OP_DECODE;
+        if(s >= first) {
+            decoded[s].base = OP_DECODE;
+        }
+    }
+}
+
+void decode_disasm(inst word, uint32_t addr, char* buf, size_t size) {
+    dinst d;
+    decode_word(word, &d);
+    if(d.base == OP_INVALID) {
+        snprintf(buf, size, ".word 0x%08X", word);
+        return;
+    }
+
+    const char* name = names[d.base];
+    const char* rs = regNames[d.rs];
+    const char* rt = regNames[d.rt];
+    const char* rd = regNames[d.rd];
+    switch(opArgs[d.base]) {
+        case ARGS_NONE:
+            snprintf(buf, size, "%s", name);
+            break;
+        case ARGS_DST:
+            snprintf(buf, size, "%s $%s, $%s, $%s", name, rd, rs, rt);
+            break;
+        case ARGS_DTS:
+            snprintf(buf, size, "%s $%s, $%s, $%s", name, rd, rt, rs);
+            break;
+        case ARGS_DTA:
+            snprintf(buf, size, "%s $%s, $%s, %d", name, rd, rt, d.shamt);
+            break;
+        case ARGS_TSI:
+            snprintf(buf, size, "%s $%s, $%s, %d", name, rt, rs, d.imm);
+            break;
+        case ARGS_TI:
+            snprintf(buf, size, "%s $%s, 0x%X", name, rt, d.imm & 0xFFFF);
+            break;
+        case ARGS_MEM:
+            snprintf(buf, size, "%s $%s, %d($%s)", name, rt, d.imm, rs);
+            break;
+        case ARGS_STB:
+            snprintf(buf, size, "%s $%s, $%s, 0x%X", name, rs, rt,
+                     addr + 4 + ((uint32_t) d.imm << 2));
+            break;
+        case ARGS_S:
+            snprintf(buf, size, "%s $%s", name, rs);
+            break;
+        case ARGS_D:
+            snprintf(buf, size, "%s $%s", name, rd);
+            break;
+        case ARGS_DS:
+            snprintf(buf, size, "%s $%s, $%s", name, rd, rs);
+            break;
+        case ARGS_ST:
+            snprintf(buf, size, "%s $%s, $%s", name, rs, rt);
+            break;
+        case ARGS_J:
+            snprintf(buf, size, "%s 0x%X", name, (uint32_t) d.imm << 2);
+            break;
+    }
+}
+
+void decode_exit() {
+    if(!attached) {
+        free(decoded);
+    }
+    free(pagesDecoded);
+    pagesDecoded = NULL;
+    attached = 0;
+    decoded = NULL;
+    numSlots = 0;
+}
@@ -0,0 +1,241 @@
+#ifndef GSIM_DECODE_H
+#define GSIM_DECODE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "simulator.h"
+#include "instructions.h"
+
+/**
+ * Predecoded text segment feeding the run loop.
+ *
+ * Every instruction word of the text segment has a slot holding its
+ * operation and unpacked operands, so the loop dispatches on a small enum
+ * instead of re-extracting fields from the word each time it executes.
+ * The operation is specialized for its operands once, at decode: writes
+ * to $zero that cannot fault become nops, results that only depend on
+ * immediates become constants, and ALU and branch operations with $zero
+ * as an operand get a variant with that operand folded in.
+ *
+ * Idioms the rlink output is full of are fused into superinstructions that
+ * execute two or three guest instructions in a single dispatch. Only the
+ * first slot of such a sequence holds the fused operation; the following
+ * slots keep their own decode and provide the fused operation's operands,
+ * so a branch into the middle of the sequence simply executes the rest
+ * unfused. Only the last instruction of a fused sequence may fault or
+ * change control flow, and the fused handlers advance pc past each member
+ * before executing the next one, so the architectural state and the pc
+ * reported on a fault are the same as when executing one at a time.
+ *
+ * Slots are decoded on demand: a page of the text segment is decoded the
+ * first time one of its instructions executes, so starting a program costs
+ * nothing for the code it never reaches. A bitmap records the pages
+ * decoded. Stores into the text segment invalidate the slots covering the
+ * written words; those are decoded again, one at a time, when next
+ * executed.
+ *
+ * The run loop keeps a pointer to the current slot instead of translating
+ * pc for every instruction: it steps to the next slot, or to the one a
+ * block exit leads to. Direct branches know their target slot, calls push
+ * their return slot on a shadow return-address stack, and jr $ra is
+ * predicted from it. Other indirect jumps, and a return whose prediction
+ * does not match $ra, translate the new pc.
+ *
+ * Delay loops that only count registers up or down until a bne falls
+ * through are marked at their head. The run loop computes how many
+ * iterations they run in closed form and skips to their exit, or to the
+ * instruction limit, as if every instruction had executed.
+ *
+ * Loops that step pointers through memory one element at a time, copying,
+ * filling or scanning for a zero element, are marked the same way and run
+ * as a host memmove, memset or memchr. Only the iterations whose accesses
+ * all fall inside the text or data segment, in address order, are run on
+ * the host; the rest execute normally, so a fault is reported by the same
+ * instruction of the same iteration.
+ */
+
+typedef enum op_code {
+    OP_DECODE,      // Not decoded yet
+    OP_INVALID,
+
+#define OP_ENUM(OP, ...) OP_##OP,
+    ALL_OPS(OP_ENUM)
+#undef OP_ENUM
+
+    // Operand-specialized variants, chosen by the decoder
+    OP_NOP,         // Writes $zero and cannot fault
+    OP_LI,          // Result does not depend on any register: $dest = val
+    OP_MOVE,        // Shift by 0: $dest = $rt
+    OP_B,           // Branch on a condition that always holds
+    OP_CALL,        // jal, pushing the return slot
+    OP_CALLR,       // jalr, pushing the return slot
+    OP_RETURN,      // jr $ra, predicted from the return-address stack
+    OP_SPIN,        // Head of a counted loop that may be fast-forwarded
+    OP_BULK,        // Head of a copy, fill or scan loop run on the host
+#define OP_ZERO_VARIANTS(OP, ...) OP_##OP##_RZ, OP_##OP##_LZ,
+    ALU_OPS(OP_ZERO_VARIANTS)       // rt or rs is $zero
+    BRANCH_OPS(OP_ZERO_VARIANTS)
+#undef OP_ZERO_VARIANTS
+
+    // Fused operations
+    OP_LUI_ORI,         // lui r; ori x, r, lo
+    OP_LUI_ADDIU,       // lui r; addiu x, r, lo
+    OP_SLT_BEQ,         // slt r, a, b; beq r, $zero
+    OP_SLT_BNE,         // slt r, a, b; bne r, $zero
+    OP_SLTU_BEQ,        // sltu r, a, b; beq r, $zero
+    OP_SLTU_BNE,        // sltu r, a, b; bne r, $zero
+    OP_ADDIU_SW,        // addiu $sp, $sp, n; sw x, off($sp)
+    OP_ADDIU_JR,        // addiu $sp, $sp, n; jr x
+    OP_SLL_ADDU_LW,     // sll i, x, 2; addu p, i, base; lw y, off(p)
+
+    OP_END,         // Sentinel slot past the end of the text segment
+    NUM_OPS
+} op_code;
+
+#define MAX_FUSED_LEN 3     // Longest fused sequence, in instructions
+#define RETURN_STACK_SIZE 64    // Entries of the return-address stack, a power of 2
+#define MAX_SPIN_LEN 8          // Longest loop fast-forwarded, in instructions
+
+typedef struct dinst {
+    uint8_t op;         // Operation to dispatch on
+    uint8_t base;       // Table operation of this instruction alone
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    uint8_t shamt;
+    uint8_t dest;       // Register written, REG_SINK in place of $zero
+    int32_t imm;        // Sign-extended immediate, or jump target
+    int32_t val;        // Value of OP_LI, byte offset of branches
+} dinst;
+
+/**
+ * Counted loop whose only effect is adding constants to registers:
+ * addiu x, x, c and nops, closed by a bne back to its first instruction.
+ */
+typedef struct spin_loop {
+    int len;                        // Instructions per iteration
+    int numCounters;
+    uint8_t reg[MAX_SPIN_LEN];      // Registers counted
+    reg inc[MAX_SPIN_LEN];          // Added to each one per iteration
+    uint8_t rs;                     // Operands of the closing bne
+    uint8_t rt;
+} spin_loop;
+
+/**
+ * Loop stepping pointers by one element per iteration: at most one load
+ * and one store of the same size, addiu counters and nops, closed by a bne
+ * back to its first instruction. The store writes the value just loaded
+ * (copy) or a register the loop leaves alone (fill). The bne either counts
+ * like a spin_loop's or compares the loaded value with $zero (scan).
+ */
+typedef struct bulk_loop {
+    spin_loop counted;      // Counters, length and closing bne
+    uint8_t load;           // OP_LB ... OP_LW, OP_DECODE if there is none
+    uint8_t store;          // OP_SB, OP_SH or OP_SW, OP_DECODE if there is none
+    uint8_t size;           // Bytes per element
+    uint8_t value;          // Register loaded
+    uint8_t stored;         // Register stored
+    uint8_t src;            // Pointer registers, stepped by size
+    uint8_t dest;
+    uint8_t scan;           // Exits after loading a zero element
+    int32_t srcOff;         // Address accessed minus the pointer at the
+    int32_t destOff;        // head of the iteration
+} bulk_loop;
+
+extern dinst* decoded;      // numSlots slots, then an OP_END sentinel
+extern size_t numSlots;
+
+/*
+ * Shadow return-address stack: slot of the return site of the latest calls,
+ * circular so deep recursion only loses the oldest entries. A return only
+ * follows its prediction after checking it against $ra.
+ */
+extern CPU_LOCAL uint32_t returnSlots[RETURN_STACK_SIZE];
+extern CPU_LOCAL uint32_t returnTop;
+
+/**
+ * Allocate the slots for the current text segment, none of them decoded
+ * yet, and clear the return-address stack. Called by sim_init(), unless the
+ * image cache holds them, and checkpoint_restore() once the text segment is
+ * loaded.
+ */
+void decode_init();
+
+/**
+ * Use slots decoded by an earlier run in place of decode_init(), as
+ * imgcache_load() does. They must hold the decode of the current text
+ * segment followed by the OP_END sentinel, and stay valid and writable
+ * until decode_exit() or the next decode_init().
+ * @param slots - numSlots + 1 slots
+ */
+void decode_attach(dinst* slots);
+
+/**
+ * Unpack an instruction word, without specializing or fusing it.
+ * @param word - Instruction word
+ * @param d - Filled with the table operation, in both op and base, and
+ *              the operands
+ */
+void decode_word(inst word, dinst* d);
+
+/**
+ * Decode a slot that was not decoded yet or was invalidated, fusing it with
+ * the following instructions when they form a known idiom.
+ * @param slot - Index of the slot, (pc - TEXT_ADDRESS) / 4
+ */
+void decode_slot(size_t slot);
+
+/**
+ * Decode a slot about to execute that holds OP_DECODE: its whole page if
+ * none of the page has executed yet, else just the slot.
+ * @param slot - Index of the slot
+ */
+void decode_reached(size_t slot);
+
+/**
+ * Decode every page not decoded yet, as imgcache_store() does so that
+ * later runs start with the whole text segment decoded.
+ */
+void decode_all();
+
+/**
+ * Recognize a counted loop starting at a slot, from the current contents
+ * of the text segment.
+ * @param slot - Index of the first slot of the loop
+ * @param loop - Filled with the loop
+ * @return Nonzero if there is such a loop
+ */
+int decode_spin(size_t slot, spin_loop* loop);
+
+/**
+ * Recognize a copy, fill or scan loop starting at a slot, from the current
+ * contents of the text segment.
+ * @param slot - Index of the first slot of the loop
+ * @param loop - Filled with the loop
+ * @return Nonzero if there is such a loop
+ */
+int decode_bulk(size_t slot, bulk_loop* loop);
+
+/**
+ * Invalidate the slots affected by a write to the text segment.
+ * @param offset - Offset of the write from the start of the text segment
+ * @param len - Number of bytes written
+ */
+void decode_invalidate(size_t offset, size_t len);
+
+/**
+ * Disassemble an instruction word.
+ * @param word - Instruction word
+ * @param addr - Address of the word, for branch targets
+ * @param buf - Filled with the text of the instruction
+ * @param size - Size of buf
+ */
+void decode_disasm(inst word, uint32_t addr, char* buf, size_t size);
+
+/**
+ * Free the slots.
+ */
+void decode_exit();
+
+#endif // GSIM_DECODE_H
@@ -1,24 +1,28 @@
-
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "fileReader.h"
 
 
-byte* readFile(char* fileName) {
+byte* readFile(char* fileName, size_t* size) {
 	FILE* file = fopen(fileName, "rb");
 
 	if(file == NULL) {
 	    return NULL;
 	}
 	fseek(file, 0, SEEK_END);
-	size_t fileSize = ftell(file);
+	long fileSize = ftell(file);
 	rewind(file);
 
-	byte* contents = malloc(sizeof(byte) * fileSize);
-	fread(contents, sizeof(byte), fileSize, file); 
+	// Never empty, so a header can always be looked at
+	byte* contents = fileSize >= 0 ? calloc(fileSize + 1, sizeof(byte)) : NULL;
+	if(contents != NULL && fread(contents, sizeof(byte), fileSize, file) != (size_t) fileSize) {
+	    free(contents);
+	    contents = NULL;
+	}
 
 	fclose(file); 
 
+	*size = contents != NULL ? (size_t) fileSize : 0;
 	return contents; 
 }
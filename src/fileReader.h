@@ -1,9 +1,17 @@
 #ifndef GSIM_FILEREADER_H
 #define GSIM_FILEREADER_H
 
+#include <stddef.h>
+
 typedef unsigned char byte; 
 
-byte* readFile(char* fileName);
+/**
+ * Read a whole file into memory.
+ * @param fileName - Path of the file
+ * @param size - Set to the length of the file
+ * @return Contents of the file, to be freed, or NULL if it could not be read
+ */
+byte* readFile(char* fileName, size_t* size);
 
 
 #endif // GSIM_FILEREADER_H
\ No newline at end of file
@@ -1,4 +1,12 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "functions.h"
+#include "decode.h"
+#include "guestCounters.h"
+#include "multiCore.h"
+#include "sysRecord.h"
+#include "timeTravel.h"
+#include "watchpoints.h"
 
 #define DEFAULT_STACK_SIZE 8192
 #define TEXT_ADDRESS 0x400000
@@ -8,19 +16,29 @@
 
 extern byte* text;
 extern byte* data;
-extern byte* stack;
+extern CPU_LOCAL byte* stack;
 
 extern size_t textSize;
 extern size_t dataSize;
-extern size_t stackSize;
+extern CPU_LOCAL size_t stackSize;
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL reg hi;
+extern CPU_LOCAL reg lo;
 
-extern reg registers[];
-extern reg pc;
-extern reg hi;
-extern reg lo;
+// Streams of the console syscalls, stdin and stdout when NULL
+static FILE* consoleIn;
+static FILE* consoleOut;
+static int (*inputReady)(size_t len);
 
+// Link set by the last ll of this CPU
+static CPU_LOCAL int linked;
+static CPU_LOCAL uint32_t linkAddr;
+static CPU_LOCAL uint32_t linkWord;     // Word loaded, as stored on the host
 
-static byte* getRealAddr(uint32_t progAddr) {
+
+byte* getRealAddr(uint32_t progAddr) {
     if(progAddr >= TEXT_ADDRESS && progAddr <= TEXT_ADDRESS + textSize) {
         return &text[progAddr - TEXT_ADDRESS];
     } else if(progAddr >= DATA_ADDRESS && progAddr <= DATA_ADDRESS + dataSize) {
@@ -33,57 +51,86 @@ static byte* getRealAddr(uint32_t progAddr) {
     }
 }
 
-err_code add(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] + registers[rt];
-    if((registers[rs] > 0 && registers[rt] > 0 && registers[rd] < 0)
-        || (registers[rs] < 0 && registers[rt] < 0 && registers[rd] > 0)) {
-        return OVERFLOW;
-    } else {
-        return SUCCESS;
+byte* getWritableAddr(uint32_t progAddr, size_t len) {
+    byte* realAddr = getRealAddr(progAddr);
+    if(dirtyTracking && realAddr != NULL) {
+        timetravel_dirty(realAddr, len);
+    }
+    if(progAddr - TEXT_ADDRESS <= textSize) {
+        decode_invalidate(progAddr - TEXT_ADDRESS, len);
     }
+    return realAddr;
 }
 
-err_code addi(uint8_t rs, uint8_t rt, int16_t imm) {
-    registers[rt] = registers[rs] + (reg) imm;
-    if((registers[rs] > 0 && imm > 0 && registers[rt] < 0)
-       || (registers[rs] < 0 && imm < 0 && registers[rt] > 0)) {
-        return OVERFLOW;
-    } else {
-        return SUCCESS;
+/*
+ * Generic handlers of the instructions in instructions.h, for one
+ * instruction at a time with any operands.
+ */
+#define ALU_HANDLER(OP, name, opcode, funct, args, fault, sem) \
+    err_code name(uint8_t rs, uint8_t rt, uint8_t rd) { \
+        reg a = registers[rs]; \
+        reg b = registers[rt]; \
+        reg r = alu_##name(a, b); \
+        if(rd != 0) { \
+            registers[rd] = r; \
+        } \
+        return FAULT_##fault(a, b, r); \
     }
-}
 
-err_code addiu(uint8_t rs, uint8_t rt, int16_t imm) {
-    registers[rt] = registers[rs] + (reg) imm;
-    return SUCCESS;
-}
+#define SHIFT_HANDLER(OP, name, opcode, funct, args, fault, sem) \
+    err_code name(uint8_t rt, uint8_t rd, uint8_t shamt) { \
+        if(rd != 0) { \
+            registers[rd] = shift_##name(registers[rt], shamt); \
+        } \
+        return SUCCESS; \
+    }
 
-err_code addu(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] + registers[rt];
-    return SUCCESS;
-}
+#define IMM_HANDLER(OP, name, opcode, funct, args, fault, sem) \
+    err_code name(uint8_t rs, uint8_t rt, int16_t imm) { \
+        reg a = registers[rs]; \
+        reg r = imm_##name(a, imm); \
+        if(rt != 0) { \
+            registers[rt] = r; \
+        } \
+        return FAULT_##fault(a, (reg) imm, r); \
+    }
 
-err_code and(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] & registers[rt];
-    return SUCCESS;
-}
+#define LOAD_HANDLER(OP, name, opcode, funct, args, fault, sem) \
+    err_code name(uint8_t rs, uint8_t rt, int16_t offset) { \
+        byte* realAddr = getRealAddr(registers[rs] + (reg) offset); \
+        if(realAddr == NULL) { \
+            return NONEXISTANT_MEMORY; \
+        } \
+        if(rt != 0) { \
+            registers[rt] = load_##name(realAddr); \
+        } \
+        return SUCCESS; \
+    }
 
-err_code andi(uint8_t rs, uint8_t rt, int16_t imm) {
-    registers[rt] = registers[rs] & ((reg) imm & 0xFFFF); // imm is zero extended
-    return SUCCESS;
-}
+#define STORE_HANDLER(OP, name, opcode, funct, args, fault, sem) \
+    err_code name(uint8_t rs, uint8_t rt, int16_t offset) { \
+        byte* realAddr = getWritableAddr(registers[rs] + (reg) offset, MEM_SIZE_##fault); \
+        if(realAddr == NULL) { \
+            return NONEXISTANT_MEMORY; \
+        } \
+        store_##name(realAddr, registers[rt]); \
+        return SUCCESS; \
+    }
 
-err_code beq(uint8_t rs, uint8_t rt, int16_t offset) {
-    if(registers[rs] == registers[rt])
-        pc += ((reg) offset) << 2;  // Last 2 00s taken of 16 bit inst offsetreturn SUCCESS;
-    return SUCCESS;
-}
+#define BRANCH_HANDLER(OP, name, opcode, funct, args, fault, sem) \
+    err_code name(uint8_t rs, uint8_t rt, int16_t offset) { \
+        if(branch_##name(registers[rs], registers[rt])) { \
+            pc += ((reg) offset) << 2;  /* Last 2 00s taken of 16 bit inst offset */ \
+        } \
+        return SUCCESS; \
+    }
 
-err_code bne(uint8_t rs, uint8_t rt, int16_t offset) {
-    if(registers[rs] != registers[rt])
-        pc += ((reg) offset) << 2;  // Last 2 00s taken of 16 bit inst offset
-    return SUCCESS;
-}
+ALU_OPS(ALU_HANDLER)
+SHIFT_OPS(SHIFT_HANDLER)
+IMM_OPS(IMM_HANDLER)
+LOAD_OPS(LOAD_HANDLER)
+STORE_OPS(STORE_HANDLER)
+BRANCH_OPS(BRANCH_HANDLER)
 
 err_code div_(uint8_t rs, uint8_t rt) {
     // TODO Implement overflow detection
@@ -118,8 +165,11 @@ err_code jal(uint32_t target) {
 }
 
 err_code jalr(uint8_t rs, uint8_t rd) {
-    registers[rd] = pc + 4;
-    pc = registers[rs];
+    reg target = registers[rs];
+    if(rd != 0) {
+        registers[rd] = pc + 4;
+    }
+    pc = target;
     return JUMPED;
 }
 
@@ -128,69 +178,10 @@ err_code jr(uint8_t rs) {
     return JUMPED;
 }
 
-err_code lb(uint8_t rs, uint8_t rt, int16_t offset) {
-    uint32_t addr = registers[rs] + (reg) offset;
-    byte* realAddr = getRealAddr(addr);
-    if(realAddr == NULL) {
-        return NONEXISTANT_MEMORY;
-    } else {
-        registers[rt] = (reg) ((int8_t)*realAddr);
-        return SUCCESS;
-    }
-}
-
-err_code lbu(uint8_t rs, uint8_t rt, int16_t offset) {
-    uint32_t addr = registers[rs] + (reg) offset;
-    byte* realAddr = getRealAddr(addr);
-    if(realAddr == NULL) {
-        return NONEXISTANT_MEMORY;
-    } else {
-        registers[rt] = (reg) ((uint8_t)*realAddr);
-        return SUCCESS;
-    }
-}
-
-err_code lh(uint8_t rs, uint8_t rt, int16_t offset) {
-    uint32_t addr = registers[rs] + (reg) offset;
-    byte* realAddr = getRealAddr(addr);
-    if(realAddr == NULL) {
-        return NONEXISTANT_MEMORY;
-    } else {
-        registers[rt] = (reg) ((int16_t)((realAddr[0] << 8) + realAddr[1]));
-        return SUCCESS;
-    }
-}
-
-err_code lhu(uint8_t rs, uint8_t rt, int16_t offset) {
-    uint32_t addr = registers[rs] + (reg) offset;
-    byte* realAddr = getRealAddr(addr);
-    if(realAddr == NULL) {
-        return NONEXISTANT_MEMORY;
-    } else {
-        registers[rt] = (reg) ((uint16_t)((realAddr[0] << 8) + realAddr[1]));
-        return SUCCESS;
-    }
-}
-
-err_code lui(uint8_t rt, int16_t imm) {
-    registers[rt] = (((uint32_t) imm) << 16) & 0xFFFF0000;
-    return SUCCESS;
-}
-
-err_code lw(uint8_t rs, uint8_t rt, int16_t offset) {
-    uint32_t addr = registers[rs] + (reg) offset;
-    byte* realAddr = getRealAddr(addr);
-    if(realAddr == NULL) {
-        return NONEXISTANT_MEMORY;
-    } else {
-        registers[rt] = (reg) ((realAddr[0] << 24) + (realAddr[1] << 16) +
-                                    (realAddr[2] << 8) + realAddr[3]);
-        return SUCCESS;
-    }
-}
-
 err_code mfhi(uint8_t rd) {
-    registers[rd] = hi;
+    if(rd != 0) {
+        registers[rd] = hi;
+    }
     return SUCCESS;
 }
 
@@ -200,7 +191,9 @@ err_code mthi(uint8_t rs) {
 }
 
 err_code mflo(uint8_t rd) {
-    registers[rd] = lo;
+    if(rd != 0) {
+        registers[rd] = lo;
+    }
     return SUCCESS;
 }
 
@@ -223,145 +216,236 @@ err_code multu(uint8_t rs, uint8_t rt) {
     return SUCCESS;
 }
 
-err_code nor(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = ~(registers[rs] | registers[rt]);
+err_code sync_() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
     return SUCCESS;
 }
 
-err_code xor(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] ^ registers[rt];
-    return SUCCESS;
-}
-
-err_code or(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] | registers[rt];
-    return SUCCESS;
-}
-
-err_code ori(uint8_t rs, uint8_t rt, int16_t imm) {
-    registers[rt] = registers[rs] | ((uint32_t)imm & 0xFFFF);
-    return SUCCESS;
-}
-
-err_code sb(uint8_t rs, uint8_t rt, int16_t offset) {
-    uint32_t addr = registers[rs] + (reg) offset;
-    byte* realAddr = getRealAddr(addr);
-    if(realAddr == NULL) {
-        return NONEXISTANT_MEMORY;
-    } else {
-        *realAddr = (byte)registers[rt];
-        return SUCCESS;
+/**
+ * Word stored at a host address, as ll and sc access it: atomically when
+ * it is aligned, which it is everywhere but in the stack, which only its
+ * own CPU can access.
+ */
+static uint32_t load_linked(const byte* realAddr) {
+    uint32_t word;
+    if((uintptr_t) realAddr % 4 == 0) {
+        return __atomic_load_n((const uint32_t*) realAddr, __ATOMIC_SEQ_CST);
     }
+    memcpy(&word, realAddr, 4);
+    return word;
 }
 
-err_code sh(uint8_t rs, uint8_t rt, int16_t offset) {
+err_code ll(uint8_t rs, uint8_t rt, int16_t offset) {
     uint32_t addr = registers[rs] + (reg) offset;
     byte* realAddr = getRealAddr(addr);
     if(realAddr == NULL) {
         return NONEXISTANT_MEMORY;
-    } else {
-        realAddr[0] = (byte)(registers[rt] >> 8);
-        realAddr[1] = (byte)(registers[rt]);
-        return SUCCESS;
     }
+    linked = 1;
+    linkAddr = addr;
+    linkWord = load_linked(realAddr);
+    if(rt != 0) {
+        registers[rt] = load_lw((const byte*) &linkWord);
+    }
+    return SUCCESS;
 }
 
-err_code sw(uint8_t rs, uint8_t rt, int16_t offset) {
+err_code sc(uint8_t rs, uint8_t rt, int16_t offset) {
     uint32_t addr = registers[rs] + (reg) offset;
     byte* realAddr = getRealAddr(addr);
     if(realAddr == NULL) {
         return NONEXISTANT_MEMORY;
-    } else {
-        realAddr[0] = (byte)(registers[rt] >> 24);
-        realAddr[1] = (byte)(registers[rt] >> 16);
-        realAddr[2] = (byte)(registers[rt] >> 8);
-        realAddr[3] = (byte)(registers[rt]);
-        return SUCCESS;
     }
-}
-
-err_code slt(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] < registers[rt];
-    return SUCCESS;
-}
-
-err_code slti(uint8_t rs, uint8_t rt, int16_t imm) {
-    registers[rt] = registers[rs] < (reg)imm;
-    return SUCCESS;
-}
-
-err_code stliu(uint8_t rs, uint8_t rt, int16_t imm) {
-    registers[rt] = registers[rs] < (reg)imm;
+    int stored = 0;
+    if(linked && linkAddr == addr) {
+        uint32_t word;
+        store_sw((byte*) &word, registers[rt]);
+        getWritableAddr(addr, 4);
+        if((uintptr_t) realAddr % 4 == 0) {
+            stored = __atomic_compare_exchange_n((uint32_t*) realAddr, &linkWord, word, 0,
+                                                 __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        } else if(load_linked(realAddr) == linkWord) {
+            memcpy(realAddr, &word, 4);
+            stored = 1;
+        }
+    }
+    linked = 0;
+    if(rt != 0) {
+        registers[rt] = stored;
+    }
     return SUCCESS;
 }
 
-err_code sltu(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] < registers[rt];
-    return SUCCESS;
+/**
+ * Translate an address for an access of several bytes.
+ * @param progAddr - Address as seen by the simulated program
+ * @param avail - Set to the number of bytes from progAddr to the end of its
+ *                  segment
+ * @param step - Set to the host distance between consecutive addresses, 1,
+ *                  or -1 in the stack, which is stored downwards
+ * @return Pointer to the byte at that address, or NULL if the address is
+ *          not part of the text, data or stack segment
+ */
+static byte* getRealSpan(uint32_t progAddr, size_t* avail, int* step) {
+    *step = 1;
+    if(progAddr - TEXT_ADDRESS < textSize) {
+        *avail = textSize - (progAddr - TEXT_ADDRESS);
+        return &text[progAddr - TEXT_ADDRESS];
+    } else if(progAddr - DATA_ADDRESS < dataSize) {
+        *avail = dataSize - (progAddr - DATA_ADDRESS);
+        return &data[progAddr - DATA_ADDRESS];
+    } else if(STACK_HIGH_ADDR - progAddr < stackSize) {
+        *avail = (size_t) (STACK_HIGH_ADDR - progAddr) + 1;
+        *step = -1;
+        return &stack[STACK_HIGH_ADDR - progAddr];
+    }
+    return NULL;
 }
 
-err_code sll(uint8_t rt, uint8_t rd, uint8_t shamt) {
-    registers[rd] = registers[rt] << shamt;
-    return SUCCESS;
+/**
+ * Translate a range of addresses within a single segment.
+ * @param writable - Nonzero if the range is about to be written, see
+ *                      getWritableAddr()
+ * @return Pointer to the byte at progAddr, or NULL if any byte of the range
+ *          is outside the segment holding progAddr
+ */
+static byte* getRealRange(uint32_t progAddr, size_t len, int* step, int writable) {
+    size_t avail;
+    byte* realAddr = getRealSpan(progAddr, &avail, step);
+    if(realAddr == NULL || len > avail) {
+        return NULL;
+    }
+    if(writable && len > 0) {
+        getWritableAddr(*step > 0 ? progAddr : progAddr + (len - 1), len);
+    }
+    return realAddr;
 }
 
-err_code sllv(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rt] << registers[rs];
-    return SUCCESS;
+/**
+ * Copy guest bytes in address order between a range and a host buffer.
+ * @param toGuest - Nonzero to copy buf into the range
+ */
+static void copy_range(byte* realAddr, int step, byte* buf, size_t len, int toGuest) {
+    if(step > 0 && !(toGuest && watch_enabled())) {
+        memcpy(toGuest ? realAddr : buf, toGuest ? buf : realAddr, len);
+        return;
+    }
+    // A store per byte, which watchpoints see one at a time
+    volatile byte* guest = realAddr;
+    for(size_t i=0; i<len; i++) {
+        ptrdiff_t at = step > 0 ? (ptrdiff_t) i : -(ptrdiff_t) i;
+        if(toGuest) {
+            guest[at] = buf[i];
+        } else {
+            buf[i] = guest[at];
+        }
+    }
 }
 
-err_code srl(uint8_t rt, uint8_t rd, uint8_t shamt) {
-    registers[rd] = (uint32_t)registers[rt] >> shamt;
-    return SUCCESS;
+/**
+ * Host buffer holding a copy of a guest range, or the range itself when it
+ * is stored in address order. Free it with release_range().
+ * @return Buffer, or NULL if the range is not valid or out of memory
+ */
+static byte* acquire_range(uint32_t progAddr, size_t len) {
+    int step;
+    byte* realAddr = getRealRange(progAddr, len, &step, 0);
+    if(realAddr == NULL || step > 0) {
+        return realAddr;
+    }
+    byte* buf = malloc(len ? len : 1);
+    if(buf != NULL) {
+        copy_range(realAddr, step, buf, len, 0);
+    }
+    return buf;
 }
 
-err_code srlv(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = (uint32_t)registers[rt] >> registers[rs];
-    return SUCCESS;
+static void release_range(uint32_t progAddr, byte* buf) {
+    if(progAddr - TEXT_ADDRESS >= textSize && progAddr - DATA_ADDRESS >= dataSize) {
+        free(buf);
+    }
 }
 
-err_code sra(uint8_t rt, uint8_t rd, uint8_t shamt) {
-    registers[rd] = registers[rt] >> shamt;
-    return SUCCESS;
+void syscall_streams(FILE* in, FILE* out) {
+    consoleIn = in;
+    consoleOut = out;
 }
 
-err_code srav(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rt] >> registers[rs];
-    return SUCCESS;
+void syscall_input_check(int (*ready)(size_t len)) {
+    inputReady = ready;
 }
 
-err_code sub(uint8_t rs, uint8_t rt, uint8_t rd) {
-    // TODO Implement overflow detection
-    registers[rd] = registers[rs] - registers[rt];
-    return SUCCESS;
-}
+/**
+ * Parameters in $a0 - $a3 ($4 - $7)
+ * Code indicating call in $v0 ($2)
+ * Return values in $v0 and $v1 ($2 and $3)
+ */
 
-err_code subu(uint8_t rs, uint8_t rt, uint8_t rd) {
-    registers[rd] = registers[rs] - registers[rt];
+/**
+ * Print the output of a syscall, or check it against the log when replaying.
+ */
+static err_code sys_output(uint32_t code, const char* str, size_t len) {
+    sys_record rec;
+    if(sysrec_replaying()) {
+        if(sysrec_next(code, &rec) != 0 || rec.len != len || memcmp(rec.bytes, str, len) != 0) {
+            return REPLAY_MISMATCH;
+        }
+        return SUCCESS;
+    }
+    fwrite(str, 1, len, consoleOut != NULL ? consoleOut : stdout);
+    if(sysrec_recording()) {
+        sysrec_append(code, registers[2], registers[3], (const byte*) str, len);
+    }
     return SUCCESS;
 }
 
 /**
- * Parameters in $a0 - $a3 ($4 - $7)
- * Code indicating call in $v0 ($2)
- * Return values in $v0 and $v1 ($2 and $3)
+ * Log a syscall without any result, or check it against the log when
+ * replaying. The record keeps $a0, the exit status for exit2, in place of $v1.
  */
+static err_code sys_event(uint32_t code) {
+    sys_record rec;
+    if(sysrec_replaying()) {
+        return sysrec_next(code, &rec) != 0 ? REPLAY_MISMATCH : SUCCESS;
+    }
+    if(sysrec_recording()) {
+        sysrec_append(code, registers[2], registers[4], NULL, 0);
+    }
+    return SUCCESS;
+}
 
-err_code syscall() {
+err_code syscall_() {
+    sys_record rec;
     switch(registers[2]) {
-        case 1:
-            printf("%d", registers[4]);
-            return SUCCESS;
-        case 4:
-            printf("%s", getRealAddr(registers[4]));
-            return SUCCESS;
+        case 1: {
+            char num[12];
+            return sys_output(1, num, sprintf(num, "%d", registers[4]));
+        }
+        case 4: {
+            char* str = (char*) getRealAddr(registers[4]);
+            if(str == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
+            return sys_output(4, str, strlen(str));
+        }
         case 5: {
+            if(inputReady != NULL && !inputReady(SIZE_MAX)) {
+                return WOULD_BLOCK;
+            }
+            if(sysrec_replaying()) {
+                if(sysrec_next(5, &rec) != 0) {
+                    return REPLAY_MISMATCH;
+                }
+                registers[2] = rec.v0;
+                registers[3] = rec.v1;
+                return SUCCESS;
+            }
             char* buf = NULL;
             size_t buflen = 0;
-            // Read int
-            getline(&buf, &buflen, stdin);
-            char* endptr;
-            uint32_t in = strtol(buf, &endptr, 10);
+            // Read int; at the end of input buf holds no line to parse
+            ssize_t len = getline(&buf, &buflen, consoleIn != NULL ? consoleIn : stdin);
+            char* endptr = buf;
+            uint32_t in = len < 0 ? 0 : strtol(buf, &endptr, 10);
             if(endptr == buf) {     // No number inputted
                 registers[3] = 0xffffffff;
             } else {
@@ -369,22 +453,168 @@ err_code syscall() {
                 registers[3] = 0;
             }
             free(buf);
+            if(sysrec_recording()) {
+                sysrec_append(5, registers[2], registers[3], NULL, 0);
+            }
             return SUCCESS;
         }
         case 8: {
-            char* buf = (char*) getRealAddr(registers[4]); // Address of buf in str 1
+            // fgets() reads up to len - 1 bytes
+            if(inputReady != NULL && !inputReady(registers[5] > 1 ? registers[5] - 1 : 0)) {
+                return WOULD_BLOCK;
+            }
+            char* buf = (char*) getWritableAddr(registers[4], registers[5]); // Address of buf in str 1
             size_t buflen = registers[5];
+            if(buf == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
             registers[2] = registers[4];
-            fgets(buf, buflen, stdin);
+            if(sysrec_replaying()) {
+                if(sysrec_next(8, &rec) != 0 || rec.len > buflen) {
+                    return REPLAY_MISMATCH;
+                }
+                memcpy(buf, rec.bytes, rec.len);
+                return SUCCESS;
+            }
+            char* read = fgets(buf, buflen, consoleIn != NULL ? consoleIn : stdin);
+            if(sysrec_recording()) {
+                sysrec_append(8, registers[2], registers[3], (byte*) buf, read ? strlen(buf) + 1 : 0);
+            }
             return SUCCESS;
         }
         case 10:
-            return EXIT;
-        case 11:
-            printf("%c", (char) registers[4]);
-            return SUCCESS;
+            return sys_event(10) == SUCCESS ? EXIT : REPLAY_MISMATCH;
+        case 11: {
+            char c = (char) registers[4];
+            return sys_output(11, &c, 1);
+        }
         case 17:
-            return EXIT;
+            return sys_event(17) == SUCCESS ? EXIT : REPLAY_MISMATCH;
+        case 100: {
+            size_t len = (uint32_t) registers[6];
+            int srcStep, destStep;
+            byte* src = getRealRange(registers[5], len, &srcStep, 0);
+            if(src == NULL || getRealRange(registers[4], len, &destStep, 0) == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
+            byte* dest = getRealRange(registers[4], len, &destStep, 1);
+            if(srcStep > 0 && destStep > 0 && !watch_enabled()) {
+                memmove(dest, src, len);
+            } else {
+                // Through a copy, as the ranges may overlap
+                byte* buf = malloc(len ? len : 1);
+                if(buf == NULL) {
+                    return NONEXISTANT_MEMORY;
+                }
+                copy_range(src, srcStep, buf, len, 0);
+                copy_range(dest, destStep, buf, len, 1);
+                free(buf);
+            }
+            registers[2] = registers[4];
+            return SUCCESS;
+        }
+        case 101: {
+            size_t len = (uint32_t) registers[6];
+            int step;
+            byte* dest = getRealRange(registers[4], len, &step, 1);
+            if(dest == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
+            // Downwards, the range is the same host bytes ending at dest
+            byte* start = step > 0 || len == 0 ? dest : dest - (len - 1);
+            if(watch_enabled()) {
+                volatile byte* guest = start;
+                for(size_t i=0; i<len; i++) {
+                    guest[i] = registers[5];
+                }
+            } else {
+                memset(start, registers[5], len);
+            }
+            registers[2] = registers[4];
+            return SUCCESS;
+        }
+        case 102: {
+            size_t len = (uint32_t) registers[6];
+            byte* a = acquire_range(registers[4], len);
+            byte* b = acquire_range(registers[5], len);
+            err_code err = NONEXISTANT_MEMORY;
+            if(a != NULL && b != NULL) {
+                int cmp = memcmp(a, b, len);
+                registers[2] = (cmp > 0) - (cmp < 0);
+                err = SUCCESS;
+            }
+            release_range(registers[4], a);
+            release_range(registers[5], b);
+            return err;
+        }
+        case 103: {
+            size_t avail;
+            int step;
+            byte* str = getRealSpan(registers[4], &avail, &step);
+            size_t len = 0;
+            if(str == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
+            if(step > 0) {
+                byte* end = memchr(str, 0, avail);
+                len = end != NULL ? (size_t) (end - str) : avail;
+            } else {
+                while(len < avail && str[-(ptrdiff_t) len] != 0) {
+                    len++;
+                }
+            }
+            if(len == avail) {
+                // Unterminated, the string runs off its segment
+                return NONEXISTANT_MEMORY;
+            }
+            registers[2] = len;
+            return SUCCESS;
+        }
+        case 104: {
+            // Words are read the way lw reads them, wherever they are
+            size_t count = (uint32_t) registers[5];
+            char sep = (char) registers[6];
+            for(size_t i=0; i<count; i++) {
+                if(getRealAddr(registers[4] + 4 * i) == NULL) {
+                    return NONEXISTANT_MEMORY;
+                }
+            }
+            char* out = malloc(count * 12 + 1);
+            if(out == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
+            size_t len = 0;
+            for(size_t i=0; i<count; i++) {
+                if(i > 0 && sep != 0) {
+                    out[len++] = sep;
+                }
+                len += sprintf(&out[len], "%d", load_lw(getRealAddr(registers[4] + 4 * i)));
+            }
+            err_code err = sys_output(104, out, len);
+            free(out);
+            return err;
+        }
+        case 105: {
+            size_t len = (uint32_t) registers[5];
+            byte* buf = acquire_range(registers[4], len);
+            if(buf == NULL) {
+                return NONEXISTANT_MEMORY;
+            }
+            registers[2] = len;
+            err_code err = sys_output(105, (const char*) buf, len);
+            release_range(registers[4], buf);
+            return err;
+        }
+        case 110:
+        case 111:
+        case 112:
+            return multicore_syscall(registers[2]);
+        case 120:
+        case 121:
+        case 122:
+        case 123:
+        case 124:
+            return guestcounters_syscall(registers[2]);
         default:
             return BAD_SYSCALL;
     }
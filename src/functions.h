@@ -7,9 +7,7 @@
 #include <stdio.h>
 
 #include "simulator.h"
-
-extern int getline(char **, size_t *, FILE *);
-
+#include "instructions.h"
 
 /**
  * Instruction encodings by type:
@@ -20,6 +18,35 @@ extern int getline(char **, size_t *, FILE *);
  */
 
 
+/**
+ * Translate a simulated memory address into the host address backing it.
+ * @param progAddr - Address as seen by the simulated program
+ * @return Pointer to the byte at that address, or NULL if the address is
+ *          not part of the text, data or stack segment
+ */
+byte* getRealAddr(uint32_t progAddr);
+
+
+/**
+ * Translate an address about to be written, recording the touched pages
+ * for time-travel snapshots when those are enabled and dropping the decoded
+ * instructions it overwrites.
+ * @param progAddr - Address as seen by the simulated program
+ * @param len - Number of bytes about to be written
+ * @return Pointer to the byte at that address, or NULL if the address is
+ *          not part of the text, data or stack segment
+ */
+byte* getWritableAddr(uint32_t progAddr, size_t len);
+
+
+/*
+ * The handlers below implement one instruction each, reading and writing
+ * the registers of the simulated machine. Those of the instructions in the
+ * ALU, shift, immediate, load, store and branch lists of instructions.h are
+ * generated from that table; the others are written by hand.
+ */
+
+
 /**
  * Function - mnemonic
  * X Type
@@ -206,13 +233,23 @@ err_code lh(uint8_t rs, uint8_t rt, int16_t offset);
 err_code lhu(uint8_t rs, uint8_t rt, int16_t offset);
 
 
+/**
+ * Load Linked - ll
+ * I Type
+ * Opcode: 0x30
+ * Function: NA
+ * Loads a word like lw and links this CPU to its address for sc.
+ */
+err_code ll(uint8_t rs, uint8_t rt, int16_t offset);
+
+
 /**
  * Load Upper Immediate - lui
  * I Type
  * Opcode: 0x0F
  * Function: NA
  */
-err_code lui(uint8_t rt, int16_t imm);
+err_code lui(uint8_t rs, uint8_t rt, int16_t imm);
 
 
 /**
@@ -323,6 +360,18 @@ err_code ori(uint8_t rs, uint8_t rt, int16_t imm);
 err_code sb(uint8_t rs, uint8_t rt, int16_t offset);
 
 
+/**
+ * Store Conditional - sc
+ * I Type
+ * Opcode: 0x38
+ * Function: NA
+ * Stores a word like sw if the word at the address still holds what the
+ * last ll of this CPU loaded from it, atomically with that check, and sets
+ * rt to 1 if it did, 0 otherwise. Every sc drops the link.
+ */
+err_code sc(uint8_t rs, uint8_t rt, int16_t offset);
+
+
 /**
  * Store Halfword - sh
  * I Type
@@ -365,7 +414,7 @@ err_code slti(uint8_t rs, uint8_t rt, int16_t imm);
  * Opcode: 0x0B
  * Function: NA
  */
-err_code stliu(uint8_t rs, uint8_t rt, int16_t imm);
+err_code sltiu(uint8_t rs, uint8_t rt, int16_t imm);
 
 
 /**
@@ -449,6 +498,16 @@ err_code sub(uint8_t rs, uint8_t rt, uint8_t rd);
 err_code subu(uint8_t rs, uint8_t rt, uint8_t rd);
 
 
+/**
+ * Synchronize Shared Memory - sync
+ * R Type
+ * Opcode: 0x00
+ * Function: 0x0F
+ * Full memory barrier between the CPUs.
+ */
+err_code sync_();
+
+
 /**
  * System call parameters are placed in the argument registers (a0 through a3);
  * the code indicating which system call is being made is placed in register v0.
@@ -493,7 +552,58 @@ err_code subu(uint8_t rs, uint8_t rt, uint8_t rd);
  *                                  fd is the file descriptor which is to be closed.
  * 17	exit2(code)	            This is the standard UNIX exit() system call. The code in
  *                                  register a0 is used as the termination status when the simulator itself exits.
+ *
+ * Codes from 100 on are gsim services, letting a runtime library hand bulk work over to the host. Every byte
+ * of a range must lie in a single segment, otherwise the call fails with an illegal memory address and
+ * changes nothing.
+ *
+ * 100	memcpy(dest,src,len)	Copy len bytes from src to dest, which may overlap. Returns dest in v0.
+ * 101	memset(dest,c,len)	    Fill len bytes at dest with the lowest byte of c. Returns dest in v0.
+ * 102	memcmp(a,b,len)	        Compare len bytes as unsigned characters. Returns -1, 0 or 1 in v0.
+ * 103	strlen(str)	            Returns in v0 the length of the NUL-terminated string at str.
+ * 104	print_ints(arr,n,sep)	Print the n words of the array at arr as integers, separated by the character in
+ *                                  the lowest byte of sep unless it is 0.
+ * 105	print_buf(buf,len)	    Print len bytes from buf, NULs included. Returns len in v0.
+ *
+ * Codes from 110 on control the CPUs of gsim --cpus N, see multiCore.h. exit and exit2 only stop the calling
+ * CPU, except on CPU 0 where they end the program. With a single CPU, cpu_start and cpu_join return -1.
+ *
+ * 110	cpu_id()	            Returns the number of the calling CPU, 0 to N-1, in v0 and N in v1.
+ * 111	cpu_start(entry,arg)	Start an idle CPU at entry with arg in a0, its own empty stack, gp copied from
+ *                                  the caller and every other register 0. Returns its number in v0, or -1 if
+ *                                  every CPU is busy. The CPU stops when it calls exit or exit2.
+ * 112	cpu_join(cpu)	        Wait until a CPU started by cpu_start has stopped. Returns the code it passed to
+ *                                  exit2, 0 for exit, in v0, or -1 if cpu is not a CPU started since the last
+ *                                  cpu_join of it.
+ *
+ * Codes from 120 on read the guest's performance counters and mark regions of interest, see guestCounters.h.
+ *
+ * 120	read_insts()	        Returns the instructions retired in v0 (low word) and v1 (high word).
+ * 121	read_mem_ops()	        Returns the loads in v0 and the stores in v1.
+ * 122	read_cycles()	        Returns the simulated cycles in v0 (low word) and v1 (high word).
+ * 123	roi_begin()	            Start a region of interest.
+ * 124	roi_end()	            End the region of interest.
+ */
+err_code syscall_();
+
+
+/**
+ * Redirect the console syscalls, which read stdin and print to stdout until
+ * this is called.
+ * @param in - Stream read by read_int and read_string, NULL for stdin
+ * @param out - Stream printed to, NULL for stdout
+ */
+void syscall_streams(FILE* in, FILE* out);
+
+/**
+ * Have read_int and read_string check that their input is there before
+ * reading it. When ready returns 0 they return WOULD_BLOCK without any
+ * effect; the run loop has then moved pc past the syscall, so it must be
+ * moved back by 4 to execute the syscall again.
+ * @param ready - Returns nonzero once a whole line, the end of the input or
+ *                  len bytes can be read without blocking; NULL to read
+ *                  right away
  */
-err_code syscall();
+void syscall_input_check(int (*ready)(size_t len));
 
 #endif //GSIM_FUNCTIONS_H
@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "daemon.h"
+#include "imageCache.h"
+
+
+static void usage() {
+	fprintf(stderr, "Usage: gsimd [options] socket\n"
+	                "Options:\n"
+	                "  --workers N               Run jobs on N worker processes (default 4)\n"
+	                "  --image-cache DIR         Keep the analyzed images of the programs in DIR\n"
+	                "  --shared-image            Share the images of the programs in memory\n"
+	                "                            between the workers\n");
+}
+
+int main(int argc, char* argv[]) {
+	char* endptr;
+	long workers = DAEMON_DEFAULT_WORKERS;
+
+	int argi = 1;
+	while(argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+		if(strcmp(argv[argi], "--workers") == 0 && argi + 1 < argc
+		   && (workers = strtol(argv[argi + 1], &endptr, 0)) > 0 && *endptr == '\0') {
+			argi++;
+		} else if(strcmp(argv[argi], "--image-cache") == 0 && argi + 1 < argc) {
+			imgcache_dir(argv[++argi]);
+		} else if(strcmp(argv[argi], "--shared-image") == 0) {
+			imgcache_shared();
+		} else {
+			usage();
+			return EXIT_FAILURE;
+		}
+		argi++;
+	}
+	if(argi + 1 != argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if(daemon_serve(argv[argi], workers) != 0) {
+		fprintf(stderr, "Could not listen on \"%s\"\n", argv[argi]);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+
+#include "guestCounters.h"
+#include "hostProfile.h"
+
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL uint64_t instCount;
+
+int guestCounting;
+CPU_LOCAL uint64_t guestLoads;
+CPU_LOCAL uint64_t guestStores;
+CPU_LOCAL uint64_t guestStalls;
+int roiInside = 1;
+
+typedef struct roi_counts {
+    uint64_t insts;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t cycles;
+} roi_counts;
+
+static int roiEnabled;
+static int roiProfiling;
+static int numRegions;
+static roi_counts regionStart;
+static roi_counts totals;
+
+
+static void read_counts(roi_counts* c) {
+    c->insts = instCount;
+    c->loads = guestLoads;
+    c->stores = guestStores;
+    c->cycles = instCount + guestStalls;
+}
+
+void guestcounters_roi(int profiling) {
+    roiEnabled = 1;
+    roiProfiling = profiling;
+    roiInside = 0;
+    // The regions are measured whatever the program reads itself
+    guestCounting = 1;
+}
+
+static void roi_begin() {
+    read_counts(&regionStart);
+    roiInside = 1;
+    numRegions++;
+    if(roiProfiling) {
+        hostprof_begin();
+    }
+}
+
+static void roi_end() {
+    roi_counts now;
+    read_counts(&now);
+    totals.insts += now.insts - regionStart.insts;
+    totals.loads += now.loads - regionStart.loads;
+    totals.stores += now.stores - regionStart.stores;
+    totals.cycles += now.cycles - regionStart.cycles;
+    roiInside = 0;
+    if(roiProfiling) {
+        hostprof_end();
+    }
+}
+
+err_code guestcounters_syscall(uint32_t code) {
+    // Leave the run loop for its counting copy
+    err_code err = guestCounting ? SUCCESS : MODE_SWITCH;
+    guestCounting = 1;
+    switch(code) {
+        case 120:
+            registers[2] = (uint32_t) instCount;
+            registers[3] = (uint32_t) (instCount >> 32);
+            break;
+        case 121:
+            registers[2] = (uint32_t) guestLoads;
+            registers[3] = (uint32_t) guestStores;
+            break;
+        case 122: {
+            uint64_t cycles = instCount + guestStalls;
+            registers[2] = (uint32_t) cycles;
+            registers[3] = (uint32_t) (cycles >> 32);
+            break;
+        }
+        case 123:
+            if(roiEnabled && !roiInside) {
+                roi_begin();
+                err = MODE_SWITCH;
+            }
+            break;
+        case 124:
+            if(roiEnabled && roiInside) {
+                roi_end();
+                err = MODE_SWITCH;
+            }
+            break;
+        default:
+            return BAD_SYSCALL;
+    }
+    return err;
+}
+
+void guestcounters_report() {
+    if(roiInside) {
+        roi_end();
+    }
+    fprintf(stderr, "\nRegions of interest (%d):\n", numRegions);
+    fprintf(stderr, "  instructions %16llu\n", (unsigned long long) totals.insts);
+    fprintf(stderr, "  loads        %16llu\n", (unsigned long long) totals.loads);
+    fprintf(stderr, "  stores       %16llu\n", (unsigned long long) totals.stores);
+    fprintf(stderr, "  cycles       %16llu\n", (unsigned long long) totals.cycles);
+}
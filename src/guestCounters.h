@@ -0,0 +1,62 @@
+#ifndef GSIM_GUESTCOUNTERS_H
+#define GSIM_GUESTCOUNTERS_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+
+/**
+ * Performance counters the guest reads through syscalls, and regions of
+ * interest it marks.
+ *
+ * Instructions retired are always known. Loads, stores and a simulated
+ * cycle count need the run loop to count them, which a program not asking
+ * for them should not pay for: the run loop has a counting copy, taken
+ * from the first of the syscalls below on. Those counts start there, so a
+ * program measures a region by the difference of two reads around it. The
+ * cycle count is one per instruction plus the extra cycles of the R2000's
+ * multiply and divide.
+ *
+ * 120	read_insts()	        Instructions retired before the call, low word in v0 and high word in v1.
+ * 121	read_mem_ops()	        Loads (ll included) in v0 and stores (sc included) in v1.
+ * 122	read_cycles()	        Simulated cycles, low word in v0 and high word in v1.
+ * 123	roi_begin()	            Enter a region of interest.
+ * 124	roi_end()	            Leave it.
+ *
+ * Regions only matter with gsim --roi: then --trace and --host-counters
+ * are off outside of them, and the instructions, loads, stores and cycles
+ * of all the regions are added up and reported on stderr when the program
+ * stops. A region still open at that point ends there.
+ */
+
+#define GUESTCOUNTERS_MULT_CYCLES 12    // Cycles of mult and multu
+#define GUESTCOUNTERS_DIV_CYCLES 35     // Cycles of div and divu
+
+extern int guestCounting;                   // Counting copy of the run loop in use
+extern CPU_LOCAL uint64_t guestLoads;
+extern CPU_LOCAL uint64_t guestStores;
+extern CPU_LOCAL uint64_t guestStalls;      // Cycles beyond one per instruction
+extern int roiInside;                       // Tracing and profiling on, always without --roi
+
+/**
+ * Restrict tracing and host counters to the regions of interest, before
+ * the program runs.
+ * @param profiling - Whether host counters are enabled, to be started and
+ *                      stopped with each region
+ */
+void guestcounters_roi(int profiling);
+
+/**
+ * Run one of the syscalls above.
+ * @return SUCCESS, or MODE_SWITCH if the run loop must be left for the
+ *          change to take effect
+ */
+err_code guestcounters_syscall(uint32_t code);
+
+/**
+ * End the open region, if any, and print the totals of the regions to
+ * stderr. Called once the program stopped, when guestcounters_roi() was.
+ */
+void guestcounters_report();
+
+#endif // GSIM_GUESTCOUNTERS_H
@@ -0,0 +1,92 @@
+#define _DEFAULT_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "hostCounters.h"
+
+static const uint64_t configs[HC_NUM_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_MISSES
+};
+
+static const char* names[HC_NUM_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "branch-misses",
+    "cache-misses"
+};
+
+
+static int open_counter(uint64_t config, int groupFd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = groupFd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+int hostcounters_open(host_counters* hc) {
+    hc->leader = -1;
+    hc->numOpen = 0;
+    for(int i=0; i<HC_NUM_COUNTERS; i++) {
+        hc->fds[i] = open_counter(configs[i], hc->leader);
+        hc->slot[i] = -1;
+        if(hc->fds[i] >= 0) {
+            if(hc->leader == -1) {
+                hc->leader = hc->fds[i];
+            }
+            hc->slot[i] = hc->numOpen++;
+        }
+    }
+    return hc->numOpen;
+}
+
+void hostcounters_start(host_counters* hc) {
+    if(hc->leader >= 0) {
+        ioctl(hc->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(hc->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void hostcounters_stop(host_counters* hc) {
+    if(hc->leader >= 0) {
+        ioctl(hc->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void hostcounters_read(host_counters* hc, uint64_t values[HC_NUM_COUNTERS]) {
+    // Group read format: number of counters, then one value per counter
+    uint64_t buf[1 + HC_NUM_COUNTERS];
+    ssize_t expected = (1 + hc->numOpen) * sizeof(uint64_t);
+    int ok = hc->leader >= 0 && read(hc->leader, buf, sizeof(buf)) == expected;
+
+    for(int i=0; i<HC_NUM_COUNTERS; i++) {
+        values[i] = ok && hc->slot[i] >= 0 ? buf[1 + hc->slot[i]] : UINT64_MAX;
+    }
+}
+
+void hostcounters_close(host_counters* hc) {
+    for(int i=0; i<HC_NUM_COUNTERS; i++) {
+        if(hc->fds[i] >= 0) {
+            close(hc->fds[i]);
+            hc->fds[i] = -1;
+        }
+    }
+    hc->leader = -1;
+    hc->numOpen = 0;
+}
+
+const char* hostcounters_name(host_counter counter) {
+    return names[counter];
+}
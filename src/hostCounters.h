@@ -0,0 +1,64 @@
+#ifndef GSIM_HOSTCOUNTERS_H
+#define GSIM_HOSTCOUNTERS_H
+
+#include <stdint.h>
+
+/**
+ * Host hardware performance counters, read through perf_event_open(2).
+ *
+ * The counters are opened as one group so they are scheduled together, and
+ * only count user-space execution of the calling thread. Any counter the
+ * host does not provide (no PMU in a virtual machine, perf_event_paranoid
+ * too strict, seccomp filters...) is reported as unavailable instead of
+ * failing, so callers can always print what they got.
+ */
+
+typedef enum host_counter {
+    HC_CYCLES,
+    HC_INSTRUCTIONS,
+    HC_BRANCH_MISSES,
+    HC_CACHE_MISSES,
+    HC_NUM_COUNTERS
+} host_counter;
+
+typedef struct host_counters {
+    int fds[HC_NUM_COUNTERS];       // -1 for unavailable counters
+    int slot[HC_NUM_COUNTERS];      // Position of each counter in a group read
+    int leader;
+    int numOpen;
+} host_counters;
+
+/**
+ * Open the counters, disabled.
+ * @return Number of counters available, 0 if none could be opened
+ */
+int hostcounters_open(host_counters* hc);
+
+/**
+ * Reset all counters to zero and start counting.
+ */
+void hostcounters_start(host_counters* hc);
+
+/**
+ * Stop counting.
+ */
+void hostcounters_stop(host_counters* hc);
+
+/**
+ * Read the counters.
+ * @param values - Filled with each counter's value, UINT64_MAX for the
+ *                  unavailable ones
+ */
+void hostcounters_read(host_counters* hc, uint64_t values[HC_NUM_COUNTERS]);
+
+/**
+ * Close the counters.
+ */
+void hostcounters_close(host_counters* hc);
+
+/**
+ * @return Short name of a counter, for reports
+ */
+const char* hostcounters_name(host_counter counter);
+
+#endif // GSIM_HOSTCOUNTERS_H
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "simulator.h"
+#include "hostCounters.h"
+#include "hostProfile.h"
+
+#define CALIBRATION_ROUNDS 1000
+
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL uint64_t instCount;
+
+typedef enum op_class {
+    CLASS_ALU,
+    CLASS_SHIFT,
+    CLASS_IMMEDIATE,
+    CLASS_LOAD,
+    CLASS_STORE,
+    CLASS_BRANCH,
+    CLASS_JUMP,
+    CLASS_MULDIV,
+    CLASS_HILO,
+    CLASS_SYSCALL,
+    CLASS_OTHER,
+    NUM_CLASSES
+} op_class;
+
+static const char* classNames[NUM_CLASSES] = {
+    "alu", "shift", "immediate", "load", "store", "branch",
+    "jump", "mult/div", "hi/lo", "syscall", "other"
+};
+
+static host_counters hc;
+static uint64_t interval;
+static uint64_t startCount;
+static uint64_t retired;
+static uint64_t totals[HC_NUM_COUNTERS];
+static uint64_t samples[NUM_CLASSES];
+static double classCounts[NUM_CLASSES][HC_NUM_COUNTERS];
+static double readCost[HC_NUM_COUNTERS];      // Counts added by one pair of reads
+static uint64_t nextSample;
+static uint32_t rngState = 0x9E3779B9;
+
+
+static op_class classify(inst word) {
+    uint8_t opcode = word >> 26 & 0x3F;
+    if(opcode == 0) {
+        uint8_t function = word & 0x3F;
+        if(function <= 7) {
+            return CLASS_SHIFT;
+        } else if(function == 8 || function == 9) {
+            return CLASS_JUMP;
+        } else if(function == 12) {
+            return CLASS_SYSCALL;
+        } else if(function >= 16 && function <= 19) {
+            return CLASS_HILO;
+        } else if(function >= 24 && function <= 27) {
+            return CLASS_MULDIV;
+        } else if(function >= 32 && function <= 43) {
+            return CLASS_ALU;
+        }
+        return CLASS_OTHER;
+    } else if(opcode == 2 || opcode == 3) {
+        return CLASS_JUMP;
+    } else if(opcode >= 4 && opcode <= 7) {
+        return CLASS_BRANCH;
+    } else if(opcode >= 8 && opcode <= 15) {
+        return CLASS_IMMEDIATE;
+    } else if((opcode >= 32 && opcode <= 38) || opcode == 48) {
+        return CLASS_LOAD;
+    } else if((opcode >= 40 && opcode <= 46) || opcode == 56) {
+        return CLASS_STORE;
+    }
+    return CLASS_OTHER;
+}
+
+static void read_counters(uint64_t values[HC_NUM_COUNTERS]) {
+    hostcounters_read(&hc, values);
+}
+
+/**
+ * Measure what two back to back counter reads add to the counts, so it can
+ * be subtracted from every sample.
+ */
+static void calibrate() {
+    uint64_t before[HC_NUM_COUNTERS];
+    uint64_t after[HC_NUM_COUNTERS];
+    double sum[HC_NUM_COUNTERS] = {0};
+
+    hostcounters_start(&hc);
+    for(int r=0; r<CALIBRATION_ROUNDS; r++) {
+        read_counters(before);
+        read_counters(after);
+        for(int c=0; c<HC_NUM_COUNTERS; c++) {
+            sum[c] += (double) (after[c] - before[c]);
+        }
+    }
+    hostcounters_stop(&hc);
+    for(int c=0; c<HC_NUM_COUNTERS; c++) {
+        readCost[c] = sum[c] / CALIBRATION_ROUNDS;
+    }
+}
+
+int hostprof_enable(uint64_t sampleInterval) {
+    if(hostcounters_open(&hc) == 0) {
+        return -1;
+    }
+    interval = sampleInterval;
+    if(interval) {
+        calibrate();
+    }
+    return 0;
+}
+
+void hostprof_begin() {
+    startCount = instCount;
+    hostcounters_start(&hc);
+}
+
+void hostprof_end() {
+    uint64_t values[HC_NUM_COUNTERS];
+    hostcounters_stop(&hc);
+    hostcounters_read(&hc, values);
+    for(int c=0; c<HC_NUM_COUNTERS; c++) {
+        totals[c] = values[c] == UINT64_MAX ? UINT64_MAX : totals[c] + values[c];
+    }
+    retired += instCount - startCount;
+}
+
+/**
+ * Distance to the next sample, uniformly spread over [interval/2,
+ * 3*interval/2) so the samples do not lock onto the period of a loop.
+ */
+static uint64_t jitter() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return interval / 2 + 1 + rngState % interval;
+}
+
+uint64_t hostprof_next(uint64_t now) {
+    if(interval == 0) {
+        return UINT64_MAX;
+    }
+    if(nextSample <= now) {
+        nextSample = now + jitter();
+    }
+    return nextSample;
+}
+
+err_code hostprof_sample(uint64_t limit) {
+    uint64_t before[HC_NUM_COUNTERS];
+    uint64_t after[HC_NUM_COUNTERS];
+    uint64_t start = instCount;
+    byte* word = getRealAddr(pc);
+    op_class cls = word == NULL ? CLASS_OTHER :
+                   classify((inst) word[0] << 24 | (inst) word[1] << 16 | (inst) word[2] << 8 | word[3]);
+
+    read_counters(before);
+    err_code err = sim_step(limit);
+    read_counters(after);
+    if(instCount == start) {
+        // Too close to the next checkpoint, snapshot or poll
+        return err;
+    }
+
+    // A fused sequence is charged to the class of its first instruction
+    double ran = (double) (instCount - start);
+    samples[cls]++;
+    for(int c=0; c<HC_NUM_COUNTERS; c++) {
+        classCounts[cls][c] += ((double) (after[c] - before[c]) - readCost[c]) / ran;
+    }
+    return err;
+}
+
+void hostprof_report() {
+    fprintf(stderr, "\nHost counters for %llu guest instructions:\n", (unsigned long long) retired);
+    for(int c=0; c<HC_NUM_COUNTERS; c++) {
+        if(totals[c] == UINT64_MAX) {
+            fprintf(stderr, "  %-14s %16s\n", hostcounters_name(c), "unavailable");
+        } else {
+            fprintf(stderr, "  %-14s %16llu %10.2f per guest instruction\n", hostcounters_name(c),
+                    (unsigned long long) totals[c], retired ? (double) totals[c] / retired : 0.0);
+        }
+    }
+
+    uint64_t sampled = 0;
+    for(int k=0; k<NUM_CLASSES; k++) {
+        sampled += samples[k];
+    }
+    if(sampled) {
+        fprintf(stderr, "Per opcode class, sampled 1 in %llu (%llu samples), per guest instruction:\n",
+                (unsigned long long) interval, (unsigned long long) sampled);
+        fprintf(stderr, "  %-10s %7s", "class", "share");
+        for(int c=0; c<HC_NUM_COUNTERS; c++) {
+            fprintf(stderr, " %14s", hostcounters_name(c));
+        }
+        fprintf(stderr, "\n");
+        for(int k=0; k<NUM_CLASSES; k++) {
+            if(samples[k] == 0) {
+                continue;
+            }
+            fprintf(stderr, "  %-10s %6.1f%%", classNames[k], 100.0 * samples[k] / sampled);
+            for(int c=0; c<HC_NUM_COUNTERS; c++) {
+                if(totals[c] == UINT64_MAX) {
+                    fprintf(stderr, " %14s", "-");
+                } else {
+                    fprintf(stderr, " %14.2f", classCounts[k][c] / samples[k]);
+                }
+            }
+            fprintf(stderr, "\n");
+        }
+    }
+    hostcounters_close(&hc);
+}
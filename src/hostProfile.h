@@ -0,0 +1,64 @@
+#ifndef GSIM_HOSTPROFILE_H
+#define GSIM_HOSTPROFILE_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+
+/**
+ * Host counter profile of a simulation run (gsim --host-counters).
+ *
+ * The host counters of hostCounters.h are enabled around sim_run() and
+ * reported per guest instruction retired. With sampling enabled, one
+ * dispatch of the decoded loop out of every interval instructions is also
+ * executed alone between two counter reads, and its counts are charged to
+ * the opcode class of the instruction at pc; the cost of the reads
+ * themselves is calibrated and subtracted. Being cut out of the loop, a
+ * sample still misses the branch history and prefetching of a free run. The per-class
+ * figures show whether a workload is bound by dispatch, memory translation
+ * or syscall I/O inside the simulator.
+ */
+
+/**
+ * Open the counters.
+ * @param sampleInterval - Guest instructions between per-class samples,
+ *                          0 to only count totals
+ * @return 0 on success, -1 if no host counter is available
+ */
+int hostprof_enable(uint64_t sampleInterval);
+
+/**
+ * Start counting. Called right before sim_run(), or at the start of each
+ * region of interest.
+ */
+void hostprof_begin();
+
+/**
+ * Stop counting and add the counts since hostprof_begin() to the totals.
+ * Called right after sim_run(), or at the end of each region of interest.
+ */
+void hostprof_end();
+
+/**
+ * Instruction count of the next sample.
+ * @param now - Instructions executed so far
+ * @return Count of the next sample after now, or UINT64_MAX if none
+ */
+uint64_t hostprof_next(uint64_t now);
+
+/**
+ * Execute the instruction at pc, or the fused sequence starting there,
+ * between two counter reads and charge the counts per instruction to its
+ * opcode class.
+ * @param limit - Instruction count of the next checkpoint, snapshot or poll;
+ *                  no sample is taken if it could reach it
+ * @return Code returned by the last instruction executed
+ */
+err_code hostprof_sample(uint64_t limit);
+
+/**
+ * Print the totals and per-class breakdown to stderr and close the counters.
+ */
+void hostprof_report();
+
+#endif // GSIM_HOSTPROFILE_H
@@ -0,0 +1,314 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "imageCache.h"
+#include "decode.h"
+
+#define PC_INIT_LOC 0x8
+#define TEXT_SIZE_LOC 0xc
+#define TEXT_START_LOC 0x34
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+
+extern byte* text;
+extern byte* data;
+extern size_t textSize;
+extern size_t dataSize;
+
+static const char* cacheDir;
+static int shared;
+static int verify;
+static byte* image;         // Mapping of the image in use
+static size_t imageLen;
+
+
+static uint32_t get32(const byte* src) {
+    return ((uint32_t) src[0] << 24) + ((uint32_t) src[1] << 16) +
+            ((uint32_t) src[2] << 8) + src[3];
+}
+
+/**
+ * FNV-1a style hash taking 8 bytes at a time, continuing from h.
+ */
+static uint64_t hash_bytes(uint64_t h, const void* bytes, size_t len) {
+    const byte* p = bytes;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, &p[i], 8);
+        h = (h ^ word) * FNV_PRIME;
+        h ^= h >> 29;
+    }
+    for(; i<len; i++) {
+        h = (h ^ p[i]) * FNV_PRIME;
+    }
+    return h;
+}
+
+static size_t page_align(size_t len) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    return (len + pageSize - 1) / pageSize * pageSize;
+}
+
+/**
+ * Header describing the image of an executable, without the checksum.
+ */
+static void fill_header(image_header* h, const byte* execFile, size_t numBlocks) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    h->version = IMAGE_VERSION;
+    h->dinstSize = sizeof(dinst);
+    h->numOps = NUM_OPS;
+    h->blockSize = sizeof(cfg_block);
+    h->buildId = hash_bytes(FNV_OFFSET, IMAGE_BUILD_ID, strlen(IMAGE_BUILD_ID));
+
+    size_t loaded;
+    h->textSize = get32(&execFile[TEXT_SIZE_LOC]);
+    h->zeroSize = sim_data_size(execFile, &loaded) - loaded;
+    h->dataSize = loaded;
+    h->entry = get32(&execFile[PC_INIT_LOC]);
+    h->key = hash_bytes(hash_bytes(FNV_OFFSET, h, sizeof(*h)), execFile,
+                        TEXT_START_LOC + (size_t) h->textSize + h->dataSize);
+    h->numBlocks = numBlocks;
+
+    size_t slots = h->textSize / 4 + 1;
+    h->slotsOff = page_align(sizeof(*h));
+    h->textOff = h->slotsOff + page_align(slots * sizeof(dinst));
+    h->dataOff = h->textOff + page_align(h->textSize);
+    h->blocksOff = h->dataOff + page_align(h->dataSize);
+    h->blockOfOff = h->blocksOff + numBlocks * sizeof(cfg_block);
+    h->fileSize = h->blockOfOff + (slots - 1) * sizeof(int);
+}
+
+static void image_name(char* name, size_t size, uint64_t key) {
+    if(shared) {
+        snprintf(name, size, "/gsim-%016llx", (unsigned long long) key);
+    } else {
+        snprintf(name, size, "%s/%016llx.img", cacheDir, (unsigned long long) key);
+    }
+}
+
+/**
+ * Check the header of an image against the one expected for the
+ * executable being loaded.
+ */
+static int header_matches(const image_header* h, const image_header* expect, size_t fileSize) {
+    return memcmp(h->magic, expect->magic, sizeof(h->magic)) == 0
+           && h->version == expect->version && h->dinstSize == expect->dinstSize
+           && h->numOps == expect->numOps && h->blockSize == expect->blockSize
+           && h->buildId == expect->buildId
+           && h->key == expect->key && h->textSize == expect->textSize
+           && h->dataSize == expect->dataSize && h->zeroSize == expect->zeroSize
+           && h->entry == expect->entry
+           && h->slotsOff == expect->slotsOff && h->textOff == expect->textOff
+           && h->dataOff == expect->dataOff && h->blocksOff == expect->blocksOff
+           && h->blockOfOff == h->blocksOff + (uint64_t) h->numBlocks * sizeof(cfg_block)
+           && h->fileSize == h->blockOfOff + (uint64_t) (h->textSize / 4) * sizeof(int)
+           && h->fileSize == fileSize;
+}
+
+/**
+ * Map a segment privately from an image, so its pages are shared until
+ * written.
+ * @param size - Bytes of the segment stored in the image. The padding of
+ *                  the image supplies zeroes up to the next page, and the
+ *                  pages after that are anonymous.
+ * @param total - Size of the segment
+ * @return Segment, or NULL on failure
+ */
+static byte* map_segment(int fd, uint64_t offset, size_t size, size_t total) {
+    byte* seg = sim_alloc_segment(total);
+    if(seg != NULL && size != 0
+       && mmap(seg, page_align(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) == MAP_FAILED) {
+        sim_free_segment(seg, total);
+        return NULL;
+    }
+    return seg;
+}
+
+void imgcache_dir(const char* dir) {
+    cacheDir = dir;
+}
+
+void imgcache_shared() {
+    shared = 1;
+}
+
+void imgcache_verify() {
+    verify = 1;
+}
+
+int imgcache_load(const byte* execFile) {
+    if(cacheDir == NULL && !shared) {
+        return -1;
+    }
+    image_header expect;
+    fill_header(&expect, execFile, 0);
+    char name[4096];
+    image_name(name, sizeof(name), expect.key);
+    int fd = shared ? shm_open(name, O_RDONLY, 0) : open(name, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    image_header h;
+    memset(&h, 0, sizeof(h));
+    ssize_t got = pread(fd, &h, sizeof(h), 0);
+    if(fstat(fd, &st) != 0 || got != sizeof(h) || !header_matches(&h, &expect, st.st_size)) {
+        // A shared object gets the magic of its header last, so a whole
+        // header with it that does not match is stale or damaged and can
+        // be replaced. A short or unmarked one is still being written.
+        if(shared && got == sizeof(h) && memcmp(h.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0) {
+            shm_unlink(name);
+        }
+        close(fd);
+        return -1;
+    }
+
+    byte* map = mmap(NULL, h.fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    byte* textSeg = map_segment(fd, h.textOff, textSize, textSize);
+    byte* dataSeg = map_segment(fd, h.dataOff, h.dataSize, dataSize);
+    close(fd);
+
+    // Reading the whole image back costs about as much as decoding it, so
+    // only --image-verify rules out hash collisions and damaged contents
+    if(map == MAP_FAILED || textSeg == NULL || dataSeg == NULL
+       || ((dinst*) &map[h.slotsOff])[textSize / 4].op != OP_END
+       || (verify && (memcmp(textSeg, &execFile[TEXT_START_LOC], textSize) != 0
+                      || memcmp(dataSeg, &execFile[TEXT_START_LOC + textSize], h.dataSize) != 0
+                      || hash_bytes(FNV_OFFSET, &map[sizeof(h)], h.fileSize - sizeof(h)) != h.checksum))) {
+        if(map != MAP_FAILED) {
+            munmap(map, h.fileSize);
+        }
+        sim_free_segment(textSeg, textSize);
+        sim_free_segment(dataSeg, dataSize);
+        if(shared) {
+            shm_unlink(name);
+        }
+        return -1;
+    }
+
+    imgcache_close();
+    image = map;
+    imageLen = h.fileSize;
+    text = textSeg;
+    data = dataSeg;
+    decode_attach((dinst*) &map[h.slotsOff]);
+    return 0;
+}
+
+/**
+ * Write an image into a new shared memory object, header last and the
+ * magic of the header after the rest of it.
+ */
+static void publish_shared(const char* name, const byte* file, size_t len) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0) {
+        // Another run is publishing it
+        return;
+    }
+    size_t hdrLen = sizeof(image_header);
+    size_t magicLen = sizeof(((image_header*) 0)->magic);
+    int failed = ftruncate(fd, len) != 0
+                 || pwrite(fd, &file[hdrLen], len - hdrLen, hdrLen) != (ssize_t) (len - hdrLen)
+                 || pwrite(fd, &file[magicLen], hdrLen - magicLen, magicLen) != (ssize_t) (hdrLen - magicLen)
+                 || pwrite(fd, file, magicLen, 0) != (ssize_t) magicLen;
+    close(fd);
+    if(failed) {
+        shm_unlink(name);
+    }
+}
+
+/**
+ * Write an image into a file of the cache directory, renaming it into
+ * place once complete.
+ */
+static void publish_file(const char* name, const byte* file, size_t len) {
+    char tmpName[4096 + 32];
+    snprintf(tmpName, sizeof(tmpName), "%s.%ld.tmp", name, (long) getpid());
+    FILE* out = fopen(tmpName, "wb");
+    if(out != NULL) {
+        int failed = fwrite(file, 1, len, out) != len;
+        failed |= fclose(out);
+        if(failed || rename(tmpName, name) != 0) {
+            remove(tmpName);
+        }
+    }
+}
+
+void imgcache_store(const byte* execFile) {
+    if(cacheDir == NULL && !shared) {
+        return;
+    }
+    cfg g;
+    if(cfg_load(&g, execFile) != 0) {
+        return;
+    }
+    image_header h;
+    fill_header(&h, execFile, g.numBlocks);
+    h.numLoops = g.numLoops;
+    h.numResolved = g.numResolved;
+
+    byte* file = calloc(h.fileSize, 1);
+    if(file != NULL) {
+        decode_all();
+        memcpy(&file[h.slotsOff], decoded, (numSlots + 1) * sizeof(dinst));
+        memcpy(&file[h.textOff], &execFile[TEXT_START_LOC], h.textSize);
+        memcpy(&file[h.dataOff], &execFile[TEXT_START_LOC + h.textSize], h.dataSize);
+        memcpy(&file[h.blocksOff], g.blocks, g.numBlocks * sizeof(cfg_block));
+        memcpy(&file[h.blockOfOff], g.blockOf, numSlots * sizeof(int));
+        h.checksum = hash_bytes(FNV_OFFSET, &file[sizeof(h)], h.fileSize - sizeof(h));
+        memcpy(file, &h, sizeof(h));
+
+        char name[4096];
+        image_name(name, sizeof(name), h.key);
+        if(shared) {
+            publish_shared(name, file, h.fileSize);
+        } else {
+            publish_file(name, file, h.fileSize);
+        }
+    }
+    free(file);
+    cfg_free(&g);
+}
+
+int imgcache_cfg(cfg* g, const byte* execFile) {
+    if(image == NULL) {
+        return -1;
+    }
+    const image_header* h = (const image_header*) image;
+    memset(g, 0, sizeof(*g));
+    g->numBlocks = h->numBlocks;
+    g->numSlots = h->textSize / 4;
+    g->blocks = malloc(h->numBlocks * sizeof(cfg_block) + 1);
+    g->blockOf = malloc(g->numSlots * sizeof(int) + 1);
+    if(g->blocks == NULL || g->blockOf == NULL) {
+        cfg_free(g);
+        return -1;
+    }
+    memcpy(g->blocks, &image[h->blocksOff], h->numBlocks * sizeof(cfg_block));
+    memcpy(g->blockOf, &image[h->blockOfOff], g->numSlots * sizeof(int));
+    g->text = &execFile[TEXT_START_LOC];
+    g->entry = h->entry;
+    g->numLoops = h->numLoops;
+    g->numResolved = h->numResolved;
+    return 0;
+}
+
+void imgcache_close() {
+    if(image != NULL) {
+        munmap(image, imageLen);
+        image = NULL;
+        imageLen = 0;
+    }
+}
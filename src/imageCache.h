@@ -0,0 +1,129 @@
+#ifndef GSIM_IMAGECACHE_H
+#define GSIM_IMAGECACHE_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+#include "cfg.h"
+
+/**
+ * Cache of loaded and analyzed program images, kept on disk
+ * (gsim --image-cache DIR) or in shared memory (gsim --shared-image).
+ *
+ * The first run of an executable loads, decodes and analyzes it as usual,
+ * then publishes the image: its decoded slots, control-flow graph, text
+ * segment and pristine data segment. The image is named after a hash of the
+ * executable's bytes and of the cache format. Later runs of the same
+ * executable map the image instead of loading it. The text and data
+ * segments and the slots are mapped privately from it, so every process
+ * running the executable shares the same physical pages and only gets its
+ * own copy of a page when it writes to it.
+ *
+ * Image layout, in host byte order since it is only read back by the same
+ * build. Sections start on a page boundary so they can be mapped:
+ *
+ *       image_header
+ *       decoded slots, numSlots + 1 of them
+ *       text segment
+ *       stored part of the data segment, as in the executable
+ *       cfg blocks, then the block of each slot
+ *
+ * An image is only used if its header matches this build and the
+ * executable being loaded, whose bytes it is keyed on; anything else is
+ * ignored and replaced. Checking the checksum of its contents and its
+ * segments against the executable as well reads the whole image, which
+ * costs about as much as decoding it, so that is left to --image-verify. Files are written under a
+ * temporary name and renamed into place. Shared memory objects, which
+ * cannot be renamed, are created exclusively and get their header last,
+ * its magic after the rest of it; runs that find an object without a
+ * complete header yet load the executable themselves.
+ */
+
+#define IMAGE_MAGIC "GSIMIMG"
+#define IMAGE_VERSION 3     // Bump when the decoded slots or graph change meaning
+
+// Hash of the decoder's sources, set by the Makefile, so a change to what
+// the slots mean invalidates images even when IMAGE_VERSION is not bumped.
+// Other builds only have IMAGE_VERSION to go by.
+#ifndef IMAGE_BUILD_ID
+#define IMAGE_BUILD_ID ""
+#endif
+
+typedef struct image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dinstSize;     // Layout of this build
+    uint32_t numOps;
+    uint32_t blockSize;
+    uint64_t buildId;       // Hash of IMAGE_BUILD_ID
+    uint64_t key;           // Hash of the executable
+    uint64_t checksum;      // Hash of everything after the header
+    uint64_t slotsOff;      // Offsets of the sections
+    uint64_t textOff;
+    uint64_t dataOff;
+    uint64_t blocksOff;
+    uint64_t blockOfOff;
+    uint64_t fileSize;
+    uint32_t textSize;
+    uint32_t dataSize;      // Stored part of the data segment
+    uint32_t zeroSize;      // Zero-filled part after it
+    uint32_t entry;
+    uint32_t numBlocks;
+    uint32_t numLoops;
+    uint32_t numResolved;
+} image_header;
+
+/**
+ * Keep images in a directory.
+ * @param dir - Directory holding the images, which must exist
+ */
+void imgcache_dir(const char* dir);
+
+/**
+ * Keep images in POSIX shared memory objects named /gsim-KEY instead, so
+ * concurrent runs of an executable share its memory without touching the
+ * disk. The objects last until the host reboots or they are removed from
+ * /dev/shm.
+ */
+void imgcache_shared();
+
+/**
+ * Also check the checksum and segments of images before using them.
+ */
+void imgcache_verify();
+
+/**
+ * Map the cached image of an executable as its text and data segments and
+ * decoded slots, in place of loading the segments and decode_init().
+ * textSize and dataSize must already be set from the executable.
+ * @param execFile - Contents of the executable file
+ * @return 0 if the segments and slots come from the cache, -1 if the cache
+ *          is disabled or holds no valid image of the executable
+ */
+int imgcache_load(const byte* execFile);
+
+/**
+ * Publish the image of an executable right after loading it and calling
+ * decode_init(), before anything executes. The whole text segment is
+ * decoded for it, so later runs do not decode anything. Does nothing when
+ * the cache is disabled; failures only mean the next run loads the
+ * executable again.
+ * @param execFile - Contents of the executable file
+ */
+void imgcache_store(const byte* execFile);
+
+/**
+ * Copy the control-flow graph of the image loaded by imgcache_load().
+ * @param g - Filled with the graph, free it with cfg_free()
+ * @param execFile - Contents of the executable file
+ * @return 0 on success, -1 if no image is loaded
+ */
+int imgcache_cfg(cfg* g, const byte* execFile);
+
+/**
+ * Unmap the loaded image. Called by sim_exit() after decode_exit(); the
+ * segments mapped from it are freed with the others.
+ */
+void imgcache_close();
+
+#endif // GSIM_IMAGECACHE_H
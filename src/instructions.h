@@ -0,0 +1,180 @@
+#ifndef GSIM_INSTRUCTIONS_H
+#define GSIM_INSTRUCTIONS_H
+
+#include "simulator.h"
+
+/**
+ * Instruction table.
+ *
+ * Every implemented instruction is described once here. The op_code enum,
+ * the decoder and disassembler of decode.c, the generic handlers of
+ * functions.c and the operand-specialized variants dispatched by the run
+ * loop are all expanded from these lists, so adding an instruction means
+ * adding one line.
+ *
+ * Each list applies X(OP, name, opcode, funct, args, fault, sem):
+ *   OP      Suffix of its op_code, OP_##OP
+ *   name    Mnemonic, also the name of its handler in functions.c
+ *   opcode  Bits 31 - 26 of the word
+ *   funct   Bits 5 - 0 for R type instructions, 0 otherwise
+ *   args    Operand layout, for the disassembler (ARGS_* below)
+ *   fault   What the instruction can report besides SUCCESS (FAULTS_* below)
+ *   sem     Semantics, over the operand values each list names
+ *
+ * ALU_OPS      R type, $rd = sem of a = $rs and b = $rt
+ * SHIFT_OPS    R type, $rd = sem of b = $rt and s = shamt
+ * IMM_OPS      I type, $rt = sem of a = $rs and i = sign-extended immediate
+ * LOAD_OPS     I type, $rt = sem of p, the host address of $rs + i
+ * STORE_OPS    I type, sem stores v = $rt at p, the host address of $rs + i
+ * BRANCH_OPS   I type, pc += i << 2 when sem of a = $rs and b = $rt holds.
+ *              All conditions are symmetric in a and b.
+ * SPECIAL_OPS  Anything else: sem calls the hand-written handler with the
+ *              operands of dinst* d and gives its err_code
+ *
+ * Writes to $zero are dropped by every handler and variant.
+ */
+
+#define ALU_OPS(X) \
+    X(ADD,   add,   0x00, 0x20, ARGS_DST, OVF_ADD, (uint32_t) a + b) \
+    X(ADDU,  addu,  0x00, 0x21, ARGS_DST, NONE,    (uint32_t) a + b) \
+    X(SUB,   sub,   0x00, 0x22, ARGS_DST, OVF_SUB, (uint32_t) a - b) \
+    X(SUBU,  subu,  0x00, 0x23, ARGS_DST, NONE,    (uint32_t) a - b) \
+    X(AND,   and,   0x00, 0x24, ARGS_DST, NONE,    a & b) \
+    X(OR,    or,    0x00, 0x25, ARGS_DST, NONE,    a | b) \
+    X(XOR,   xor,   0x00, 0x26, ARGS_DST, NONE,    a ^ b) \
+    X(NOR,   nor,   0x00, 0x27, ARGS_DST, NONE,    ~(a | b)) \
+    X(SLT,   slt,   0x00, 0x2A, ARGS_DST, NONE,    a < b) \
+    X(SLTU,  sltu,  0x00, 0x2B, ARGS_DST, NONE,    (uint32_t) a < (uint32_t) b) \
+    X(SLLV,  sllv,  0x00, 0x04, ARGS_DTS, NONE,    (uint32_t) b << (a & 0x1F)) \
+    X(SRLV,  srlv,  0x00, 0x06, ARGS_DTS, NONE,    (uint32_t) b >> (a & 0x1F)) \
+    X(SRAV,  srav,  0x00, 0x07, ARGS_DTS, NONE,    b >> (a & 0x1F))
+
+#define SHIFT_OPS(X) \
+    X(SLL,   sll,   0x00, 0x00, ARGS_DTA, NONE,    (uint32_t) b << s) \
+    X(SRL,   srl,   0x00, 0x02, ARGS_DTA, NONE,    (uint32_t) b >> s) \
+    X(SRA,   sra,   0x00, 0x03, ARGS_DTA, NONE,    b >> s)
+
+#define IMM_OPS(X) \
+    X(ADDI,  addi,  0x08, 0x00, ARGS_TSI, OVF_ADD, (uint32_t) a + i) \
+    X(ADDIU, addiu, 0x09, 0x00, ARGS_TSI, NONE,    (uint32_t) a + i) \
+    X(SLTI,  slti,  0x0A, 0x00, ARGS_TSI, NONE,    a < i) \
+    X(SLTIU, sltiu, 0x0B, 0x00, ARGS_TSI, NONE,    (uint32_t) a < (uint32_t) i) \
+    X(ANDI,  andi,  0x0C, 0x00, ARGS_TSI, NONE,    a & (i & 0xFFFF)) \
+    X(ORI,   ori,   0x0D, 0x00, ARGS_TSI, NONE,    a | (i & 0xFFFF)) \
+    X(LUI,   lui,   0x0F, 0x00, ARGS_TI,  NONE,    (uint32_t) i << 16)
+
+#define LOAD_OPS(X) \
+    X(LB,    lb,    0x20, 0x00, ARGS_MEM, MEM1,    (int8_t) p[0]) \
+    X(LH,    lh,    0x21, 0x00, ARGS_MEM, MEM2,    (int16_t) (p[0] << 8 | p[1])) \
+    X(LW,    lw,    0x23, 0x00, ARGS_MEM, MEM4, \
+      (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | p[2] << 8 | p[3]) \
+    X(LBU,   lbu,   0x24, 0x00, ARGS_MEM, MEM1,    p[0]) \
+    X(LHU,   lhu,   0x25, 0x00, ARGS_MEM, MEM2,    p[0] << 8 | p[1])
+
+#define STORE_OPS(X) \
+    X(SB,    sb,    0x28, 0x00, ARGS_MEM, MEM1,    p[0] = v) \
+    X(SH,    sh,    0x29, 0x00, ARGS_MEM, MEM2,    (p[0] = v >> 8, p[1] = v)) \
+    X(SW,    sw,    0x2B, 0x00, ARGS_MEM, MEM4, \
+      (p[0] = v >> 24, p[1] = v >> 16, p[2] = v >> 8, p[3] = v))
+
+#define BRANCH_OPS(X) \
+    X(BEQ,   beq,   0x04, 0x00, ARGS_STB, NONE,    a == b) \
+    X(BNE,   bne,   0x05, 0x00, ARGS_STB, NONE,    a != b)
+
+#define SPECIAL_OPS(X) \
+    X(JR,      jr,      0x00, 0x08, ARGS_S,    JUMP,  jr(d->rs)) \
+    X(JALR,    jalr,    0x00, 0x09, ARGS_DS,   JUMP,  jalr(d->rs, d->rd)) \
+    X(SYSCALL, syscall, 0x00, 0x0C, ARGS_NONE, ANY,   syscall_()) \
+    X(BREAK,   break,   0x00, 0x0D, ARGS_NONE, ANY,   BREAK) \
+    X(MFHI,    mfhi,    0x00, 0x10, ARGS_D,    NONE,  mfhi(d->rd)) \
+    X(MTHI,    mthi,    0x00, 0x11, ARGS_S,    NONE,  mthi(d->rs)) \
+    X(MFLO,    mflo,    0x00, 0x12, ARGS_D,    NONE,  mflo(d->rd)) \
+    X(MTLO,    mtlo,    0x00, 0x13, ARGS_S,    NONE,  mtlo(d->rs)) \
+    X(MULT,    mult,    0x00, 0x18, ARGS_ST,   NONE,  mult(d->rs, d->rt)) \
+    X(MULTU,   multu,   0x00, 0x19, ARGS_ST,   NONE,  multu(d->rs, d->rt)) \
+    X(DIV,     div,     0x00, 0x1A, ARGS_ST,   ANY,   div_(d->rs, d->rt)) \
+    X(DIVU,    divu,    0x00, 0x1B, ARGS_ST,   ANY,   divu(d->rs, d->rt)) \
+    X(SYNC,    sync,    0x00, 0x0F, ARGS_NONE, NONE,  sync_()) \
+    X(J,       j,       0x02, 0x00, ARGS_J,    JUMP,  j(d->imm)) \
+    X(JAL,     jal,     0x03, 0x00, ARGS_J,    JUMP,  jal(d->imm)) \
+    X(LL,      ll,      0x30, 0x00, ARGS_MEM,  MEM4,  ll(d->rs, d->rt, d->imm)) \
+    X(SC,      sc,      0x38, 0x00, ARGS_MEM,  MEM4,  sc(d->rs, d->rt, d->imm))
+
+#define ALL_OPS(X) \
+    ALU_OPS(X) SHIFT_OPS(X) IMM_OPS(X) LOAD_OPS(X) STORE_OPS(X) BRANCH_OPS(X) SPECIAL_OPS(X)
+
+/**
+ * Operand layouts, as printed by the disassembler.
+ */
+typedef enum op_args {
+    ARGS_NONE,      // syscall
+    ARGS_DST,       // rd, rs, rt
+    ARGS_DTS,       // rd, rt, rs
+    ARGS_DTA,       // rd, rt, shamt
+    ARGS_TSI,       // rt, rs, imm
+    ARGS_TI,        // rt, imm
+    ARGS_MEM,       // rt, imm(rs)
+    ARGS_STB,       // rs, rt, branch target
+    ARGS_S,         // rs
+    ARGS_D,         // rd
+    ARGS_DS,        // rd, rs
+    ARGS_ST,        // rs, rt
+    ARGS_J          // jump target
+} op_args;
+
+/**
+ * Nonzero for instructions that may return something else than SUCCESS,
+ * which the decoder must not turn into a nop when they write $zero.
+ */
+#define FAULTS_NONE 0
+#define FAULTS_OVF_ADD 1    // Signed overflow, OVERFLOW and execution goes on
+#define FAULTS_OVF_SUB 1
+#define FAULTS_MEM1 1       // Address outside every segment, 1 byte access
+#define FAULTS_MEM2 1
+#define FAULTS_MEM4 1
+#define FAULTS_JUMP 1       // Returns JUMPED
+#define FAULTS_ANY 1
+
+#define MEM_SIZE_MEM1 1
+#define MEM_SIZE_MEM2 2
+#define MEM_SIZE_MEM4 4
+
+/**
+ * Code returned by an ALU or immediate instruction computing r from a and b.
+ */
+#define FAULT_NONE(a, b, r) SUCCESS
+#define FAULT_OVF_ADD(a, b, r) ((((a) ^ (r)) & ((b) ^ (r))) < 0 ? OVERFLOW : SUCCESS)
+#define FAULT_OVF_SUB(a, b, r) ((((a) ^ (b)) & ((a) ^ (r))) < 0 ? OVERFLOW : SUCCESS)
+
+/*
+ * Semantics of each instruction as an inline function of its operand
+ * values, alu_addu(a, b), imm_lui(a, i), load_lw(p)...
+ */
+#define ALU_SEM(OP, name, opcode, funct, args, fault, sem) \
+    static inline reg alu_##name(reg a, reg b) { return sem; }
+#define SHIFT_SEM(OP, name, opcode, funct, args, fault, sem) \
+    static inline reg shift_##name(reg b, int s) { return sem; }
+#define IMM_SEM(OP, name, opcode, funct, args, fault, sem) \
+    static inline reg imm_##name(reg a, reg i) { (void) a; return sem; }
+#define LOAD_SEM(OP, name, opcode, funct, args, fault, sem) \
+    static inline reg load_##name(const byte* p) { return sem; }
+#define STORE_SEM(OP, name, opcode, funct, args, fault, sem) \
+    static inline void store_##name(byte* p, reg v) { sem; }
+#define BRANCH_SEM(OP, name, opcode, funct, args, fault, sem) \
+    static inline int branch_##name(reg a, reg b) { return sem; }
+
+ALU_OPS(ALU_SEM)
+SHIFT_OPS(SHIFT_SEM)
+IMM_OPS(IMM_SEM)
+LOAD_OPS(LOAD_SEM)
+STORE_OPS(STORE_SEM)
+BRANCH_OPS(BRANCH_SEM)
+
+#undef ALU_SEM
+#undef SHIFT_SEM
+#undef IMM_SEM
+#undef LOAD_SEM
+#undef STORE_SEM
+#undef BRANCH_SEM
+
+#endif // GSIM_INSTRUCTIONS_H
@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lockstep.h"
+#include "decode.h"
+
+#define STACK_HIGH_ADDR 0x7fffffff
+#define TEXT_ADDRESS 0x400000
+#define DATA_ADDRESS 0x10000000
+#define REG_RA 31
+
+
+extern byte* text;
+
+extern size_t textSize;
+extern size_t dataSize;
+extern CPU_LOCAL size_t stackSize;
+
+
+typedef struct lanes {
+    reg v[LOCKSTEP_LANES];
+} lanes;
+
+/**
+ * An instance of the program: its files, and its state while it does not
+ * own a lane.
+ */
+typedef struct instance {
+    char* inName;
+    char* outName;
+    FILE* in;
+    FILE* out;
+    sim_machine m;
+} instance;
+
+typedef struct lane {
+    instance* inst;     // Instance running in the lane, NULL if it is free
+    uint32_t pc;        // While the lane is not in the group
+} lane;
+
+// Registers of the lanes, with a sink for $zero like registers[]
+static lanes regs[NUM_REGISTERS + 1];
+static lanes hiLanes;
+static lanes loLanes;
+static lane laneOf[LOCKSTEP_LANES];
+static int numBusy;
+
+static uint32_t groupPc;    // pc of the lanes executing
+static lanes group;         // -1 for the lanes executing, 0 for the others
+static int numWaiting;      // Busy lanes outside the group
+static uint32_t minWaiting; // Lowest pc among them
+
+static instance* instances;
+static size_t numInstances;
+static size_t nextInstance;     // First instance not started yet
+static instance** evicted;      // Instances left to the regular run loop
+static size_t numEvicted;
+static size_t dataUsed;         // Bytes of the program's data segment each instance copies
+
+
+/**
+ * Put the lanes of the group at pc next and make the busy lanes at the
+ * lowest pc the group.
+ */
+static void regroup(uint32_t next) {
+    uint32_t low = UINT32_MAX;
+    for(int l=0; l<LOCKSTEP_LANES; l++) {
+        if(group.v[l]) {
+            laneOf[l].pc = next;
+        }
+        if(laneOf[l].inst != NULL && laneOf[l].pc < low) {
+            low = laneOf[l].pc;
+        }
+    }
+    groupPc = low;
+    numWaiting = 0;
+    minWaiting = UINT32_MAX;
+    for(int l=0; l<LOCKSTEP_LANES; l++) {
+        int busy = laneOf[l].inst != NULL;
+        group.v[l] = busy && laneOf[l].pc == low ? -1 : 0;
+        if(busy && laneOf[l].pc != low) {
+            numWaiting++;
+            minWaiting = laneOf[l].pc < minWaiting ? laneOf[l].pc : minWaiting;
+        }
+    }
+}
+
+/**
+ * Put the registers of an instance in a lane.
+ */
+static void load_lane(int l, const instance* inst) {
+    for(int r=0; r<NUM_REGISTERS; r++) {
+        regs[r].v[l] = inst->m.regs[r];
+    }
+    hiLanes.v[l] = inst->m.hi;
+    loLanes.v[l] = inst->m.lo;
+}
+
+/**
+ * Save the registers of a lane in its instance, at the group's pc.
+ */
+static void save_lane(int l, instance* inst) {
+    for(int r=0; r<NUM_REGISTERS; r++) {
+        inst->m.regs[r] = regs[r].v[l];
+    }
+    inst->m.hi = hiLanes.v[l];
+    inst->m.lo = loLanes.v[l];
+    inst->m.pc = groupPc;
+}
+
+/**
+ * Start the next instances of the list in the free lanes. They wait at
+ * the entry point until the next regroup().
+ */
+static void fill_lanes() {
+    for(int l=0; l<LOCKSTEP_LANES && nextInstance < numInstances; l++) {
+        if(laneOf[l].inst != NULL) {
+            continue;
+        }
+        instance* inst = &instances[nextInstance++];
+        inst->in = fopen(inst->inName, "r");
+        inst->out = fopen(inst->outName, "w");
+        if(inst->in == NULL || inst->out == NULL || sim_machine_init(&inst->m, dataUsed) != 0) {
+            fprintf(stderr, "%s: could not open \"%s\" or \"%s\"\n", inst->outName, inst->inName, inst->outName);
+            if(inst->in != NULL) {
+                fclose(inst->in);
+            }
+            if(inst->out != NULL) {
+                fclose(inst->out);
+            }
+            l--;
+            continue;
+        }
+        uint32_t start = inst->m.pc;
+        load_lane(l, inst);
+        laneOf[l].inst = inst;
+        laneOf[l].pc = start;
+        numBusy++;
+        group.v[l] = 0;
+        numWaiting++;
+        minWaiting = start < minWaiting ? start : minWaiting;
+    }
+}
+
+/**
+ * Release an instance that has exited.
+ */
+static void finish_instance(instance* inst) {
+    fclose(inst->in);
+    fclose(inst->out);
+    sim_machine_free(&inst->m);
+}
+
+/**
+ * Remove a lane of the group, which has exited or is evicted.
+ * @param keep - Nonzero to save the state of its instance for the regular
+ *                  run loop, which resumes it at the group's pc
+ */
+static void drop_lane(int l, int keep) {
+    instance* inst = laneOf[l].inst;
+    if(keep) {
+        save_lane(l, inst);
+        instance** grown = realloc(evicted, (numEvicted + 1) * sizeof(instance*));
+        if(grown != NULL) {
+            evicted = grown;
+            evicted[numEvicted++] = inst;
+        }
+    } else {
+        finish_instance(inst);
+    }
+    laneOf[l].inst = NULL;
+    group.v[l] = 0;
+    numBusy--;
+}
+
+/**
+ * Host address of a guest address of a lane, like getRealAddr().
+ */
+static byte* lane_addr(const instance* inst, uint32_t progAddr) {
+    if(progAddr >= TEXT_ADDRESS && progAddr <= TEXT_ADDRESS + textSize) {
+        return &text[progAddr - TEXT_ADDRESS];
+    } else if(progAddr >= DATA_ADDRESS && progAddr <= DATA_ADDRESS + dataSize) {
+        return &inst->m.data[progAddr - DATA_ADDRESS];
+    } else if(progAddr >= STACK_HIGH_ADDR - stackSize && progAddr <= STACK_HIGH_ADDR) {
+        return &inst->m.stack[STACK_HIGH_ADDR - progAddr];
+    }
+    return NULL;
+}
+
+/**
+ * Run the syscall of a lane.
+ * @return Code returned by the handler, or FUNC_NOT_IMPLEMENTED if it
+ *          would write to the text segment
+ */
+static err_code lane_syscall(int l) {
+    uint32_t code = regs[2].v[l];
+    uint32_t dest = regs[4].v[l];
+    uint32_t len = code == 8 ? regs[5].v[l] : regs[6].v[l];
+    if((code == 8 || code == 100 || code == 101)
+       && dest <= TEXT_ADDRESS + textSize && dest + (uint64_t) len >= TEXT_ADDRESS) {
+        return FUNC_NOT_IMPLEMENTED;
+    }
+    // The handlers of functions.c see the lane as the machine
+    instance* inst = laneOf[l].inst;
+    save_lane(l, inst);
+    sim_machine_swap(&inst->m);
+    syscall_streams(inst->in, inst->out);
+    err_code err = syscall_();
+    syscall_streams(NULL, NULL);
+    sim_machine_swap(&inst->m);
+    load_lane(l, inst);
+    // Lanes share one set of counters and have no counting loop to switch to
+    return err == MODE_SWITCH ? SUCCESS : err;
+}
+
+/**
+ * Write the lanes of the group of a register.
+ */
+static inline void set_lanes(lanes* dest, lanes r) {
+    for(int l=0; l<LOCKSTEP_LANES; l++) {
+        dest->v[l] = (r.v[l] & group.v[l]) | (dest->v[l] & ~group.v[l]);
+    }
+}
+
+/**
+ * Move the group on to the next pc of all its lanes.
+ */
+static inline void advance(uint32_t next) {
+    if(numWaiting > 0 && next >= minWaiting) {
+        regroup(next);
+    } else {
+        groupPc = next;
+    }
+}
+
+/**
+ * Move each lane of the group on to its own next pc.
+ */
+static void branch_lanes(const lanes* next) {
+    uint32_t first = 0;
+    int same = 1;
+    int any = 0;
+    for(int l=0; l<LOCKSTEP_LANES; l++) {
+        if(group.v[l]) {
+            same &= !any || (uint32_t) next->v[l] == first;
+            first = any ? first : (uint32_t) next->v[l];
+            any = 1;
+        }
+    }
+    if(same) {
+        advance(first);
+        return;
+    }
+    for(int l=0; l<LOCKSTEP_LANES; l++) {
+        if(group.v[l]) {
+            laneOf[l].pc = next->v[l];
+        }
+    }
+    group = (lanes) {{0}};
+    regroup(0);
+}
+
+/**
+ * Execute the instruction at the group's pc for every lane of the group.
+ */
+static void step() {
+    uint32_t offset = groupPc - TEXT_ADDRESS;
+    if(offset % 4 != 0 || offset / 4 >= numSlots) {
+        // Let the run loop report it
+        for(int l=0; l<LOCKSTEP_LANES; l++) {
+            if(group.v[l]) {
+                drop_lane(l, 1);
+            }
+        }
+        regroup(0);
+        return;
+    }
+    dinst* d = &decoded[offset / 4];
+    if(d->base == OP_DECODE) {
+        decode_reached(offset / 4);
+    }
+    uint32_t next = groupPc + 4;
+    lanes r;
+
+    switch(d->base) {
+#define ALU_LANES(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: { \
+            lanes a = regs[d->rs]; \
+            lanes b = regs[d->rt]; \
+            for(int l=0; l<LOCKSTEP_LANES; l++) { \
+                r.v[l] = alu_##name(a.v[l], b.v[l]); \
+            } \
+            set_lanes(&regs[d->dest], r); \
+            break; \
+        }
+        ALU_OPS(ALU_LANES)
+#undef ALU_LANES
+
+#define SHIFT_LANES(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: { \
+            lanes b = regs[d->rt]; \
+            for(int l=0; l<LOCKSTEP_LANES; l++) { \
+                r.v[l] = shift_##name(b.v[l], d->shamt); \
+            } \
+            set_lanes(&regs[d->dest], r); \
+            break; \
+        }
+        SHIFT_OPS(SHIFT_LANES)
+#undef SHIFT_LANES
+
+#define IMM_LANES(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: { \
+            lanes a = regs[d->rs]; \
+            for(int l=0; l<LOCKSTEP_LANES; l++) { \
+                r.v[l] = imm_##name(a.v[l], d->imm); \
+            } \
+            set_lanes(&regs[d->dest], r); \
+            break; \
+        }
+        IMM_OPS(IMM_LANES)
+#undef IMM_LANES
+
+#define LOAD_LANES(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            for(int l=0; l<LOCKSTEP_LANES; l++) { \
+                byte* p = group.v[l] ? lane_addr(laneOf[l].inst, regs[d->rs].v[l] + d->imm) : NULL; \
+                if(p != NULL) { \
+                    regs[d->dest].v[l] = load_##name(p); \
+                } else if(group.v[l]) { \
+                    drop_lane(l, 1); \
+                } \
+            } \
+            break;
+        LOAD_OPS(LOAD_LANES)
+#undef LOAD_LANES
+
+#define STORE_LANES(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            for(int l=0; l<LOCKSTEP_LANES; l++) { \
+                uint32_t addr = regs[d->rs].v[l] + d->imm; \
+                byte* p = group.v[l] && addr - TEXT_ADDRESS > textSize ? lane_addr(laneOf[l].inst, addr) : NULL; \
+                if(p != NULL) { \
+                    store_##name(p, regs[d->rt].v[l]); \
+                } else if(group.v[l]) { \
+                    drop_lane(l, 1); \
+                } \
+            } \
+            break;
+        STORE_OPS(STORE_LANES)
+#undef STORE_LANES
+
+#define BRANCH_LANES(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: { \
+            lanes a = regs[d->rs]; \
+            lanes b = regs[d->rt]; \
+            uint32_t target = next + ((uint32_t) d->imm << 2); \
+            for(int l=0; l<LOCKSTEP_LANES; l++) { \
+                r.v[l] = branch_##name(a.v[l], b.v[l]) ? target : next; \
+            } \
+            branch_lanes(&r); \
+            return; \
+        }
+        BRANCH_OPS(BRANCH_LANES)
+#undef BRANCH_LANES
+
+        case OP_J:
+            next = (uint32_t) d->imm << 2;
+            break;
+        case OP_JAL:
+            r = (lanes) {{0}};
+            for(int l=0; l<LOCKSTEP_LANES; l++) {
+                r.v[l] = next;
+            }
+            set_lanes(&regs[REG_RA], r);
+            next = (uint32_t) d->imm << 2;
+            break;
+        case OP_JR:
+            branch_lanes(&regs[d->rs]);
+            return;
+        case OP_JALR: {
+            lanes target = regs[d->rs];
+            for(int l=0; l<LOCKSTEP_LANES; l++) {
+                r.v[l] = next;
+            }
+            set_lanes(&regs[d->rd ? d->rd : REG_SINK], r);
+            branch_lanes(&target);
+            return;
+        }
+        case OP_MFHI:
+            set_lanes(&regs[d->rd ? d->rd : REG_SINK], hiLanes);
+            break;
+        case OP_MTHI:
+            set_lanes(&hiLanes, regs[d->rs]);
+            break;
+        case OP_MFLO:
+            set_lanes(&regs[d->rd ? d->rd : REG_SINK], loLanes);
+            break;
+        case OP_MTLO:
+            set_lanes(&loLanes, regs[d->rs]);
+            break;
+        case OP_MULT:
+        case OP_MULTU: {
+            lanes h;
+            for(int l=0; l<LOCKSTEP_LANES; l++) {
+                uint64_t p = d->base == OP_MULT
+                             ? (uint64_t) ((int64_t) regs[d->rs].v[l] * regs[d->rt].v[l])
+                             : (uint64_t) (uint32_t) regs[d->rs].v[l] * (uint32_t) regs[d->rt].v[l];
+                h.v[l] = (reg) (p >> 32);
+                r.v[l] = (reg) p;
+            }
+            set_lanes(&hiLanes, h);
+            set_lanes(&loLanes, r);
+            break;
+        }
+        case OP_DIV:
+        case OP_DIVU:
+            // Signed division, like div_() and divu()
+            for(int l=0; l<LOCKSTEP_LANES; l++) {
+                if(!group.v[l]) {
+                    continue;
+                }
+                reg a = regs[d->rs].v[l];
+                reg b = regs[d->rt].v[l];
+                if(b == 0) {
+                    drop_lane(l, 1);
+                } else {
+                    loLanes.v[l] = a / b;
+                    hiLanes.v[l] = a % b;
+                }
+            }
+            break;
+        case OP_SYSCALL:
+            for(int l=0; l<LOCKSTEP_LANES; l++) {
+                if(!group.v[l]) {
+                    continue;
+                }
+                err_code err = lane_syscall(l);
+                if(err == EXIT) {
+                    drop_lane(l, 0);
+                } else if(err != SUCCESS) {
+                    drop_lane(l, 1);
+                }
+            }
+            break;
+        case OP_SYNC:
+            break;
+        default:
+            // break, ll, sc and invalid instructions
+            for(int l=0; l<LOCKSTEP_LANES; l++) {
+                if(group.v[l]) {
+                    drop_lane(l, 1);
+                }
+            }
+            break;
+    }
+
+    int any = 0;
+    for(int l=0; l<LOCKSTEP_LANES; l++) {
+        any |= group.v[l];
+    }
+    if(any) {
+        advance(next);
+    } else {
+        regroup(0);
+    }
+}
+
+/**
+ * Finish an evicted instance with the regular run loop.
+ * @param pristine - Text segment as loaded, restored after an instance
+ *                      that wrote to it
+ */
+static void run_alone(instance* inst, const byte* pristine) {
+    sim_machine_swap(&inst->m);
+    returnTop = 0;
+    syscall_streams(inst->in, inst->out);
+
+    err_code err;
+    do {
+        err = sim_execute(UINT64_MAX);
+    } while(err_continues(err));
+    if(err != EXIT) {
+        fprintf(stderr, "%s: ", inst->outName);
+        sim_report_error(err);
+        fprintf(stderr, "\n");
+    }
+
+    syscall_streams(NULL, NULL);
+    sim_machine_swap(&inst->m);
+    finish_instance(inst);
+    if(memcmp(text, pristine, textSize) != 0) {
+        memcpy(text, pristine, textSize);
+        decode_init();
+    }
+}
+
+int lockstep_run(const char* listName) {
+    sim_list_entry* list;
+    if(sim_read_list(listName, &list, &numInstances) != 0) {
+        return -1;
+    }
+    instances = calloc(numInstances + 1, sizeof(instance));
+    if(instances == NULL) {
+        sim_free_list(list, numInstances);
+        return -1;
+    }
+    for(size_t i=0; i<numInstances; i++) {
+        instances[i].inName = list[i].inName;
+        instances[i].outName = list[i].outName;
+    }
+
+    // Lanes get fresh zeroed segments, so the bss need not be copied
+    dataUsed = sim_data_used();
+
+    minWaiting = UINT32_MAX;
+    fill_lanes();
+    regroup(0);
+    while(numWaiting > 0 || groupPc != UINT32_MAX) {
+        step();
+        if(numBusy < LOCKSTEP_LANES && nextInstance < numInstances) {
+            fill_lanes();
+        }
+    }
+
+    byte* pristine = malloc(textSize + 1);
+    memcpy(pristine, text, textSize);
+    for(size_t i=0; i<numEvicted; i++) {
+        run_alone(evicted[i], pristine);
+    }
+    free(pristine);
+    free(evicted);
+    sim_free_list(list, numInstances);
+    free(instances);
+    return 0;
+}
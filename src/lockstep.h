@@ -0,0 +1,45 @@
+#ifndef GSIM_LOCKSTEP_H
+#define GSIM_LOCKSTEP_H
+
+#include "simulator.h"
+
+/**
+ * Lockstep execution of many instances of the loaded program
+ * (gsim --lockstep LIST), for batches that run one program on many inputs.
+ *
+ * Up to LOCKSTEP_LANES instances run together, one per lane. Their
+ * registers are stored as one array of lanes per register, and each
+ * decoded instruction is executed for all the lanes at its pc at once: the
+ * ALU, shift and immediate instructions as loops over the lanes, which the
+ * compiler turns into vector instructions, the others lane by lane. Each
+ * lane has its own data segment and stack, initialized like the program's,
+ * and its own console streams; the text segment and the decoded text are
+ * shared.
+ *
+ * Lanes follow their own pc. The lanes at the lowest pc execute while the
+ * others wait, so lanes that branch apart on beq, bne or a jump meet again
+ * at the first instruction both paths reach, and execute together from
+ * there on. A lane that finishes leaves its place to the next instance of
+ * the list.
+ *
+ * Syscalls are serviced lane by lane with the handlers of functions.c. A
+ * lane that faults, writes to the text segment or executes ll or sc leaves
+ * the lockstep group; it is finished afterwards by the regular run loop,
+ * from where it stopped, so its results and error messages are exactly
+ * those of running it alone. A lane that never finishes keeps the lanes
+ * waiting behind it from finishing too.
+ */
+
+#define LOCKSTEP_LANES 8    // Instances executed together, one 256 bit vector of registers
+
+/**
+ * Run an instance of the loaded program for each line of a list, instead
+ * of sim_run(). Lines hold the file an instance reads its input from and
+ * the file it prints to, separated by blanks. Instances that fault are
+ * reported on stderr after the name of their output file.
+ * @param listName - Path of the list
+ * @return 0 once every instance has run, -1 if the list cannot be read
+ */
+int lockstep_run(const char* listName);
+
+#endif // GSIM_LOCKSTEP_H
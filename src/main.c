@@ -1,27 +1,395 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "fileReader.h"
+#include "aflCoverage.h"
 #include "simulator.h"
+#include "cfg.h"
+#include "checkpoint.h"
+#include "daemon.h"
+#include "guestCounters.h"
+#include "hostProfile.h"
+#include "imageCache.h"
+#include "lockstep.h"
+#include "multiCore.h"
+#include "sessions.h"
+#include "sysRecord.h"
+#include "timeTravel.h"
+#include "trace.h"
+#include "watchpoints.h"
 
 
+static void usage() {
+	fprintf(stderr, "Usage: gsim [options] filename [args]\n"
+	                "Options:\n"
+	                "  --trace FILE              Write a binary execution trace to FILE\n"
+	                "  --cfg-dot FILE            Write the control-flow graph of the program to\n"
+	                "                            FILE in Graphviz DOT format\n"
+	                "  --checkpoint-at N         Save the machine state after N instructions\n"
+	                "  --checkpoint-every N      Save the machine state every N instructions\n"
+	                "  --checkpoint-prefix NAME  Name checkpoints NAME.COUNT.ckpt (default gsim)\n"
+	                "  --restore FILE            Resume from a checkpoint instead of a program\n"
+	                "  --image-cache DIR         Keep the analyzed image of the program in DIR\n"
+	                "                            and reuse it on later runs\n"
+	                "  --shared-image            Share the image of the program in memory with\n"
+	                "                            other runs of it\n"
+	                "  --image-verify            Check the whole cached image against the\n"
+	                "                            program before using it\n"
+	                "  --reverse N               Snapshot every N instructions and browse the\n"
+	                "                            execution history when the program stops\n"
+	                "  --record LOG              Log the results of every syscall to LOG\n"
+	                "  --replay LOG              Take syscall results from LOG instead of the\n"
+	                "                            terminal\n"
+	                "  --host-counters           Report host hardware counters per guest\n"
+	                "                            instruction\n"
+	                "  --host-counters-sample N  Also break them down by opcode class, sampling\n"
+	                "                            one instruction in N\n"
+	                "  --cpus N                  Simulate N CPUs on parallel host threads\n"
+	                "  --lockstep LIST           Run the program once per line \"INPUT OUTPUT\" of\n"
+	                "                            LIST, several instances at a time\n"
+	                "  --sessions LIST           Run the program once per line \"INPUT OUTPUT\" of\n"
+	                "                            LIST, all at once on one thread, waiting for\n"
+	                "                            input that is not there yet\n"
+	                "  --slice N                 Instructions a session runs per turn (default\n"
+	                "                            100000)\n"
+	                "  --client SOCKET           Run the program on the gsimd listening on SOCKET\n"
+	                "  --max-instructions N      Stop the program on gsimd after N instructions\n"
+	                "  --afl                     Count edge coverage for AFL and serve its fork\n"
+	                "                            server protocol\n"
+	                "  --watch ADDR[:LEN][:MODE] Report reads (r) or writes (w, default) of the\n"
+	                "                            LEN bytes at ADDR (default 4), may be repeated\n"
+	                "  --roi                     Only trace and count host counters between the\n"
+	                "                            program's roi_begin and roi_end, and report\n"
+	                "                            those regions\n");
+}
+
+// Options and modes that cannot always be combined
+enum {
+	OPT_CPUS,
+	OPT_LOCKSTEP,
+	OPT_SESSIONS,
+	OPT_CLIENT,
+	OPT_AFL,
+	OPT_TRACE,
+	OPT_CFG_DOT,
+	OPT_RESTORE,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_REVERSE,
+	OPT_HOST_COUNTERS,
+	OPT_CHECKPOINTS,
+	OPT_IMAGE,
+	OPT_WATCH,
+	OPT_ROI,
+	NUM_OPTS
+};
+
+#define OPT(o) (1u << (o))
+// Modes running the program other than once on one CPU
+#define MODES (OPT(OPT_CPUS) | OPT(OPT_LOCKSTEP) | OPT(OPT_SESSIONS) | OPT(OPT_CLIENT) | OPT(OPT_AFL))
+// Options following a single CPU through one deterministic run
+#define SINGLE_RUN (OPT(OPT_TRACE) | OPT(OPT_RESTORE) | OPT(OPT_RECORD) | OPT(OPT_REPLAY) \
+                    | OPT(OPT_REVERSE) | OPT(OPT_HOST_COUNTERS) | OPT(OPT_CHECKPOINTS) \
+                    | OPT(OPT_WATCH) | OPT(OPT_ROI))
+
+static const struct {
+	const char* name;
+	unsigned int conflicts;     // Options it cannot be combined with
+} options[NUM_OPTS] = {
+	[OPT_CPUS] = {"--cpus", MODES | SINGLE_RUN},
+	[OPT_LOCKSTEP] = {"--lockstep", MODES | SINGLE_RUN},
+	[OPT_SESSIONS] = {"--sessions", MODES | SINGLE_RUN},
+	// The job runs on gsimd, which knows none of the others
+	[OPT_CLIENT] = {"--client", ~0u},
+	[OPT_AFL] = {"--afl", MODES | SINGLE_RUN},
+	[OPT_TRACE] = {"--trace", 0},
+	[OPT_CFG_DOT] = {"--cfg-dot", OPT(OPT_RESTORE)},
+	[OPT_RESTORE] = {"--restore", 0},
+	[OPT_RECORD] = {"--record", 0},
+	[OPT_REPLAY] = {"--replay", 0},
+	[OPT_REVERSE] = {"--reverse", 0},
+	[OPT_HOST_COUNTERS] = {"--host-counters", 0},
+	[OPT_CHECKPOINTS] = {"checkpoints", 0},
+	[OPT_IMAGE] = {"--image-cache/--shared-image", 0},
+	// Those read, restore or map guest memory besides the program's own accesses
+	[OPT_WATCH] = {"--watch", OPT(OPT_REVERSE) | OPT(OPT_CHECKPOINTS) | OPT(OPT_IMAGE)},
+	// Regions are measured once, along a run from its start
+	[OPT_ROI] = {"--roi", OPT(OPT_REVERSE) | OPT(OPT_RESTORE)},
+};
+
+
+/**
+ * Report the first option given along with one it conflicts with.
+ * @param used - Options given
+ * @return 0 if there is none, -1 otherwise
+ */
+static int check_conflicts(unsigned int used) {
+	for(int o=0; o<NUM_OPTS; o++) {
+		unsigned int bad = used & OPT(o) ? used & options[o].conflicts & ~OPT(o) : 0;
+		if(bad == 0) {
+			continue;
+		}
+		fprintf(stderr, "%s cannot be combined with ", options[o].name);
+		for(int c=0; c<NUM_OPTS; c++) {
+			if(bad & OPT(c)) {
+				bad &= ~OPT(c);
+				// The last one after "or", the others separated by commas
+				int last = bad == 0;
+				int beforeLast = !last && (bad & (bad - 1)) == 0;
+				fprintf(stderr, "%s%s", options[c].name, last ? "\n" : beforeLast ? " or " : ", ");
+			}
+		}
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_count(const char* str, uint64_t* count) {
+	char* endptr;
+	*count = strtoull(str, &endptr, 0);
+	return *endptr != '\0' || endptr == str || *count == 0 ? -1 : 0;
+}
+
+static int write_cfg(const char* name, const byte* execFile) {
+	cfg g;
+	if(imgcache_cfg(&g, execFile) != 0 && cfg_load(&g, execFile) != 0) {
+		return -1;
+	}
+	FILE* out = fopen(name, "w");
+	if(out != NULL) {
+		cfg_write_dot(&g, out);
+		fclose(out);
+	}
+	cfg_free(&g);
+	return out == NULL ? -1 : 0;
+}
+
 int main(int argc, char* argv[]) {
-	if(argc < 2) {
-		fprintf(stderr, "Usage: gsim filename [args]\n");
+	char* traceName = NULL;
+	char* cfgName = NULL;
+	char* restoreName = NULL;
+	char* recordName = NULL;
+	char* replayName = NULL;
+	uint64_t count;
+	uint64_t snapshotInterval = 0;
+	int hostCounters = 0;
+	uint64_t sampleInterval = 0;
+	uint64_t numCpus = 1;
+	char* lockstepName = NULL;
+	char* sessionsName = NULL;
+	uint64_t slice = SESSIONS_DEFAULT_SLICE;
+	char* clientName = NULL;
+	uint64_t maxInsts = 0;
+	int afl = 0;
+	int roi = 0;
+	int image = 0;
+
+	int argi = 1;
+	while(argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+		if(strcmp(argv[argi], "--trace") == 0 && argi + 1 < argc) {
+			traceName = argv[++argi];
+		} else if(strcmp(argv[argi], "--cfg-dot") == 0 && argi + 1 < argc) {
+			cfgName = argv[++argi];
+		} else if(strcmp(argv[argi], "--checkpoint-at") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &count) == 0) {
+			checkpoint_at(count);
+			argi++;
+		} else if(strcmp(argv[argi], "--checkpoint-every") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &count) == 0) {
+			checkpoint_every(count);
+			argi++;
+		} else if(strcmp(argv[argi], "--checkpoint-prefix") == 0 && argi + 1 < argc) {
+			checkpoint_prefix(argv[++argi]);
+		} else if(strcmp(argv[argi], "--reverse") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &snapshotInterval) == 0) {
+			argi++;
+		} else if(strcmp(argv[argi], "--record") == 0 && argi + 1 < argc) {
+			recordName = argv[++argi];
+		} else if(strcmp(argv[argi], "--replay") == 0 && argi + 1 < argc) {
+			replayName = argv[++argi];
+		} else if(strcmp(argv[argi], "--host-counters") == 0) {
+			hostCounters = 1;
+		} else if(strcmp(argv[argi], "--host-counters-sample") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &sampleInterval) == 0) {
+			hostCounters = 1;
+			argi++;
+		} else if(strcmp(argv[argi], "--cpus") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &numCpus) == 0 && numCpus <= MULTICORE_MAX_CPUS) {
+			argi++;
+		} else if(strcmp(argv[argi], "--lockstep") == 0 && argi + 1 < argc) {
+			lockstepName = argv[++argi];
+		} else if(strcmp(argv[argi], "--sessions") == 0 && argi + 1 < argc) {
+			sessionsName = argv[++argi];
+		} else if(strcmp(argv[argi], "--slice") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &slice) == 0) {
+			argi++;
+		} else if(strcmp(argv[argi], "--client") == 0 && argi + 1 < argc) {
+			clientName = argv[++argi];
+		} else if(strcmp(argv[argi], "--max-instructions") == 0 && argi + 1 < argc
+		          && parse_count(argv[argi + 1], &maxInsts) == 0) {
+			argi++;
+		} else if(strcmp(argv[argi], "--afl") == 0) {
+			afl = 1;
+		} else if(strcmp(argv[argi], "--roi") == 0) {
+			roi = 1;
+		} else if(strcmp(argv[argi], "--watch") == 0 && argi + 1 < argc
+		          && watch_add(argv[argi + 1]) == 0) {
+			argi++;
+		} else if(strcmp(argv[argi], "--restore") == 0 && argi + 1 < argc) {
+			restoreName = argv[++argi];
+		} else if(strcmp(argv[argi], "--image-cache") == 0 && argi + 1 < argc) {
+			imgcache_dir(argv[++argi]);
+			image = 1;
+		} else if(strcmp(argv[argi], "--shared-image") == 0) {
+			imgcache_shared();
+			image = 1;
+		} else if(strcmp(argv[argi], "--image-verify") == 0) {
+			imgcache_verify();
+		} else {
+			usage();
+			return EXIT_FAILURE;
+		}
+		argi++;
+	}
+
+	unsigned int used = (numCpus > 1 ? OPT(OPT_CPUS) : 0)
+	                    | (lockstepName != NULL ? OPT(OPT_LOCKSTEP) : 0)
+	                    | (sessionsName != NULL ? OPT(OPT_SESSIONS) : 0)
+	                    | (clientName != NULL ? OPT(OPT_CLIENT) : 0)
+	                    | (afl ? OPT(OPT_AFL) : 0)
+	                    | (traceName != NULL ? OPT(OPT_TRACE) : 0)
+	                    | (cfgName != NULL ? OPT(OPT_CFG_DOT) : 0)
+	                    | (restoreName != NULL ? OPT(OPT_RESTORE) : 0)
+	                    | (recordName != NULL ? OPT(OPT_RECORD) : 0)
+	                    | (replayName != NULL ? OPT(OPT_REPLAY) : 0)
+	                    | (snapshotInterval ? OPT(OPT_REVERSE) : 0)
+	                    | (hostCounters ? OPT(OPT_HOST_COUNTERS) : 0)
+	                    | (checkpoint_next(0) != UINT64_MAX ? OPT(OPT_CHECKPOINTS) : 0)
+	                    | (image ? OPT(OPT_IMAGE) : 0)
+	                    | (watch_enabled() ? OPT(OPT_WATCH) : 0)
+	                    | (roi ? OPT(OPT_ROI) : 0);
+	if(check_conflicts(used) != 0) {
+		return EXIT_FAILURE;
+	}
+	if(maxInsts && clientName == NULL) {
+		fprintf(stderr, "--max-instructions needs --client\n");
+		return EXIT_FAILURE;
+	}
+	if(clientName != NULL) {
+		if(argi >= argc) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		daemon_result result;
+		return daemon_submit(clientName, argc - argi, &argv[argi], maxInsts, &result) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if(traceName != NULL && trace_open(traceName) != 0) {
+		fprintf(stderr, "Could not create trace file \"%s\"\n", traceName);
 		return EXIT_FAILURE;
 	}
 
-	byte* execFile = readFile(argv[1]);
-	if(execFile == NULL) {
-	    fprintf(stderr, "File \"%s\" does not exist!\n", argv[1]);
-	    return EXIT_FAILURE;
+	if(replayName != NULL && sysrec_load(replayName) != 0) {
+		fprintf(stderr, "\"%s\" is not a valid syscall log!\n", replayName);
+		return EXIT_FAILURE;
 	}
+	if(recordName != NULL) {
+		sysrec_start();
+	}
+
+	if(restoreName != NULL) {
+		if(checkpoint_restore(restoreName) != 0) {
+			fprintf(stderr, "\"%s\" is not a valid checkpoint!\n", restoreName);
+			return EXIT_FAILURE;
+		}
+	} else {
+		if(argi >= argc) {
+			usage();
+			return EXIT_FAILURE;
+		}
+
+		size_t fileSize;
+		byte* execFile = readFile(argv[argi], &fileSize);
+		if(execFile == NULL) {
+		    fprintf(stderr, "File \"%s\" does not exist!\n", argv[argi]);
+		    return EXIT_FAILURE;
+		}
+		if(sim_check_exec(execFile, fileSize) != 0) {
+		    fprintf(stderr, "\"%s\" is not a valid executable!\n", argv[argi]);
+		    return EXIT_FAILURE;
+		}
 
-	sim_init(execFile, argc, argv);
-	sim_run();
+		// Simulator expects argv[1] to be the program name
+		if(sim_init(execFile, argc - argi + 1, &argv[argi - 1]) != 0) {
+		    fprintf(stderr, "Could not allocate the segments of \"%s\"\n", argv[argi]);
+		    return EXIT_FAILURE;
+		}
+
+		// After sim_init(), which may have loaded the graph from the image cache
+		if(cfgName != NULL && write_cfg(cfgName, execFile) != 0) {
+		    fprintf(stderr, "Could not write control-flow graph \"%s\"\n", cfgName);
+		    return EXIT_FAILURE;
+		}
+
+		// Everything is loaded, keep only the segments resident
+		free(execFile);
+	}
+
+	if(numCpus > 1 && multicore_enable(numCpus) != 0) {
+		fprintf(stderr, "Could not start %d CPUs\n", (int) numCpus);
+		return EXIT_FAILURE;
+	}
+	if(snapshotInterval) {
+		timetravel_enable(snapshotInterval);
+	}
+	if(hostCounters && hostprof_enable(sampleInterval) != 0) {
+		fprintf(stderr, "Host performance counters unavailable\n");
+		hostCounters = 0;
+	}
+	if(watch_enabled() && watch_start() != 0) {
+		fprintf(stderr, "Could not set watchpoints: each must lie in one host page of the data\n"
+		                "segment or the stack, on an x86-64 Linux host\n");
+		sim_exit();
+		return EXIT_FAILURE;
+	}
+	if(roi) {
+		guestcounters_roi(hostCounters);
+	} else if(hostCounters) {
+		hostprof_begin();
+	}
+	if(lockstepName != NULL) {
+		if(lockstep_run(lockstepName) != 0) {
+			fprintf(stderr, "Could not read instance list \"%s\"\n", lockstepName);
+			sim_exit();
+			return EXIT_FAILURE;
+		}
+	} else if(sessionsName != NULL) {
+		if(sessions_run(sessionsName, slice) != 0) {
+			fprintf(stderr, "Could not read session list \"%s\"\n", sessionsName);
+			sim_exit();
+			return EXIT_FAILURE;
+		}
+	} else if(afl) {
+		afl_run();
+	} else {
+		sim_run();
+	}
+	if(roi) {
+		guestcounters_report();
+	} else if(hostCounters) {
+		hostprof_end();
+	}
+	if(hostCounters) {
+		hostprof_report();
+	}
 	sim_exit();
+	trace_close();
 
-	free(execFile);
+	if(recordName != NULL && sysrec_save(recordName) != 0) {
+		fprintf(stderr, "Could not write syscall log \"%s\"\n", recordName);
+		return EXIT_FAILURE;
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "multiCore.h"
+#include "decode.h"
+
+#define STACK_HIGH_ADDR 0x7fffffff
+#define DEFAULT_STACK_SIZE 8192
+#define REG_A0 4
+#define REG_GP 28
+#define REG_SP 29
+#define POLL_INTERVAL 65536     // Instructions run between checks for the end
+
+
+extern CPU_LOCAL byte* stack;
+extern CPU_LOCAL size_t stackSize;
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL reg hi;
+extern CPU_LOCAL reg lo;
+
+extern CPU_LOCAL uint64_t instCount;
+
+typedef enum cpu_state {
+    CPU_IDLE,
+    CPU_STARTING,       // Taken by cpu_start, its thread has not seen it yet
+    CPU_RUNNING,
+    CPU_STOPPED         // Waiting for cpu_join
+} cpu_state;
+
+typedef struct cpu {
+    pthread_t thread;
+    int id;
+    cpu_state state;
+    reg entry;          // Arguments of cpu_start
+    reg arg;
+    reg gp;
+    reg result;         // Code of exit2, or -1 after a fault
+} cpu;
+
+static cpu cpus[MULTICORE_MAX_CPUS];
+static int numCpus = 1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;   // Some CPU changed state
+static int ending;      // Set once the program ends, read without the lock
+static CPU_LOCAL int cpuId;
+
+
+static int is_ending() {
+    return __atomic_load_n(&ending, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Reset the state of the calling CPU for a cpu_start.
+ */
+static void start_cpu(const cpu* c) {
+    memset(registers, 0, (NUM_REGISTERS + 1) * sizeof(reg));
+    memset(stack, 0, stackSize);
+    registers[REG_A0] = c->arg;
+    registers[REG_GP] = c->gp;
+    registers[REG_SP] = STACK_HIGH_ADDR - 15;
+    pc = c->entry;
+    hi = 0;
+    lo = 0;
+    instCount = 0;
+    returnTop = 0;
+}
+
+/**
+ * Host thread of CPUs 1 to n - 1: run each cpu_start until the CPU stops,
+ * until the program ends.
+ */
+static void* run_cpu(void* arg) {
+    cpu* c = arg;
+    cpuId = c->id;
+    stackSize = DEFAULT_STACK_SIZE;
+    stack = sim_alloc_segment(stackSize);
+
+    pthread_mutex_lock(&lock);
+    while(!ending) {
+        if(c->state != CPU_STARTING) {
+            pthread_cond_wait(&changed, &lock);
+            continue;
+        }
+        c->state = CPU_RUNNING;
+        start_cpu(c);
+        pthread_mutex_unlock(&lock);
+
+        err_code err;
+        do {
+            err = sim_execute(instCount + POLL_INTERVAL);
+        } while(err_continues(err) && !is_ending());
+
+        pthread_mutex_lock(&lock);
+        if(err == EXIT) {
+            c->result = registers[2] == 17 ? registers[REG_A0] : 0;
+        } else if(!err_continues(err)) {
+            fprintf(stderr, "CPU %d: ", c->id);
+            sim_report_error(err);
+            fprintf(stderr, "\n");
+            c->result = -1;
+            __atomic_store_n(&ending, 1, __ATOMIC_RELEASE);
+        }
+        c->state = CPU_STOPPED;
+        pthread_cond_broadcast(&changed);
+    }
+    pthread_mutex_unlock(&lock);
+
+    sim_free_segment(stack, stackSize);
+    return NULL;
+}
+
+int multicore_enable(int n) {
+    // Slots decoded lazily would be written by several threads
+    decode_all();
+    for(int i=1; i<n; i++) {
+        cpus[i].id = i;
+        cpus[i].state = CPU_IDLE;
+        if(pthread_create(&cpus[i].thread, NULL, run_cpu, &cpus[i]) != 0) {
+            multicore_stop();
+            return -1;
+        }
+        numCpus = i + 1;
+    }
+    return 0;
+}
+
+uint64_t multicore_next(uint64_t count) {
+    return numCpus > 1 ? count + POLL_INTERVAL : UINT64_MAX;
+}
+
+err_code multicore_poll() {
+    return is_ending() ? EXIT : SUCCESS;
+}
+
+/**
+ * Take an idle CPU and have its thread start it.
+ * @return Number of the CPU, -1 if none is idle
+ */
+static reg cpu_start(reg entry, reg arg) {
+    for(int i=1; i<numCpus; i++) {
+        if(cpus[i].state == CPU_IDLE) {
+            cpus[i].entry = entry;
+            cpus[i].arg = arg;
+            cpus[i].gp = registers[REG_GP];
+            cpus[i].state = CPU_STARTING;
+            pthread_cond_broadcast(&changed);
+            return i;
+        }
+    }
+    return -1;
+}
+
+err_code multicore_syscall(uint32_t code) {
+    err_code err = SUCCESS;
+    pthread_mutex_lock(&lock);
+    if(code == 110) {
+        registers[2] = cpuId;
+        registers[3] = numCpus;
+    } else if(code == 111) {
+        registers[2] = cpu_start(registers[REG_A0], registers[REG_A0 + 1]);
+    } else {
+        uint32_t id = registers[REG_A0];
+        cpu* c = id >= 1 && id < (uint32_t) numCpus && id != (uint32_t) cpuId ? &cpus[id] : NULL;
+        while(c != NULL && c->state != CPU_IDLE && c->state != CPU_STOPPED && !ending) {
+            pthread_cond_wait(&changed, &lock);
+        }
+        if(c != NULL && c->state == CPU_STOPPED) {
+            registers[2] = c->result;
+            c->state = CPU_IDLE;
+        } else if(c != NULL && c->state != CPU_IDLE) {
+            // Interrupted by the end of the program
+            err = EXIT;
+        } else {
+            registers[2] = -1;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+void multicore_stop() {
+    if(numCpus == 1) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    __atomic_store_n(&ending, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    for(int i=1; i<numCpus; i++) {
+        pthread_join(cpus[i].thread, NULL);
+    }
+    numCpus = 1;
+}
@@ -0,0 +1,64 @@
+#ifndef GSIM_MULTICORE_H
+#define GSIM_MULTICORE_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+
+/**
+ * Multi-processor simulation (gsim --cpus N).
+ *
+ * The machine gets N CPUs sharing the text and data segments and the
+ * decoded text. Each CPU has its own registers, pc, instruction count,
+ * ll link and stack (see CPU_LOCAL); the stacks all span the same
+ * addresses, so a CPU cannot see the stack of another one. CPU 0 runs the
+ * program on the main thread as usual. The others run on host threads of
+ * their own and idle until the program starts them with the cpu_start
+ * syscall (see syscall_() in functions.h). Running CPUs never take a lock,
+ * so the simulation speed grows with the host cores.
+ *
+ * Like the host, the CPUs see each other's memory accesses in no
+ * particular order. sync is a full barrier. sc is a compare-and-swap of
+ * the word with the value ll loaded from it: it succeeds when the word
+ * holds that value, even if another CPU wrote it in between.
+ *
+ * exit and exit2 stop the calling CPU; on CPU 0 they end the program, and
+ * the other CPUs with it. A fault on any CPU is reported with its number
+ * and ends the program. The whole text segment is decoded before the other
+ * CPUs start, and writing to it while they run is not supported.
+ */
+
+#define MULTICORE_MAX_CPUS 64
+
+/**
+ * Create the host threads of CPUs 1 to n - 1, once the program is loaded.
+ * @param n - Number of CPUs, 2 to MULTICORE_MAX_CPUS
+ * @return 0 on success, -1 if the threads could not be created
+ */
+int multicore_enable(int n);
+
+/**
+ * @return Instruction count of CPU 0 at which it must call
+ *          multicore_poll(), UINT64_MAX with a single CPU
+ */
+uint64_t multicore_next(uint64_t count);
+
+/**
+ * Check whether another CPU ended the program.
+ * @return EXIT if it did, SUCCESS otherwise
+ */
+err_code multicore_poll();
+
+/**
+ * Run the cpu_id, cpu_start or cpu_join syscall for the calling CPU.
+ * @param code - Syscall code, 110 to 112
+ * @return SUCCESS, or EXIT if the program ended while cpu_join waited
+ */
+err_code multicore_syscall(uint32_t code);
+
+/**
+ * Stop the other CPUs and wait for their threads, once CPU 0 has stopped.
+ */
+void multicore_stop();
+
+#endif // GSIM_MULTICORE_H
@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sessions.h"
+
+#define INPUT_CHUNK 4096
+#define MAX_EVENTS 64
+
+
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL uint64_t instCount;
+
+typedef struct guest {
+    char* outName;
+    int fd;             // Input
+    FILE* in;           // Reads buf, for the syscall handlers
+    FILE* out;
+    char* buf;          // Input read from fd and not consumed yet
+    size_t start;
+    size_t end;
+    size_t cap;
+    int eof;
+    int fifo;           // Input is a pipe, which may have no writer yet
+    int hup;            // Its writers have come and gone
+    int watched;        // Whether fd was added to the epoll set
+    size_t need;        // Bytes of input the waiting syscall asked for
+    sim_machine m;
+
+    struct guest* next; // In the run queue
+} guest;
+
+static guest* guests;
+static size_t numGuests;
+static guest* runHead;
+static guest* runTail;
+static guest* current;  // Guest whose state is in the machine
+static int epfd;
+
+
+/**
+ * @return Nonzero if a read of up to need bytes of input would not block
+ */
+static int has_input(const guest* g, size_t need) {
+    size_t avail = g->end - g->start;
+    return g->eof || avail >= need || (avail > 0 && memchr(&g->buf[g->start], '\n', avail) != NULL);
+}
+
+/**
+ * Read what input is available without blocking, until there is enough for
+ * a read of need bytes.
+ */
+static void fill(guest* g, size_t need) {
+    while(!has_input(g, need)) {
+        if(g->end == g->cap) {
+            if(g->start > 0) {
+                memmove(g->buf, &g->buf[g->start], g->end - g->start);
+                g->end -= g->start;
+                g->start = 0;
+            } else {
+                char* grown = realloc(g->buf, g->cap + INPUT_CHUNK);
+                if(grown == NULL) {
+                    g->eof = 1;
+                    break;
+                }
+                g->buf = grown;
+                g->cap += INPUT_CHUNK;
+            }
+        }
+        ssize_t n = read(g->fd, &g->buf[g->end], g->cap - g->end);
+        if(n > 0) {
+            g->end += n;
+        } else if(n == 0 && g->fifo && !g->hup) {
+            // No writer has opened the FIFO yet
+            break;
+        } else if(n == 0 || (errno != EINTR && errno != EAGAIN)) {
+            g->eof = 1;
+        } else if(errno == EAGAIN) {
+            break;
+        }
+    }
+}
+
+/**
+ * Read function of a guest's input stream, handing out its buffered input.
+ */
+static ssize_t read_buffered(void* cookie, char* dest, size_t size) {
+    guest* g = cookie;
+    size_t n = g->end - g->start < size ? g->end - g->start : size;
+    memcpy(dest, &g->buf[g->start], n);
+    g->start += n;
+    return n;
+}
+
+/**
+ * Input check of the console syscalls for the guest running.
+ */
+static int input_ready(size_t len) {
+    current->need = len;
+    fill(current, len);
+    return has_input(current, len);
+}
+
+static void enqueue(guest* g) {
+    g->next = NULL;
+    if(runTail != NULL) {
+        runTail->next = g;
+    } else {
+        runHead = g;
+    }
+    runTail = g;
+}
+
+/**
+ * Wait for more input of a guest.
+ * @return 0 on success, -1 if its input cannot be watched
+ */
+static int watch(guest* g) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = g;
+    int ret = epoll_ctl(epfd, g->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, g->fd, &ev);
+    g->watched = ret == 0;
+    return ret;
+}
+
+/**
+ * Open the input and output of a guest and set up its machine.
+ * @return 0 on success, -1 on failure
+ */
+static int start_guest(guest* g, const char* inName, size_t dataUsed) {
+    cookie_io_functions_t io = {read_buffered, NULL, NULL, NULL};
+    struct stat st;
+    g->fd = open(inName, O_RDONLY | O_NONBLOCK);
+    g->fifo = g->fd >= 0 && fstat(g->fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    g->in = g->fd >= 0 ? fopencookie(g, "r", io) : NULL;
+    g->out = fopen(g->outName, "w");
+    if(g->in == NULL || g->out == NULL || sim_machine_init(&g->m, dataUsed) != 0) {
+        if(g->in != NULL) {
+            fclose(g->in);
+        }
+        if(g->fd >= 0) {
+            close(g->fd);
+        }
+        if(g->out != NULL) {
+            fclose(g->out);
+        }
+        return -1;
+    }
+    // Unbuffered, so the stream never takes more than the syscall reads
+    setvbuf(g->in, NULL, _IONBF, 0);
+    return 0;
+}
+
+static void stop_guest(guest* g) {
+    fclose(g->in);
+    close(g->fd);
+    fclose(g->out);
+    free(g->buf);
+    sim_machine_free(&g->m);
+}
+
+/**
+ * Run a guest for a slice, then queue it again, wait for its input or stop
+ * it.
+ * @return 1 if the guest stopped, 0 otherwise
+ */
+static int run_slice(guest* g, uint64_t slice) {
+    current = g;
+    sim_machine_swap(&g->m);
+    syscall_streams(g->in, g->out);
+    err_code err = sim_execute(instCount + slice);
+    syscall_streams(NULL, NULL);
+    if(err == WOULD_BLOCK) {
+        // Execute the syscall again once the input is there
+        pc -= 4;
+        instCount--;
+    } else if(!err_continues(err) && err != EXIT) {
+        fprintf(stderr, "%s: ", g->outName);
+        sim_report_error(err);
+        fprintf(stderr, "\n");
+    }
+    sim_machine_swap(&g->m);
+    current = NULL;
+
+    if(err_continues(err)) {
+        enqueue(g);
+        return 0;
+    }
+    fflush(g->out);
+    if(err != WOULD_BLOCK) {
+        stop_guest(g);
+        return 1;
+    }
+    if(watch(g) != 0) {
+        // Cannot wait for it, take the input as ended
+        g->eof = 1;
+        enqueue(g);
+    }
+    return 0;
+}
+
+/**
+ * Let the guests run one after the other until they all stop.
+ */
+static void schedule(size_t live, uint64_t slice) {
+    struct epoll_event events[MAX_EVENTS];
+    while(live > 0) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, runHead != NULL ? 0 : -1);
+        for(int i=0; i<n; i++) {
+            guest* g = events[i].data.ptr;
+            g->hup |= (events[i].events & EPOLLHUP) != 0;
+            fill(g, g->need);
+            if(has_input(g, g->need)) {
+                enqueue(g);
+            } else {
+                watch(g);
+            }
+        }
+        if(runHead == NULL) {
+            continue;
+        }
+        guest* g = runHead;
+        runHead = g->next;
+        if(runHead == NULL) {
+            runTail = NULL;
+        }
+        live -= run_slice(g, slice);
+    }
+}
+
+int sessions_run(const char* listName, uint64_t slice) {
+    sim_list_entry* list;
+    if(sim_read_list(listName, &list, &numGuests) != 0) {
+        return -1;
+    }
+    guests = calloc(numGuests + 1, sizeof(guest));
+    if(guests == NULL) {
+        sim_free_list(list, numGuests);
+        return -1;
+    }
+
+    // Two descriptors per session
+    struct rlimit files;
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    // Guests get fresh zeroed segments, so the bss need not be copied
+    size_t dataUsed = sim_data_used();
+
+    epfd = epoll_create1(0);
+    size_t live = 0;
+    for(size_t i=0; i<numGuests; i++) {
+        guests[i].outName = list[i].outName;
+        if(start_guest(&guests[i], list[i].inName, dataUsed) == 0) {
+            enqueue(&guests[i]);
+            live++;
+        } else {
+            fprintf(stderr, "%s: could not open \"%s\" or \"%s\"\n", guests[i].outName, list[i].inName, guests[i].outName);
+        }
+    }
+
+    syscall_input_check(input_ready);
+    schedule(live, slice);
+    syscall_input_check(NULL);
+
+    close(epfd);
+    sim_free_list(list, numGuests);
+    free(guests);
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef GSIM_SESSIONS_H
+#define GSIM_SESSIONS_H
+
+#include <stdint.h>
+
+#include "simulator.h"
+
+/**
+ * Many concurrent sessions of the loaded program on one host thread
+ * (gsim --sessions LIST), for interactive programs that spend most of their
+ * time waiting for input.
+ *
+ * Each session is a guest machine of its own: registers, pc, instruction
+ * count, data segment and stack, initialized like the program's, with its
+ * own input and output. The text segment and the decoded text are shared,
+ * and writing to them is not supported in this mode.
+ *
+ * Runnable guests take turns, each running a slice of instructions. A guest
+ * whose read_int or read_string finds no whole line in its input yields
+ * instead of blocking the thread; inputs that are pipes or FIFOs are then
+ * watched with epoll, and the guest runs again, from that syscall, once its
+ * line or the end of its input arrives. Inputs are read into a buffer of
+ * the guest, so a guest never waits for input another one has already
+ * sent. Regular files never make a guest wait. Output is written as usual,
+ * and flushed whenever the guest waits or stops.
+ */
+
+#define SESSIONS_DEFAULT_SLICE 100000  // Instructions a guest runs before the next one gets its turn
+
+/**
+ * Run a session of the loaded program for each line of a list, instead of
+ * sim_run(). Lines hold the file or FIFO a session reads its input from
+ * and the file it prints to, separated by blanks. Sessions that fault are
+ * reported on stderr after the name of their output file.
+ * @param listName - Path of the list
+ * @param slice - Instructions a guest runs per turn
+ * @return 0 once every session has stopped, -1 if the list cannot be read
+ */
+int sessions_run(const char* listName, uint64_t slice);
+
+#endif // GSIM_SESSIONS_H
@@ -1,32 +1,54 @@
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "simulator.h"
+#include "aflCoverage.h"
+#include "checkpoint.h"
+#include "decode.h"
+#include "guestCounters.h"
+#include "hostProfile.h"
+#include "imageCache.h"
+#include "multiCore.h"
+#include "sysRecord.h"
+#include "timeTravel.h"
+#include "trace.h"
+#include "watchpoints.h"
 
 #define PC_INIT_LOC 0x8
 #define TEXT_SIZE_LOC 0xc
+#define RDATA_SIZE_LOC 0x10
 #define DATA_SIZE_LOC 0x14
+#define SDATA_SIZE_LOC 0x18
+#define SBSS_SIZE_LOC 0x1c
+#define BSS_SIZE_LOC 0x20
 #define TEXT_START_LOC 0x34
 #define STACK_HIGH_ADDR 0x7fffffff
 #define DEFAULT_STACK_SIZE 8192
 #define TEXT_ADDRESS 0x400000
 #define DATA_ADDRESS 0x10000000
+#define REG_RA 31
  
 byte* text;
 byte* data;
-byte* stack;
+CPU_LOCAL byte* stack;
 
 size_t textSize;
 size_t dataSize;
-size_t stackSize;
+CPU_LOCAL size_t stackSize;
+
+CPU_LOCAL reg registers[NUM_REGISTERS + 1];
+CPU_LOCAL reg pc;
+CPU_LOCAL reg hi;
+CPU_LOCAL reg lo;
 
-reg registers[NUM_REGISTERS];
-reg pc;
-reg hi; 
-reg lo;
+CPU_LOCAL uint64_t instCount;
 
 
-static unsigned int bintoint(byte* src) {
+static unsigned int bintoint(const byte* src) {
 	return (src[0] << 24) + (src[1] << 16) +
 			(src[2] << 8) + src[3];
 }
@@ -39,23 +61,75 @@ static void inttobin(byte* dest, unsigned int i) {
 }
 
 
-void sim_init(byte* execFile, int argc, char* argv[]) {
+byte* sim_alloc_segment(size_t size) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t mapSize = size ? ((size - 1) | (pageSize - 1)) + 1 : pageSize;
+    void* seg = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return seg == MAP_FAILED ? NULL : seg;
+}
+
+void sim_free_segment(byte* seg, size_t size) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    if(seg != NULL) {
+        munmap(seg, size ? ((size - 1) | (pageSize - 1)) + 1 : pageSize);
+    }
+}
+
+size_t sim_data_size(const byte* execFile, size_t* loaded) {
+    *loaded = (size_t) bintoint(&execFile[RDATA_SIZE_LOC]) + bintoint(&execFile[DATA_SIZE_LOC])
+              + bintoint(&execFile[SDATA_SIZE_LOC]);
+    return *loaded + bintoint(&execFile[SBSS_SIZE_LOC]) + bintoint(&execFile[BSS_SIZE_LOC]);
+}
+
+int sim_check_exec(const byte* execFile, size_t fileSize) {
+    if(fileSize < TEXT_START_LOC) {
+        return -1;
+    }
+    size_t textLen = bintoint(&execFile[TEXT_SIZE_LOC]);
+    size_t loaded;
+    size_t dataLen = sim_data_size(execFile, &loaded);
+    // Each section size is 32 bits, so none of the sums overflow
+    return textLen % 4 != 0 || textLen > DATA_ADDRESS - TEXT_ADDRESS
+           || dataLen > STACK_HIGH_ADDR - DATA_ADDRESS
+           || TEXT_START_LOC + textLen + loaded > fileSize ? -1 : 0;
+}
+
+int sim_init(byte* execFile, int argc, char* argv[]) {
 	// Get location size of text segment (amount of instructions)
     textSize = bintoint(&execFile[TEXT_SIZE_LOC]);
-	text = malloc(textSize);
-	// Copy text region of file into text array of instuctions
-	memcpy(text, &execFile[TEXT_START_LOC], textSize);
-	
 	// Get location size of data segment (number of bytes)
 	unsigned int dataLoc = TEXT_START_LOC + textSize;
-    dataSize = bintoint(&execFile[DATA_SIZE_LOC]);
-	data = malloc(dataSize);
-	// Copy data region of file into data array
-	memcpy(data, &execFile[dataLoc], dataSize);
+	size_t dataLoaded;
+    dataSize = sim_data_size(execFile, &dataLoaded);
+
+	// The image cache maps both segments and the decoded text when it can
+	if(imgcache_load(execFile) != 0) {
+		text = sim_alloc_segment(textSize);
+		// The zero-filled sections of the data segment only get pages
+		// once touched
+		data = sim_alloc_segment(dataSize);
+		if(text == NULL || data == NULL) {
+			sim_free_segment(text, textSize);
+			sim_free_segment(data, dataSize);
+			text = NULL;
+			data = NULL;
+			return -1;
+		}
+		// Copy text region of file into text array of instuctions
+		memcpy(text, &execFile[TEXT_START_LOC], textSize);
+		// Copy data region of file into data array
+		memcpy(data, &execFile[dataLoc], dataLoaded);
+		decode_init();
+		imgcache_store(execFile);
+	}
 
 	// Create stack segment
 	stackSize = DEFAULT_STACK_SIZE;
-    stack = calloc(stackSize, sizeof(byte));
+    stack = sim_alloc_segment(stackSize);
+    if(stack == NULL) {
+        sim_exit();
+        return -1;
+    }
 	// Set top of stack to be the command line arguments
 	unsigned char* sp = stack;
     for(int i=argc-1; i>=1; i--) {
@@ -85,238 +159,959 @@ void sim_init(byte* execFile, int argc, char* argv[]) {
     }
 	registers[29] = STACK_HIGH_ADDR - (sp - stack);
 	hi = 0;
-	lo = 0;  	
+	lo = 0;
+	instCount = 0;
+	return 0;
+}
+
+int sim_read_list(const char* listName, sim_list_entry** entries, size_t* count) {
+    FILE* list = fopen(listName, "r");
+    *entries = NULL;
+    *count = 0;
+    if(list == NULL) {
+        return -1;
+    }
+    char inName[4096];
+    char outName[4096];
+    int fields;
+    while((fields = fscanf(list, "%4095s %4095s", inName, outName)) == 2) {
+        sim_list_entry* grown = realloc(*entries, (*count + 1) * sizeof(sim_list_entry));
+        if(grown == NULL) {
+            break;
+        }
+        *entries = grown;
+        (*entries)[*count].inName = strdup(inName);
+        (*entries)[*count].outName = strdup(outName);
+        (*count)++;
+    }
+    fclose(list);
+    if(fields != EOF) {
+        sim_free_list(*entries, *count);
+        return -1;
+    }
+    return 0;
+}
+
+void sim_free_list(sim_list_entry* entries, size_t count) {
+    for(size_t i=0; i<count; i++) {
+        free(entries[i].inName);
+        free(entries[i].outName);
+    }
+    free(entries);
+}
+
+size_t sim_data_used() {
+    size_t len = dataSize;
+    while(len > 0 && data[len - 1] == 0) {
+        len--;
+    }
+    return len;
+}
+
+int sim_machine_init(sim_machine* m, size_t dataUsed) {
+    m->data = sim_alloc_segment(dataSize);
+    m->stack = sim_alloc_segment(stackSize);
+    if(m->data == NULL || m->stack == NULL) {
+        sim_machine_free(m);
+        return -1;
+    }
+    memcpy(m->data, data, dataUsed);
+    memcpy(m->stack, stack, stackSize);
+    memcpy(m->regs, registers, sizeof(m->regs));
+    m->hi = hi;
+    m->lo = lo;
+    m->pc = pc;
+    m->instCount = 0;
+    return 0;
+}
+
+void sim_machine_free(sim_machine* m) {
+    sim_free_segment(m->data, dataSize);
+    sim_free_segment(m->stack, stackSize);
+    m->data = NULL;
+    m->stack = NULL;
+}
+
+void sim_machine_swap(sim_machine* m) {
+    for(int r=0; r<NUM_REGISTERS; r++) {
+        reg tmp = registers[r];
+        registers[r] = m->regs[r];
+        m->regs[r] = tmp;
+    }
+    reg tmp = hi;
+    hi = m->hi;
+    m->hi = tmp;
+    tmp = lo;
+    lo = m->lo;
+    m->lo = tmp;
+    tmp = pc;
+    pc = m->pc;
+    m->pc = tmp;
+    uint64_t count = instCount;
+    instCount = m->instCount;
+    m->instCount = count;
+    byte* seg = data;
+    data = m->data;
+    m->data = seg;
+    seg = stack;
+    stack = m->stack;
+    m->stack = seg;
+}
+
+/**
+ * Execute an unpacked instruction with the generic handlers of functions.c.
+ */
+static err_code exec_generic(const dinst* d) {
+    switch(d->base) {
+#define ALU_CASE(OP, name, ...) case OP_##OP: return name(d->rs, d->rt, d->rd);
+#define SHIFT_CASE(OP, name, ...) case OP_##OP: return name(d->rt, d->rd, d->shamt);
+#define IMM_CASE(OP, name, ...) case OP_##OP: return name(d->rs, d->rt, d->imm);
+#define SPECIAL_CASE(OP, name, opcode, funct, args, fault, sem) case OP_##OP: return sem;
+        ALU_OPS(ALU_CASE)
+        SHIFT_OPS(SHIFT_CASE)
+        IMM_OPS(IMM_CASE)
+        LOAD_OPS(IMM_CASE)
+        STORE_OPS(IMM_CASE)
+        BRANCH_OPS(IMM_CASE)
+        SPECIAL_OPS(SPECIAL_CASE)
+#undef ALU_CASE
+#undef SHIFT_CASE
+#undef IMM_CASE
+#undef SPECIAL_CASE
+        default:
+            return FUNC_NOT_IMPLEMENTED;
+    }
 }
 
 err_code exec_func(inst current_inst) {
-    uint8_t opcode = current_inst >> 26 & 0x3F;
-    uint8_t rs = current_inst >> 21 & 0x1F;
-    uint8_t rt = current_inst >> 16 & 0x1F;
-    err_code err = SUCCESS;
+    dinst d;
     if(pc % 4 != 0) {
         return UNALIGNED_INST;
     }
+    decode_word(current_inst, &d);
+    return exec_generic(&d);
+}
 
-    if (opcode == 0) {
-        // R type instructions
-        uint8_t rd = current_inst >> 11 & 0x1F;
-        uint8_t shamt = current_inst >> 6 & 0x1F;
-        uint8_t function = current_inst & 0x3F;
-        switch (function) {
-            case 0:
-                err = sll(rt, rd, shamt);
-                break;
-            case 2:
-                err = srl(rt, rd, shamt);
-                break;
-            case 3:
-                err = sra(rt, rd, shamt);
-                break;
-            case 4:
-                err = sllv(rs, rt, rd);
-                break;
-            case 6:
-                err = srlv(rs, rt, rd);
-                break;
-            case 7:
-                err = srav(rs, rt, rd);
-                break;
-            case 8:
-                err = jr(rs);
-                break;
-            case 9:
-                err = jalr(rs, rd);
-                break;
-                // 10 movz?
-                // 11 movn?
-            case 12:
-                err = syscall();
-                break;
-            case 13:
-                err = BREAK;
-                break;
-                // 15 sync?
-            case 16:
-                err = mfhi(rd);
-                break;
-            case 17:
-                err = mthi(rs);
-                break;
-            case 18:
-                err = mflo(rd);
-                break;
-            case 19:
-                err = mtlo(rs);
-                break;
-            case 24:
-                err = mult(rs, rt);
-                break;
+/**
+ * Count a table operation in the guest's loads, stores and stall cycles.
+ */
+static inline void count_op(uint8_t op) {
+    switch(op) {
+#define COUNT_CASE(OP, ...) case OP_##OP:
+        LOAD_OPS(COUNT_CASE)
+        case OP_LL:
+            guestLoads++;
+            break;
+        STORE_OPS(COUNT_CASE)
+        case OP_SC:
+            guestStores++;
+            break;
+#undef COUNT_CASE
+        case OP_MULT:
+        case OP_MULTU:
+            guestStalls += GUESTCOUNTERS_MULT_CYCLES - 1;
+            break;
+        case OP_DIV:
+        case OP_DIVU:
+            guestStalls += GUESTCOUNTERS_DIV_CYCLES - 1;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Count an instruction word executed outside of the run loop.
+ */
+static void count_word(inst word) {
+    dinst d;
+    decode_word(word, &d);
+    count_op(d.base);
+}
+
+/**
+ * Register written by an instruction, as numbered in the trace format.
+ * @return Register number, TRACE_REG_LO for instructions writing both
+ *          $hi and $lo, or -1 if no register is written
+ */
+static int trace_dest(inst current_inst) {
+    uint8_t opcode = current_inst >> 26 & 0x3F;
+    if(opcode == 0) {
+        switch (current_inst & 0x3F) {
+            case 8:     // jr
+            case 12:    // syscall
+            case 13:    // break
+            case 15:    // sync
+                return -1;
+            case 17:    // mthi
+                return TRACE_REG_HI;
+            case 19:    // mtlo
+                return TRACE_REG_LO;
+            case 24:    // mult, multu, div, divu
             case 25:
-                err = multu(rs, rt);
-                break;
             case 26:
-                err = div_(rs, rt);
-                break;
             case 27:
-                err = divu(rs, rt);
-                break;
-            case 32:
-                add(rs, rt, rd);
-                break;
-            case 33:
-                err = addu(rs, rt, rd);
-                break;
-            case 34:
-                err = sub(rs, rt, rd);
-                break;
-            case 35:
-                err = subu(rs, rt, rd);
-                break;
-            case 36:
-                err = and(rs, rt, rd);
-                break;
-            case 37:
-                err = or(rs, rt, rd);
-                break;
-            case 38:
-                err = xor(rs, rt, rd);
-                break;
-            case 39:
-                err = nor(rs, rt, rd);
-                break;
-            case 42:
-                err = slt(rs, rt, rd);
+                return TRACE_REG_LO;
+            default:
+                return current_inst >> 11 & 0x1F;
+        }
+    } else if(opcode == 3) {
+        return 31;
+    } else if(opcode == 2 || opcode == 4 || opcode == 5 || (opcode >= 40 && opcode != 56)) {
+        return -1;
+    } else {
+        return current_inst >> 16 & 0x1F;
+    }
+}
+
+/**
+ * Execute one instruction, pushing its pc, register writes and memory
+ * accesses to the trace ring buffer.
+ */
+static err_code exec_traced(inst current_inst) {
+    uint8_t opcode = current_inst >> 26 & 0x3F;
+    int dest = trace_dest(current_inst);
+    reg v0 = registers[2];
+    reg v1 = registers[3];
+    uint32_t addr = registers[current_inst >> 21 & 0x1F] + (reg) (int16_t) (current_inst & 0xFFFF);
+
+    trace_pc(pc);
+    err_code err = exec_func(current_inst);
+    if(err == NONEXISTANT_MEMORY || err == UNALIGNED_INST || err == FUNC_NOT_IMPLEMENTED) {
+        return err;
+    }
+
+    if(opcode >= 32 && opcode <= 43) {
+        // Access size is encoded in the low two opcode bits: 0 byte, 1 half, 3 word
+        trace_mem(addr, (opcode & 3) == 3 ? 2 : opcode & 1, opcode >= 40);
+    } else if(opcode == 48 || opcode == 56) {
+        // ll and sc, traced as a word access even when sc fails
+        trace_mem(addr, 2, opcode == 56);
+    }
+    if(dest == TRACE_REG_LO) {
+        trace_reg(TRACE_REG_HI, hi);
+        trace_reg(TRACE_REG_LO, lo);
+    } else if(dest >= 0) {
+        trace_reg(dest, dest == TRACE_REG_HI ? hi : registers[dest]);
+    } else if(opcode == 0 && (current_inst & 0x3F) == 12) {
+        if(registers[2] != v0) {
+            trace_reg(2, registers[2]);
+        }
+        if(registers[3] != v1) {
+            trace_reg(3, registers[3]);
+        }
+    }
+    return err;
+}
+
+/**
+ * @return Slot of the instruction at addr, or the sentinel slot if addr is
+ *          not an instruction of the text segment
+ */
+static inline dinst* slot_at(uint32_t addr) {
+    uint32_t offset = addr - TEXT_ADDRESS;
+    return offset % 4 == 0 && offset / 4 < numSlots ? &decoded[offset / 4] : &decoded[numSlots];
+}
+
+/**
+ * @return Slot a taken branch in slot d goes to
+ */
+static inline dinst* branch_slot(const dinst* d) {
+    size_t slot = (size_t) (d - decoded) + 1 + d->imm;
+    return slot < numSlots ? &decoded[slot] : &decoded[numSlots];
+}
+
+/**
+ * Push the slot following a call on the return-address stack.
+ */
+static inline void push_return(const dinst* d) {
+    returnSlots[++returnTop % RETURN_STACK_SIZE] = d + 1 - decoded;
+}
+
+/**
+ * Pop the predicted return slot, falling back to translating target when
+ * the prediction is wrong.
+ * @param target - Address actually returned to
+ */
+static inline dinst* pop_return(uint32_t target) {
+    uint32_t slot = returnSlots[returnTop-- % RETURN_STACK_SIZE];
+    return target == TEXT_ADDRESS + 4 * slot ? &decoded[slot] : slot_at(target);
+}
+
+/**
+ * Smallest n >= 1 such that n * c = t modulo 2^32.
+ * @return n, or UINT64_MAX if there is none
+ */
+static uint64_t solve_iterations(uint32_t c, uint32_t t) {
+    if(c == 0) {
+        return t == 0 ? 1 : UINT64_MAX;
+    }
+    int shift = __builtin_ctz(c);
+    if(t & ((1u << shift) - 1)) {
+        return UINT64_MAX;
+    }
+    // c >> shift is odd, so it has an inverse modulo 2^32 (Newton's method)
+    uint32_t odd = c >> shift;
+    uint32_t inv = odd;
+    for(int i=0; i<5; i++) {
+        inv *= 2 - odd * inv;
+    }
+    uint64_t period = (uint64_t) 1 << (32 - shift);
+    uint64_t n = (uint64_t) ((t >> shift) * inv) & (period - 1);
+    return n == 0 ? period : n;
+}
+
+/**
+ * @return Number of iterations a counted loop runs before its bne falls
+ *          through, from the current registers, UINT64_MAX if it never does
+ */
+static uint64_t count_iterations(const spin_loop* loop) {
+    // bne a, b loops while a - b, which moves by the same amount every
+    // iteration, is not zero
+    uint32_t step = 0;
+    for(int c=0; c<loop->numCounters; c++) {
+        step += loop->reg[c] == loop->rs ? (uint32_t) loop->inc[c] : 0;
+        step -= loop->reg[c] == loop->rt ? (uint32_t) loop->inc[c] : 0;
+    }
+    return solve_iterations(step, (uint32_t) registers[loop->rt] - (uint32_t) registers[loop->rs]);
+}
+
+/**
+ * Apply n iterations of a loop to its counters.
+ */
+static void add_counters(const spin_loop* loop, uint64_t n) {
+    for(int c=0; c<loop->numCounters; c++) {
+        registers[loop->reg[c]] = (uint32_t) registers[loop->reg[c]] + (uint32_t) n * (uint32_t) loop->inc[c];
+    }
+}
+
+/**
+ * Skip whole iterations of the counted loop starting at slot d, as many as
+ * it runs or as fit before limit, leaving pc at its exit or back at its
+ * head. The caller counts the last instruction skipped.
+ * @return Slot to continue at, or NULL if the loop must be executed
+ *          normally
+ */
+static dinst* skip_spin(dinst* d, uint64_t limit) {
+    spin_loop loop;
+    if(!decode_spin(d - decoded, &loop)) {
+        return NULL;
+    }
+    uint64_t runs = count_iterations(&loop);
+    uint64_t n = runs;
+    if(n > (limit - instCount) / loop.len) {
+        n = (limit - instCount) / loop.len;
+    }
+    if(n == 0) {
+        return NULL;
+    }
+
+    add_counters(&loop, n);
+    instCount += n * loop.len - 1;
+    if(n == runs) {
+        pc += 4 * loop.len;
+        return d + loop.len;
+    }
+    return d;
+}
+
+/**
+ * Number of size byte elements from addr on that lie in the text or data
+ * segment, where consecutive addresses are consecutive host bytes.
+ * @param host - Set to the host address of addr
+ * @param writable - Only count elements of the data segment, the text
+ *                      segment holding the loop itself
+ */
+static uint64_t host_elements(uint32_t addr, int size, byte** host, int writable) {
+    if(!writable && addr - TEXT_ADDRESS < textSize) {
+        *host = &text[addr - TEXT_ADDRESS];
+        return (textSize - (addr - TEXT_ADDRESS)) / size;
+    }
+    if(addr - DATA_ADDRESS < dataSize) {
+        *host = &data[addr - DATA_ADDRESS];
+        return (dataSize - (addr - DATA_ADDRESS)) / size;
+    }
+    return 0;
+}
+
+static reg load_element(uint8_t op, const byte* p) {
+    switch(op) {
+#define LOAD_ELEMENT(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            return load_##name(p);
+        LOAD_OPS(LOAD_ELEMENT)
+#undef LOAD_ELEMENT
+        default:
+            return 0;
+    }
+}
+
+static void store_element(uint8_t op, byte* p, reg v) {
+    switch(op) {
+#define STORE_ELEMENT(OP, name, opcode, funct, args, fault, sem) \
+        case OP_##OP: \
+            store_##name(p, v); \
+            break;
+        STORE_OPS(STORE_ELEMENT)
+#undef STORE_ELEMENT
+        default:
+            break;
+    }
+}
+
+/**
+ * Run the copy, fill or scan loop starting at slot d on the host, for as
+ * many iterations as it runs, fit before limit and only access memory
+ * host_elements() covers. pc is left at its exit or back at its head, for
+ * the remaining iterations to execute normally. The caller counts the last
+ * instruction run.
+ * @return Slot to continue at, or NULL if the loop must be executed
+ *          normally
+ */
+static dinst* run_bulk(dinst* d, uint64_t limit) {
+    bulk_loop loop;
+    // Watchpoints need the guest's own stores, one at a time
+    if(watch_enabled() || !decode_bulk(d - decoded, &loop)) {
+        return NULL;
+    }
+    int size = loop.size;
+    uint64_t n = (limit - instCount) / loop.counted.len;
+    uint32_t src = registers[loop.src] + loop.srcOff;
+    uint32_t dest = registers[loop.dest] + loop.destOff;
+    byte* from = NULL;
+    byte* to = NULL;
+    if(loop.load != OP_DECODE) {
+        uint64_t fit = host_elements(src, size, &from, 0);
+        n = fit < n ? fit : n;
+    }
+    if(loop.store != OP_DECODE) {
+        uint64_t fit = host_elements(dest, size, &to, 1);
+        n = fit < n ? fit : n;
+    }
+
+    uint64_t runs = UINT64_MAX;
+    if(!loop.scan) {
+        runs = count_iterations(&loop.counted);
+    } else if(size == 1) {
+        byte* zero = memchr(from, 0, n);
+        runs = zero != NULL ? (uint64_t) (zero - from) + 1 : UINT64_MAX;
+    } else {
+        for(uint64_t i=0; i<n && runs == UINT64_MAX; i++) {
+            runs = load_element(loop.load, &from[i * size]) == 0 ? i + 1 : UINT64_MAX;
+        }
+    }
+    n = runs < n ? runs : n;
+    if(n == 0) {
+        return NULL;
+    }
+
+    uint64_t len = n * size;
+    int copy = from != NULL && loop.stored == loop.value;
+    if(from != NULL && to != NULL) {
+        // Only a copy to lower addresses reads each byte before overwriting it
+        if(copy ? dest > src && dest - src < len : dest < src + len && src < dest + len) {
+            return NULL;
+        }
+    }
+    if(from != NULL) {
+        registers[loop.value] = load_element(loop.load, &from[len - size]);
+    }
+    if(to != NULL) {
+        getWritableAddr(dest, len);
+        if(copy) {
+            memmove(to, from, len);
+        } else if(size == 1) {
+            memset(to, registers[loop.stored], len);
+        } else {
+            for(uint64_t i=0; i<n; i++) {
+                store_element(loop.store, &to[i * size], registers[loop.stored]);
+            }
+        }
+    }
+
+    if(guestCounting) {
+        guestLoads += from != NULL ? n : 0;
+        guestStores += to != NULL ? n : 0;
+    }
+    add_counters(&loop.counted, n);
+    instCount += n * loop.counted.len - 1;
+    if(n == runs) {
+        pc += 4 * loop.counted.len;
+        return d + loop.counted.len;
+    }
+    return d;
+}
+
+/**
+ * Count the edge to a slot control jumps to in the AFL coverage map.
+ * @return target
+ */
+static inline dinst* edge(dinst* target, int cover) {
+    if(cover) {
+        uint32_t cur = (uint32_t) (target - decoded) * 0x9E3779B1u >> (32 - AFL_MAP_BITS);
+        aflArea[cur ^ aflPrev]++;
+        aflPrev = cur >> 1;
+    }
+    return target;
+}
+
+/**
+ * Execute instructions from the predecoded text segment, dispatching fused
+ * idioms as one operation.
+ * @param limit - Stop once this many instructions have been executed; may
+ *                  be overshot by up to MAX_FUSED_LEN - 1 instructions
+ * @param cover - Whether to count edges for AFL; a constant in each copy
+ *                  of the loop, so the other copy pays nothing for it
+ * @param count - Whether to count the guest's loads, stores and stalls,
+ *                  likewise
+ */
+static inline __attribute__((always_inline)) err_code run_decoded(uint64_t limit, const int cover, const int count) {
+    err_code err = SUCCESS;
+    dinst* d = slot_at(pc);
+    while(instCount < limit) {
+        // Slot of the next instruction, changed by block exits
+        dinst* next = d + 1;
+        if(d->op == OP_DECODE) {
+            decode_reached(d - decoded);
+        }
+        err = SUCCESS;
+        switch(d->op) {
+            // Table operations, with the semantics of instructions.h
+            // inlined and $zero written to the sink register
+#define ALU_CASES(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: { \
+                reg a = registers[d->rs]; \
+                reg b = registers[d->rt]; \
+                reg r = alu_##name(a, b); \
+                registers[d->dest] = r; \
+                err = FAULT_##fault(a, b, r); \
+                break; \
+            } \
+            case OP_##OP##_RZ: { \
+                reg a = registers[d->rs]; \
+                reg r = alu_##name(a, 0); \
+                registers[d->dest] = r; \
+                err = FAULT_##fault(a, 0, r); \
+                break; \
+            } \
+            case OP_##OP##_LZ: { \
+                reg b = registers[d->rt]; \
+                reg r = alu_##name(0, b); \
+                registers[d->dest] = r; \
+                err = FAULT_##fault(0, b, r); \
+                break; \
+            }
+            ALU_OPS(ALU_CASES)
+#undef ALU_CASES
+
+#define SHIFT_CASE(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: \
+                registers[d->dest] = shift_##name(registers[d->rt], d->shamt); \
                 break;
-            case 43:
-                err = sltu(rs, rt, rd);
+            SHIFT_OPS(SHIFT_CASE)
+#undef SHIFT_CASE
+
+#define IMM_CASE(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: { \
+                reg a = registers[d->rs]; \
+                reg r = imm_##name(a, d->imm); \
+                registers[d->dest] = r; \
+                err = FAULT_##fault(a, d->imm, r); \
+                break; \
+            }
+            IMM_OPS(IMM_CASE)
+#undef IMM_CASE
+
+#define LOAD_CASE(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: { \
+                byte* p = getRealAddr(registers[d->rs] + d->imm); \
+                if(p == NULL) { \
+                    err = NONEXISTANT_MEMORY; \
+                } else { \
+                    registers[d->dest] = load_##name(p); \
+                } \
+                guestLoads += count; \
+                break; \
+            }
+            LOAD_OPS(LOAD_CASE)
+#undef LOAD_CASE
+
+#define STORE_CASE(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: { \
+                byte* p = getWritableAddr(registers[d->rs] + d->imm, MEM_SIZE_##fault); \
+                if(p == NULL) { \
+                    err = NONEXISTANT_MEMORY; \
+                } else { \
+                    store_##name(p, registers[d->rt]); \
+                } \
+                guestStores += count; \
+                break; \
+            }
+            STORE_OPS(STORE_CASE)
+#undef STORE_CASE
+
+#define BRANCH_CASES(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: \
+                if(branch_##name(registers[d->rs], registers[d->rt])) { \
+                    pc += d->val; \
+                    next = edge(branch_slot(d), cover); \
+                } \
+                break; \
+            case OP_##OP##_RZ: \
+                if(branch_##name(registers[d->rs], 0)) { \
+                    pc += d->val; \
+                    next = edge(branch_slot(d), cover); \
+                } \
+                break; \
+            case OP_##OP##_LZ: \
+                if(branch_##name(0, registers[d->rt])) { \
+                    pc += d->val; \
+                    next = edge(branch_slot(d), cover); \
+                } \
                 break;
-                // 48 tge??
-                // ... bunch of ones that start with t
-            default:
-                err = FUNC_NOT_IMPLEMENTED;
+            BRANCH_OPS(BRANCH_CASES)
+#undef BRANCH_CASES
+
+#define SPECIAL_CASE(OP, name, opcode, funct, args, fault, sem) \
+            case OP_##OP: \
+                if(count) { \
+                    count_op(OP_##OP); \
+                } \
+                err = sem; \
+                if(err == JUMPED) { \
+                    next = edge(slot_at(pc), cover); \
+                } \
                 break;
-        }
-    } else if (opcode == 2 || opcode == 3) {
-        // J type instructions
-        uint32_t target = current_inst & 0x3FFFFFF;
-        switch (opcode) {
-            case 2:
-                err = j(target);
+            SPECIAL_OPS(SPECIAL_CASE)
+#undef SPECIAL_CASE
+
+            // Operand-specialized variants
+            case OP_NOP:
                 break;
-            case 3:
-                err = jal(target);
+            case OP_LI:
+                registers[d->dest] = d->val;
                 break;
-        }
-    } else {
-        // I type instructions
-        int16_t imm = current_inst & 0xFFFF;
-        switch (opcode) {
-            case 4:
-                err = beq(rs, rt, imm);
+            case OP_MOVE:
+                registers[d->dest] = registers[d->rt];
                 break;
-            case 5:
-                err = bne(rs, rt, imm);
+            case OP_B:
+                pc += d->val;
+                next = edge(branch_slot(d), cover);
                 break;
-                // 6 blez
-                // 7 bgtz
-            case 8:
-                err = addi(rs, rt, imm);
+            case OP_CALL:
+                push_return(d);
+                err = jal(d->imm);
+                next = edge(slot_at(pc), cover);
                 break;
-            case 9:
-                err = addiu(rs, rt, imm);
+            case OP_CALLR:
+                push_return(d);
+                err = jalr(d->rs, d->rd);
+                next = edge(slot_at(pc), cover);
                 break;
-            case 10:
-                err = slti(rs, rt, imm);
+            case OP_RETURN:
+                err = jr(d->rs);
+                next = edge(pop_return(pc), cover);
                 break;
-            case 11:
-                err = stliu(rs, rt, imm);
+            case OP_SPIN:
+                next = skip_spin(d, limit);
+                if(next != NULL) {
+                    err = JUMPED;
+                    next = edge(next, cover);
+                } else {
+                    // Not even one iteration fits before limit
+                    if(count) {
+                        count_op(d->base);
+                    }
+                    err = exec_generic(d);
+                    next = slot_at(err == JUMPED ? pc : pc + 4);
+                }
                 break;
-            case 12:
-                err = andi(rs, rt, imm);
+            case OP_BULK:
+                next = run_bulk(d, limit);
+                if(next != NULL) {
+                    err = JUMPED;
+                    next = edge(next, cover);
+                } else {
+                    if(count) {
+                        count_op(d->base);
+                    }
+                    err = exec_generic(d);
+                    next = slot_at(err == JUMPED ? pc : pc + 4);
+                }
                 break;
-            case 13:
-                err = ori(rs, rt, imm);
+            case OP_END:
+                err = pc % 4 != 0 ? UNALIGNED_INST : NONEXISTANT_MEMORY;
                 break;
-                // 14 xori
-            case 15:
-                err = lui(rt, imm);
+
+            // Fused operations: every member but the last neither faults
+            // nor jumps, and pc and instCount are stepped past it as the
+            // loop would before running the next one
+            case OP_LUI_ORI:
+                registers[d->dest] = imm_lui(0, d->imm);
+                pc += 4;
+                instCount++;
+                registers[d[1].dest] = imm_ori(registers[d[1].rs], d[1].imm);
+                next = d + 2;
                 break;
-                // 20 - 23 b stuff?
-            case 32:
-                err = lb(rs, rt, imm);
+            case OP_LUI_ADDIU:
+                registers[d->dest] = imm_lui(0, d->imm);
+                pc += 4;
+                instCount++;
+                registers[d[1].dest] = imm_addiu(registers[d[1].rs], d[1].imm);
+                next = d + 2;
                 break;
-            case 33:
-                err = lh(rs, rt, imm);
+            case OP_SLT_BEQ:
+                registers[d->dest] = alu_slt(registers[d->rs], registers[d->rt]);
+                pc += 4;
+                instCount++;
+                if(branch_beq(registers[d[1].rs], registers[d[1].rt])) {
+                    pc += (uint32_t) d[1].imm << 2;
+                    next = edge(branch_slot(&d[1]), cover);
+                } else {
+                    next = d + 2;
+                }
                 break;
-                // 34 lwl
-            case 35:
-                err = lw(rs, rt, imm);
+            case OP_SLT_BNE:
+                registers[d->dest] = alu_slt(registers[d->rs], registers[d->rt]);
+                pc += 4;
+                instCount++;
+                if(branch_bne(registers[d[1].rs], registers[d[1].rt])) {
+                    pc += (uint32_t) d[1].imm << 2;
+                    next = edge(branch_slot(&d[1]), cover);
+                } else {
+                    next = d + 2;
+                }
                 break;
-            case 36:
-                err = lbu(rs, rt, imm);
+            case OP_SLTU_BEQ:
+                registers[d->dest] = alu_sltu(registers[d->rs], registers[d->rt]);
+                pc += 4;
+                instCount++;
+                if(branch_beq(registers[d[1].rs], registers[d[1].rt])) {
+                    pc += (uint32_t) d[1].imm << 2;
+                    next = edge(branch_slot(&d[1]), cover);
+                } else {
+                    next = d + 2;
+                }
                 break;
-            case 37:
-                err = lhu(rs, rt, imm);
+            case OP_SLTU_BNE:
+                registers[d->dest] = alu_sltu(registers[d->rs], registers[d->rt]);
+                pc += 4;
+                instCount++;
+                if(branch_bne(registers[d[1].rs], registers[d[1].rt])) {
+                    pc += (uint32_t) d[1].imm << 2;
+                    next = edge(branch_slot(&d[1]), cover);
+                } else {
+                    next = d + 2;
+                }
                 break;
-                // 38 lwr (maybe lw reverse?)
-            case 40:
-                err = sb(rs, rt, imm);
+            case OP_ADDIU_SW: {
+                registers[d->dest] = imm_addiu(registers[d->rs], d->imm);
+                pc += 4;
+                instCount++;
+                byte* p = getWritableAddr(registers[d[1].rs] + d[1].imm, 4);
+                if(p == NULL) {
+                    err = NONEXISTANT_MEMORY;
+                } else {
+                    store_sw(p, registers[d[1].rt]);
+                }
+                guestStores += count;
+                next = d + 2;
                 break;
-            case 41:
-                err = sh(rs, rt, imm);
+            }
+            case OP_ADDIU_JR:
+                registers[d->dest] = imm_addiu(registers[d->rs], d->imm);
+                pc += 4;
+                instCount++;
+                err = jr(d[1].rs);
+                next = edge(d[1].rs == REG_RA ? pop_return(pc) : slot_at(pc), cover);
                 break;
-                // 42 swl?
-            case 43:
-                err = sw(rs, rt, imm);
+            case OP_SLL_ADDU_LW: {
+                registers[d->dest] = shift_sll(registers[d->rt], d->shamt);
+                registers[d[1].dest] = alu_addu(registers[d[1].rs], registers[d[1].rt]);
+                pc += 8;
+                instCount += 2;
+                byte* p = getRealAddr(registers[d[2].rs] + d[2].imm);
+                if(p == NULL) {
+                    err = NONEXISTANT_MEMORY;
+                } else {
+                    registers[d[2].dest] = load_lw(p);
+                }
+                guestLoads += count;
+                next = d + 3;
                 break;
-                // 46 swr
-                // rest are likely cache functions
+            }
             default:
                 err = FUNC_NOT_IMPLEMENTED;
                 break;
         }
+        if(err != JUMPED) {
+            pc += 4;
+        }
+        d = next;
+        instCount++;
+        if(!err_continues(err)) {
+            break;
+        }
     }
     return err;
 }
 
-void sim_run() {
-    err_code err;
-	do {
-        inst current_inst = bintoint(&text[(pc - TEXT_ADDRESS)]);
-//        printf("pc=0x%X;\t%08X\n", pc, current_inst);
-        err = exec_func(current_inst);
-        if(err != JUMPED) {
-            pc += 4;
-        }
-	} while(err == SUCCESS || err == OVERFLOW || err == JUMPED);
+static err_code exec_decoded(uint64_t limit) {
+    if(aflArea != NULL) {
+        return run_decoded(limit, 1, guestCounting);
+    }
+    return guestCounting ? run_decoded(limit, 0, 1) : run_decoded(limit, 0, 0);
+}
 
+void sim_print_error(FILE* out, err_code err) {
     switch (err) {
         case DIV_BY_ZERO:
-            fprintf(stderr, "Divide by zero error. pc=0x%X", pc);
+            fprintf(out, "Divide by zero error. pc=0x%X", pc);
             break;
         case NONEXISTANT_MEMORY:
-            fprintf(stderr, "Illegal memory address. pc=0x%X", pc);
+            fprintf(out, "Illegal memory address. pc=0x%X", pc);
             break;
         case BAD_SYSCALL:
-            fprintf(stderr, "Syscall code %d not implemented. pc=0x%X", registers[2], pc);
+            fprintf(out, "Syscall code %d not implemented. pc=0x%X", registers[2], pc);
             break;
         case FUNC_NOT_IMPLEMENTED:
-            fprintf(stderr, "Function not implemented. pc=0x%X", pc);
+            fprintf(out, "Function not implemented. pc=0x%X", pc);
             break;
         case BREAK:
-            fprintf(stderr, "Break function called. pc=0x%X", pc);
+            fprintf(out, "Break function called. pc=0x%X", pc);
             break;
         case UNALIGNED_INST:
-            fprintf(stderr, "Instrunction call not aligned on work address. pc=0x%X", pc);
+            fprintf(out, "Instrunction call not aligned on work address. pc=0x%X", pc);
+            break;
+        case REPLAY_MISMATCH:
+            fprintf(out, "Syscall code %d does not match the replayed log. pc=0x%X", registers[2], pc);
             break;
         default:
             break;
     }
 }
 
+void sim_report_error(err_code err) {
+    sim_print_error(stderr, err);
+}
+
+/**
+ * Execute instructions until limit, an error or a MODE_SWITCH.
+ */
+static err_code execute(uint64_t limit) {
+    err_code err = SUCCESS;
+    if(traceRing != NULL && roiInside) {
+        while(instCount < limit) {
+            uint32_t offset = (uint32_t) pc - TEXT_ADDRESS;
+            if(offset / 4 >= numSlots) {
+                err = NONEXISTANT_MEMORY;
+            } else {
+                inst current_inst = bintoint(&text[offset]);
+                if(guestCounting) {
+                    count_word(current_inst);
+                }
+                err = exec_traced(current_inst);
+            }
+            if(err != JUMPED) {
+                pc += 4;
+            }
+            instCount++;
+            if(!err_continues(err)) {
+                break;
+            }
+        }
+    } else {
+        // Run fused operations up to where they cannot overshoot limit, then
+        // finish one instruction at a time
+        if(limit > MAX_FUSED_LEN - 1) {
+            err = exec_decoded(limit - (MAX_FUSED_LEN - 1));
+        }
+        while(err_continues(err) && instCount < limit) {
+            uint32_t offset = (uint32_t) pc - TEXT_ADDRESS;
+            if(offset / 4 >= numSlots) {
+                err = NONEXISTANT_MEMORY;
+            } else {
+                inst current_inst = bintoint(&text[offset]);
+                if(guestCounting) {
+                    count_word(current_inst);
+                }
+                err = exec_func(current_inst);
+            }
+            if(err != JUMPED) {
+                pc += 4;
+            }
+            instCount++;
+        }
+    }
+    return err;
+}
+
+err_code sim_execute(uint64_t limit) {
+    err_code err;
+    do {
+        err = execute(limit);
+    } while(err == MODE_SWITCH);
+    return err;
+}
+
+err_code sim_step(uint64_t limit) {
+    err_code err;
+    if(instCount + MAX_FUSED_LEN >= limit) {
+        // Events are only noticed when a run stops right at them
+        return SUCCESS;
+    } else if(traceRing != NULL && roiInside) {
+        err = execute(instCount + 1);
+    } else {
+        err = exec_decoded(instCount + 1);
+    }
+    return err == MODE_SWITCH ? SUCCESS : err;
+}
+
+/**
+ * @return Nonzero if the run stopped at count next, UINT64_MAX meaning
+ *          never even when a skipped loop runs instCount up to it
+ */
+static int reached(uint64_t next) {
+    return next != UINT64_MAX && instCount == next;
+}
+
+void sim_run() {
+    err_code err;
+    do {
+        uint64_t nextCheckpoint = checkpoint_next(instCount);
+        uint64_t nextSnapshot = timetravel_next(instCount);
+        uint64_t nextSample = hostprof_next(instCount);
+        uint64_t nextPoll = multicore_next(instCount);
+        uint64_t next = nextCheckpoint < nextSnapshot ? nextCheckpoint : nextSnapshot;
+        next = next < nextPoll ? next : nextPoll;
+        err = sim_execute(next < nextSample ? next : nextSample);
+        if(err_continues(err) && reached(nextCheckpoint)) {
+            checkpoint_save();
+        }
+        if(err_continues(err) && reached(nextSnapshot)) {
+            timetravel_event();
+        }
+        if(err_continues(err) && reached(nextSample) && roiInside) {
+            err = hostprof_sample(next);
+        }
+        if(err_continues(err) && reached(nextPoll)) {
+            err = multicore_poll();
+        }
+    } while(err_continues(err));
+    multicore_stop();
+
+    sim_report_error(err);
+    if(timetravel_enabled() && err != EXIT) {
+        timetravel_debug(err);
+    }
+}
+
 void sim_exit() {
-    free(text);
-    free(data);
-    free(stack);
+    timetravel_exit();
+    decode_exit();
+    imgcache_close();
+    sim_free_segment(text, textSize);
+    sim_free_segment(data, dataSize);
+    sim_free_segment(stack, stackSize);
 }
  
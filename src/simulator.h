@@ -2,6 +2,8 @@
 #define GSIM_SIMULATOR_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 
 typedef enum err_code {
     SUCCESS,
@@ -13,12 +15,28 @@ typedef enum err_code {
     FUNC_NOT_IMPLEMENTED,
     BREAK,
     UNALIGNED_INST,
+    REPLAY_MISMATCH,
+    WOULD_BLOCK,
+    MODE_SWITCH,
     EXIT
 } err_code;
 
+typedef uint8_t byte;
+typedef int32_t reg;
+typedef uint32_t inst;
+
 #include "functions.h"
 
 #define NUM_REGISTERS 32  // Total number of registers
+#define REG_SINK NUM_REGISTERS  // Extra slot after the registers taking writes to $zero
+
+/**
+ * Storage class of the state of a simulated CPU: its registers, pc,
+ * instruction count, stack, ll link and shadow return-address stack. Each host
+ * thread running a CPU has its own copy, see multiCore.h; the segments
+ * other than the stack, and the decoded text, are shared.
+ */
+#define CPU_LOCAL __thread
 
 /*
 MIPS registers and conventional usages
@@ -41,20 +59,178 @@ $hi 	Higher order 16 bits used in multiplication
 $lo		Lower order 16 bits used in multiplication
 */
 
-typedef uint8_t byte;
-typedef int32_t reg;
-typedef uint32_t inst;
+/**
+ * Layout of the data segment of an executable: the rdata, data and sdata
+ * sections stored in the file, in that order, followed by the sbss and bss
+ * sections, which are zero-filled. The relocation, reference, symbol and
+ * string sections after them in the file are only used by the linker.
+ * @param execFile - Contents of the executable file
+ * @param loaded - Set to the number of bytes stored in the file, right
+ *                  after the text segment
+ * @return Size of the whole data segment in bytes
+ */
+size_t sim_data_size(const byte* execFile, size_t* loaded);
+
+
+/**
+ * Check that the header of an executable describes segments that lie in
+ * the file and fit the address space, before it is given to sim_init().
+ * @param execFile - Contents of the executable file
+ * @param fileSize - Length of the file
+ * @return 0 if the executable can be loaded, -1 otherwise
+ */
+int sim_check_exec(const byte* execFile, size_t fileSize);
+
 
 /**
  * Allocate memory for text, data and stack segments.
  * Also initializes registers to their correct values, and puts command
  * line arguments into the stack segment.
  * @param execFile - pointer to byte array of the inputted
- *                      executable file
+ *                      executable file, checked by sim_check_exec()
  * @param argc - Number of arguments
  * @param argv - Pointer array to arguments
+ * @return 0 on success, -1 if the segments could not be allocated
+ */
+int sim_init(byte* execFile, int argc, char* argv[]);
+
+
+/**
+ * State of one guest machine kept aside while another one is in the
+ * globals of the run loop, for the modes running several machines of the
+ * loaded program (gsim --lockstep and --sessions). They share the text
+ * segment and the decoded text.
+ */
+typedef struct sim_machine {
+    reg regs[NUM_REGISTERS];
+    reg hi;
+    reg lo;
+    reg pc;
+    uint64_t instCount;
+    byte* data;
+    byte* stack;
+} sim_machine;
+
+/**
+ * Line "INPUT OUTPUT" of the list given to those modes.
+ */
+typedef struct sim_list_entry {
+    char* inName;
+    char* outName;
+} sim_list_entry;
+
+
+/**
+ * Read a list of machines to run, one line per machine holding the file
+ * it reads its input from and the file it prints to, separated by blanks.
+ * @param listName - Path of the list
+ * @param entries - Set to the lines, free them with sim_free_list()
+ * @param count - Set to the number of lines
+ * @return 0 on success, -1 if it cannot be read or a line has no output
+ */
+int sim_read_list(const char* listName, sim_list_entry** entries, size_t* count);
+
+
+/**
+ * Release the lines returned by sim_read_list().
+ */
+void sim_free_list(sim_list_entry* entries, size_t count);
+
+
+/**
+ * @return Bytes of the data segment up to its last nonzero one, which is
+ *          all a fresh zero-filled copy of it needs
+ */
+size_t sim_data_used();
+
+
+/**
+ * Set up a machine in the state of the loaded program, right after
+ * sim_init(), with segments of its own.
+ * @param m - Machine set up
+ * @param dataUsed - Result of sim_data_used()
+ * @return 0 on success, -1 if its segments could not be allocated
+ */
+int sim_machine_init(sim_machine* m, size_t dataUsed);
+
+
+/**
+ * Release the segments of a machine set up by sim_machine_init(), while it
+ * is not in the run loop.
+ */
+void sim_machine_free(sim_machine* m);
+
+
+/**
+ * Exchange the state of a machine with the one in the run loop, so the run
+ * loop and the syscall handlers run it. Calling it again swaps back.
+ */
+void sim_machine_swap(sim_machine* m);
+
+
+/**
+ * Allocate a zero-filled, page aligned memory segment.
+ * @param size - Size of the segment in bytes
+ * @return Pointer to the segment, or NULL if it could not be mapped
+ */
+byte* sim_alloc_segment(size_t size);
+
+
+/**
+ * Release a segment returned by sim_alloc_segment().
+ * @param seg - Pointer to the segment
+ * @param size - Size the segment was allocated with
+ */
+void sim_free_segment(byte* seg, size_t size);
+
+
+/**
+ * Decode one instruction and execute it with the handler in functions.c.
+ * @param current_inst - Instruction word at pc
+ * @return Code returned by the handler
+ */
+err_code exec_func(inst current_inst);
+
+
+/**
+ * @return Nonzero if the simulation keeps running after an instruction
+ *          returned err
+ */
+static inline int err_continues(err_code err) {
+    return err == SUCCESS || err == OVERFLOW || err == JUMPED;
+}
+
+
+/**
+ * Execute instructions without checkpoints, snapshots or error reporting.
+ * @param limit - Stop once this many instructions have been executed
+ * @return Code of the last instruction executed, SUCCESS if none was
+ */
+err_code sim_execute(uint64_t limit);
+
+/**
+ * Execute one dispatch of the decoded loop: the instruction at pc, or the
+ * whole fused sequence starting there. While tracing, a single instruction
+ * of the traced loop is executed instead.
+ * @param limit - Instruction count the step must stop short of; nothing is
+ *                  executed if a fused sequence could reach it
+ * @return Code of the last instruction executed, SUCCESS if none was
+ */
+err_code sim_step(uint64_t limit);
+
+
+/**
+ * Print the message for an error that stopped the simulation.
+ * @param err - Code returned by the last instruction
+ */
+void sim_report_error(err_code err);
+
+/**
+ * Same as sim_report_error(), to another stream.
+ * @param out - Stream printed to
+ * @param err - Code returned by the last instruction
  */
-void sim_init(byte* execFile, int argc, char* argv[]);
+void sim_print_error(FILE* out, err_code err);
 
 
 /**
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sysRecord.h"
+
+#define RECORD_HEADER_SIZE 16
+#define INITIAL_LOG_SIZE 4096
+
+static int recording;
+static byte* recLog;
+static size_t logLen;
+static size_t logCap;
+static size_t readPos;
+
+
+static uint32_t get32(const byte* src) {
+    return ((uint32_t) src[0] << 24) + ((uint32_t) src[1] << 16) +
+            ((uint32_t) src[2] << 8) + src[3];
+}
+
+static void put32(byte* dest, uint32_t i) {
+    dest[0] = i >> 24 & 0xFF;
+    dest[1] = i >> 16 & 0xFF;
+    dest[2] = i >> 8 & 0xFF;
+    dest[3] = i & 0xFF;
+}
+
+void sysrec_start() {
+    recording = 1;
+}
+
+int sysrec_recording() {
+    return recording;
+}
+
+int sysrec_replaying() {
+    return readPos < logLen;
+}
+
+void sysrec_append(uint32_t code, reg v0, reg v1, const byte* bytes, uint32_t len) {
+    if(logLen + RECORD_HEADER_SIZE + len > logCap) {
+        while(logLen + RECORD_HEADER_SIZE + len > logCap) {
+            logCap = logCap ? logCap * 2 : INITIAL_LOG_SIZE;
+        }
+        recLog = realloc(recLog, logCap);
+    }
+    put32(&recLog[logLen], code);
+    put32(&recLog[logLen + 4], v0);
+    put32(&recLog[logLen + 8], v1);
+    put32(&recLog[logLen + 12], len);
+    if(len) {
+        memcpy(&recLog[logLen + RECORD_HEADER_SIZE], bytes, len);
+    }
+    logLen += RECORD_HEADER_SIZE + len;
+    readPos = logLen;
+}
+
+int sysrec_next(uint32_t code, sys_record* rec) {
+    if(readPos + RECORD_HEADER_SIZE > logLen || get32(&recLog[readPos]) != code) {
+        return -1;
+    }
+    rec->code = code;
+    rec->v0 = get32(&recLog[readPos + 4]);
+    rec->v1 = get32(&recLog[readPos + 8]);
+    rec->len = get32(&recLog[readPos + 12]);
+    rec->bytes = &recLog[readPos + RECORD_HEADER_SIZE];
+    readPos += RECORD_HEADER_SIZE + rec->len;
+    return 0;
+}
+
+int sysrec_load(const char* fileName) {
+    FILE* file = fopen(fileName, "rb");
+    if(file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+
+    size_t headerLen = strlen(SYSREC_MAGIC) + 1;
+    byte* contents = malloc(fileSize > 0 ? fileSize : 1);
+    if(fileSize < (long) headerLen || fread(contents, 1, fileSize, file) != (size_t) fileSize
+       || memcmp(contents, SYSREC_MAGIC, headerLen - 1) != 0 || contents[headerLen - 1] != SYSREC_VERSION) {
+        free(contents);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    // Check the records chain up to the end of the file
+    size_t pos = headerLen;
+    while(pos + RECORD_HEADER_SIZE <= (size_t) fileSize
+          && get32(&contents[pos + 12]) <= fileSize - pos - RECORD_HEADER_SIZE) {
+        pos += RECORD_HEADER_SIZE + get32(&contents[pos + 12]);
+    }
+    if(pos != (size_t) fileSize) {
+        free(contents);
+        return -1;
+    }
+
+    free(recLog);
+    logLen = fileSize - headerLen;
+    logCap = logLen;
+    recLog = malloc(logLen ? logLen : 1);
+    memcpy(recLog, &contents[headerLen], logLen);
+    free(contents);
+    readPos = 0;
+    return 0;
+}
+
+int sysrec_save(const char* fileName) {
+    FILE* file = fopen(fileName, "wb");
+    if(file == NULL) {
+        return -1;
+    }
+    fwrite(SYSREC_MAGIC, 1, strlen(SYSREC_MAGIC), file);
+    fputc(SYSREC_VERSION, file);
+    fwrite(recLog, 1, logLen, file);
+    int failed = ferror(file);
+    failed |= fclose(file);
+    return failed ? -1 : 0;
+}
+
+size_t sysrec_tell() {
+    return readPos;
+}
+
+void sysrec_seek(size_t pos) {
+    readPos = pos;
+}
@@ -0,0 +1,98 @@
+#ifndef GSIM_SYSRECORD_H
+#define GSIM_SYSRECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "simulator.h"
+
+/**
+ * Log of syscall results.
+ *
+ * While recording, every syscall appends what it did. As long as the read
+ * position is before the end of the log, syscalls take their results from
+ * it instead of the terminal: input syscalls return the logged values and
+ * output syscalls print nothing. Re-executing the program, from the start
+ * of a loaded log or from a time-travel snapshot, reproduces the original
+ * run exactly without touching stdin or stdout.
+ *
+ * Each record holds the syscall code, the resulting $v0 and $v1, and the
+ * bytes the syscall stored into guest memory or printed.
+ *
+ * Log file layout: "GSIMSYS" followed by one version byte, then the
+ * records, each made of big-endian code, $v0, $v1 and byte count words
+ * followed by the bytes.
+ */
+
+typedef struct sys_record {
+    uint32_t code;
+    reg v0;
+    reg v1;
+    uint32_t len;
+    const byte* bytes;
+} sys_record;
+
+#define SYSREC_MAGIC "GSIMSYS"
+#define SYSREC_VERSION 1
+
+/**
+ * Start appending syscall results to the log.
+ */
+void sysrec_start();
+
+/**
+ * @return Nonzero if syscall results are being logged
+ */
+int sysrec_recording();
+
+/**
+ * @return Nonzero if the next syscall result should come from the log
+ */
+int sysrec_replaying();
+
+/**
+ * Append a syscall result at the end of the log.
+ * @param code - Syscall code
+ * @param v0 - Resulting value of $v0
+ * @param v1 - Resulting value of $v1
+ * @param bytes - Bytes stored into guest memory, may be NULL if len is 0
+ * @param len - Number of bytes stored
+ */
+void sysrec_append(uint32_t code, reg v0, reg v1, const byte* bytes, uint32_t len);
+
+/**
+ * Read the next logged result and advance the read position.
+ * @param code - Syscall code being replayed
+ * @param rec - Filled with the record; its bytes point into the log
+ * @return 0 on success, -1 if the next record is for a different syscall
+ */
+int sysrec_next(uint32_t code, sys_record* rec);
+
+/**
+ * Replay a log file. Its records are loaded into memory and consumed
+ * before any syscall goes to the terminal.
+ * @param fileName - Path of a file written by sysrec_save()
+ * @return 0 on success, -1 if the file is missing or malformed
+ */
+int sysrec_load(const char* fileName);
+
+/**
+ * Write the whole log to a file.
+ * @param fileName - Path of the file to create
+ * @return 0 on success, -1 on failure
+ */
+int sysrec_save(const char* fileName);
+
+/**
+ * @return Current read position, for use with sysrec_seek()
+ */
+size_t sysrec_tell();
+
+/**
+ * Move the read position. Records past the position are replayed before
+ * any new result is taken from outside the simulator.
+ * @param pos - Position previously returned by sysrec_tell()
+ */
+void sysrec_seek(size_t pos);
+
+#endif // GSIM_SYSRECORD_H
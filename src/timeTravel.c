@@ -0,0 +1,542 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simulator.h"
+#include "decode.h"
+#include "sysRecord.h"
+#include "timeTravel.h"
+
+#define TEXT_ADDRESS 0x400000
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define MAX_SNAPSHOTS 1024
+#define NUM_SEGMENTS 3
+
+
+extern byte* text;
+extern byte* data;
+extern CPU_LOCAL byte* stack;
+
+extern size_t textSize;
+extern size_t dataSize;
+extern CPU_LOCAL size_t stackSize;
+
+extern CPU_LOCAL reg registers[];
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL reg hi;
+extern CPU_LOCAL reg lo;
+
+extern CPU_LOCAL uint64_t instCount;
+
+typedef struct page_copy {
+    unsigned int refs;
+    byte bytes[PAGE_SIZE];
+} page_copy;
+
+/**
+ * A page written between two snapshots, with its contents at the earlier one.
+ */
+typedef struct page_delta {
+    int seg;
+    size_t page;
+    page_copy* before;
+} page_delta;
+
+typedef struct snapshot {
+    uint64_t instCount;
+    reg registers[NUM_REGISTERS];
+    reg pc;
+    reg hi;
+    reg lo;
+    size_t recordPos;
+    page_delta* changed;        // Pages changed since the previous snapshot, sorted
+    size_t numChanged;
+} snapshot;
+
+int dirtyTracking;
+
+static uint64_t interval;
+static snapshot snapshots[MAX_SNAPSHOTS];
+static int numSnapshots;
+static uint64_t highWater;      // Furthest instruction count executed
+
+static byte* segBase[NUM_SEGMENTS];
+static size_t segPages[NUM_SEGMENTS];
+static page_copy** latest[NUM_SEGMENTS];    // Contents at the newest snapshot
+static byte* dirty[NUM_SEGMENTS];
+static page_delta* dirtyList;   // Pages written since the last snapshot, before unset
+static size_t numDirty;
+static size_t dirtyCap;
+static page_copy* zeroPage;     // Shared by the untouched pages of the first snapshot
+
+#define RESTORED 2              // dirty[] mark of a page restore_snapshot() already set
+
+
+static size_t page_len(int seg, size_t page) {
+    size_t size = seg == 0 ? textSize : seg == 1 ? dataSize : stackSize;
+    return size - page * PAGE_SIZE < PAGE_SIZE ? size - page * PAGE_SIZE : PAGE_SIZE;
+}
+
+static int is_zero(const byte* bytes, size_t len) {
+    return len == 0 || (bytes[0] == 0 && memcmp(bytes, bytes + 1, len - 1) == 0);
+}
+
+static void drop(page_copy* copy) {
+    if(--copy->refs == 0) {
+        free(copy);
+    }
+}
+
+static int delta_cmp(const void* a, const void* b) {
+    const page_delta* x = a;
+    const page_delta* y = b;
+    if(x->seg != y->seg) {
+        return x->seg - y->seg;
+    }
+    return x->page < y->page ? -1 : x->page > y->page;
+}
+
+static void release(snapshot* snap) {
+    for(size_t i=0; i<snap->numChanged; i++) {
+        drop(snap->changed[i].before);
+    }
+    free(snap->changed);
+}
+
+/**
+ * Fold the changes of a dropped snapshot into the one after it. Where both
+ * changed a page, the contents before the dropped one are kept.
+ */
+static void merge_into(snapshot* from, snapshot* into) {
+    page_delta* merged = malloc((from->numChanged + into->numChanged) * sizeof(page_delta));
+    size_t n = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while(i < from->numChanged || j < into->numChanged) {
+        int cmp = i == from->numChanged ? 1 : j == into->numChanged ? -1 :
+                delta_cmp(&from->changed[i], &into->changed[j]);
+        if(cmp < 0) {
+            merged[n++] = from->changed[i++];
+        } else if(cmp > 0) {
+            merged[n++] = into->changed[j++];
+        } else {
+            drop(into->changed[j].before);
+            merged[n] = into->changed[j++];
+            merged[n++].before = from->changed[i++].before;
+        }
+    }
+    free(from->changed);
+    free(into->changed);
+    into->changed = merged;
+    into->numChanged = n;
+}
+
+/**
+ * Keep every other snapshot once the table is full, so the retained
+ * history still spans the whole run at twice the interval. The newest is
+ * always kept, as latest holds its contents.
+ */
+static void thin_out() {
+    int kept = 1;
+    for(int i=1; i<numSnapshots; i++) {
+        if(i % 2 == 0 || i == numSnapshots - 1) {
+            snapshots[kept++] = snapshots[i];
+        } else {
+            merge_into(&snapshots[i], &snapshots[i + 1]);
+        }
+    }
+    numSnapshots = kept;
+    interval *= 2;
+}
+
+/**
+ * Record the registers and copy the pages written since the last snapshot.
+ * Pages written back unchanged, or rewritten while replaying, are skipped.
+ */
+static void take_snapshot() {
+    if(numSnapshots == MAX_SNAPSHOTS) {
+        thin_out();
+    }
+    snapshot* snap = &snapshots[numSnapshots++];
+
+    snap->instCount = instCount;
+    memcpy(snap->registers, registers, sizeof(snap->registers));
+    snap->pc = pc;
+    snap->hi = hi;
+    snap->lo = lo;
+    snap->recordPos = sysrec_tell();
+    snap->changed = numDirty ? malloc(numDirty * sizeof(page_delta)) : NULL;
+    snap->numChanged = 0;
+    for(size_t i=0; i<numDirty; i++) {
+        int s = dirtyList[i].seg;
+        size_t p = dirtyList[i].page;
+        byte* bytes = &segBase[s][p * PAGE_SIZE];
+        dirty[s][p] = 0;
+        if(memcmp(bytes, latest[s][p]->bytes, page_len(s, p)) == 0) {
+            continue;
+        }
+        page_delta* change = &snap->changed[snap->numChanged++];
+        change->seg = s;
+        change->page = p;
+        change->before = latest[s][p];
+        latest[s][p] = malloc(sizeof(page_copy));
+        latest[s][p]->refs = 1;
+        memcpy(latest[s][p]->bytes, bytes, page_len(s, p));
+    }
+    numDirty = 0;
+    if(snap->numChanged > 1) {
+        qsort(snap->changed, snap->numChanged, sizeof(page_delta), delta_cmp);
+    }
+}
+
+static void restore_page(int s, size_t p, const page_copy* copy) {
+    // Pages that did not change are left alone, so zero-filled ones
+    // never written stay unbacked
+    byte* dest = &segBase[s][p * PAGE_SIZE];
+    if(memcmp(dest, copy->bytes, page_len(s, p)) != 0) {
+        if(s == 0) {
+            // Code written since the snapshot, drop its decoded slots
+            decode_invalidate(p * PAGE_SIZE, page_len(s, p));
+        }
+        memcpy(dest, copy->bytes, page_len(s, p));
+    }
+}
+
+/**
+ * Only pages written since the last snapshot, or changed by a later
+ * snapshot than the one restored, can differ from it. The first later
+ * change of a page holds its contents at the restored snapshot.
+ */
+static void restore_snapshot(int index) {
+    snapshot* snap = &snapshots[index];
+    for(int i=index+1; i<numSnapshots; i++) {
+        for(size_t c=0; c<snapshots[i].numChanged; c++) {
+            page_delta* change = &snapshots[i].changed[c];
+            if(dirty[change->seg][change->page] != RESTORED) {
+                restore_page(change->seg, change->page, change->before);
+                dirty[change->seg][change->page] = RESTORED;
+            }
+        }
+    }
+    for(size_t i=0; i<numDirty; i++) {
+        int s = dirtyList[i].seg;
+        size_t p = dirtyList[i].page;
+        if(dirty[s][p] != RESTORED) {
+            restore_page(s, p, latest[s][p]);
+        }
+        dirty[s][p] = 0;
+    }
+    for(int i=index+1; i<numSnapshots; i++) {
+        for(size_t c=0; c<snapshots[i].numChanged; c++) {
+            dirty[snapshots[i].changed[c].seg][snapshots[i].changed[c].page] = 0;
+        }
+    }
+    numDirty = 0;
+    memcpy(registers, snap->registers, sizeof(snap->registers));
+    pc = snap->pc;
+    hi = snap->hi;
+    lo = snap->lo;
+    instCount = snap->instCount;
+    sysrec_seek(snap->recordPos);
+}
+
+void timetravel_enable(uint64_t snapInterval) {
+    segBase[0] = text;
+    segBase[1] = data;
+    segBase[2] = stack;
+    segPages[0] = (textSize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    segPages[1] = (dataSize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    segPages[2] = (stackSize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    // Held until timetravel_exit(), on top of the pages using it
+    zeroPage = calloc(1, sizeof(page_copy));
+    zeroPage->refs = 1;
+    for(int s=0; s<NUM_SEGMENTS; s++) {
+        dirty[s] = calloc(segPages[s] + 1, 1);
+        latest[s] = malloc(segPages[s] * sizeof(page_copy*));
+        for(size_t p=0; p<segPages[s]; p++) {
+            if(is_zero(&segBase[s][p * PAGE_SIZE], page_len(s, p))) {
+                // Large zero-filled sections cost one copy, not one per page
+                latest[s][p] = zeroPage;
+                zeroPage->refs++;
+            } else {
+                latest[s][p] = malloc(sizeof(page_copy));
+                latest[s][p]->refs = 1;
+                memcpy(latest[s][p]->bytes, &segBase[s][p * PAGE_SIZE], page_len(s, p));
+            }
+        }
+    }
+
+    interval = snapInterval;
+    highWater = instCount;
+    dirtyTracking = 1;
+    sysrec_start();
+    take_snapshot();
+}
+
+int timetravel_enabled() {
+    return interval != 0;
+}
+
+uint64_t timetravel_next(uint64_t now) {
+    if(interval == 0) {
+        return UINT64_MAX;
+    }
+    uint64_t next = snapshots[numSnapshots - 1].instCount + interval;
+    return next > now ? next : now + interval - now % interval;
+}
+
+void timetravel_event() {
+    if(instCount > highWater) {
+        highWater = instCount;
+    }
+    if(instCount >= snapshots[numSnapshots - 1].instCount + interval) {
+        take_snapshot();
+    }
+}
+
+void timetravel_dirty(byte* realAddr, size_t len) {
+    for(int s=0; s<NUM_SEGMENTS; s++) {
+        if(realAddr >= segBase[s] && realAddr < segBase[s] + segPages[s] * PAGE_SIZE) {
+            size_t first = (realAddr - segBase[s]) >> PAGE_SHIFT;
+            size_t last = (realAddr - segBase[s] + (len ? len - 1 : 0)) >> PAGE_SHIFT;
+            for(size_t p=first; p<=last && p<segPages[s]; p++) {
+                if(dirty[s][p]) {
+                    continue;
+                }
+                dirty[s][p] = 1;
+                if(numDirty == dirtyCap) {
+                    dirtyCap = dirtyCap ? dirtyCap * 2 : 64;
+                    dirtyList = realloc(dirtyList, dirtyCap * sizeof(page_delta));
+                }
+                dirtyList[numDirty].seg = s;
+                dirtyList[numDirty++].page = p;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Go to the state after target instructions by restoring the nearest
+ * earlier snapshot, unless the current state is already on the way, and
+ * replaying forward. Syscalls take their results from the log, so nothing
+ * is printed twice.
+ */
+static void go_to(uint64_t target) {
+    if(target > highWater) {
+        target = highWater;
+    }
+    if(target < instCount) {
+        int i = numSnapshots - 1;
+        while(i > 0 && snapshots[i].instCount > target) {
+            i--;
+        }
+        restore_snapshot(i);
+    }
+    sim_execute(target);
+}
+
+static uint32_t read_word(uint32_t addr) {
+    byte* realAddr = getRealAddr(addr);
+    return ((uint32_t) realAddr[0] << 24) + ((uint32_t) realAddr[1] << 16) +
+            ((uint32_t) realAddr[2] << 8) + realAddr[3];
+}
+
+/**
+ * Host bytes holding the guest range of len bytes at addr, which run
+ * downwards on the stack.
+ * @return len, or 0 if the range is empty or not within one segment
+ */
+static size_t host_range(uint32_t addr, size_t len, byte** dest) {
+    byte* first = len ? getRealAddr(addr) : NULL;
+    byte* last = len ? getRealAddr(addr + (len - 1)) : NULL;
+    if(first == NULL || last == NULL) {
+        return 0;
+    }
+    if(last - first == (ptrdiff_t) (len - 1)) {
+        *dest = first;
+    } else if(first - last == (ptrdiff_t) (len - 1)) {
+        *dest = last;
+    } else {
+        return 0;
+    }
+    return len;
+}
+
+/**
+ * Host range written by the instruction at pc, if it is a store or a
+ * syscall writing guest memory.
+ * @return Number of bytes written starting at *dest, or 0
+ */
+static size_t store_range(byte** dest) {
+    byte* word = getRealAddr(pc);
+    if(word == NULL || pc % 4 != 0) {
+        return 0;
+    }
+    inst current_inst = read_word(pc);
+    uint8_t opcode = current_inst >> 26 & 0x3F;
+    uint32_t addr = registers[current_inst >> 21 & 0x1F] + (reg) (int16_t) (current_inst & 0xFFFF);
+
+    if(opcode == 40 || opcode == 41 || opcode == 43 || opcode == 56) {
+        *dest = getRealAddr(addr);
+        return *dest == NULL ? 0 : opcode == 40 ? 1 : opcode == 41 ? 2 : 4;
+    } else if(opcode != 0 || (current_inst & 0x3F) != 12) {
+        return 0;
+    }
+    switch(registers[2]) {
+        case 8:
+            // fgets() fills the host bytes from a0 on, even on the stack
+            *dest = getRealAddr(registers[4]);
+            return *dest == NULL ? 0 : (uint32_t) registers[5];
+        case 100:   // memcpy
+        case 101:   // memset
+            return host_range(registers[4], (uint32_t) registers[6], dest);
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Go back to just after the last instruction before the current one that
+ * wrote the byte at addr.
+ */
+static void last_write(uint32_t addr) {
+    byte* target = getRealAddr(addr);
+    if(target == NULL) {
+        fprintf(stderr, "0x%08X is not a valid address\n", addr);
+        return;
+    }
+
+    uint64_t end = instCount;
+    uint64_t found = UINT64_MAX;
+    uint32_t writerPc = 0;
+    for(int i=numSnapshots - 1; i >= 0 && found == UINT64_MAX; i--) {
+        if(snapshots[i].instCount >= end) {
+            continue;
+        }
+        uint64_t windowEnd = i + 1 < numSnapshots && snapshots[i + 1].instCount < end ?
+                             snapshots[i + 1].instCount : end;
+        restore_snapshot(i);
+        while(instCount < windowEnd) {
+            byte* dest;
+            size_t len = store_range(&dest);
+            if(len && target >= dest && target < dest + len) {
+                found = instCount;
+                writerPc = pc;
+            }
+            if(!err_continues(sim_execute(instCount + 1))) {
+                break;
+            }
+        }
+    }
+
+    if(found == UINT64_MAX) {
+        fprintf(stderr, "No write to 0x%08X in the recorded history\n", addr);
+        go_to(end);
+        return;
+    }
+    go_to(found);
+    byte old = *target;
+    go_to(found + 1);
+    fprintf(stderr, "Instruction %llu at pc=0x%X wrote 0x%08X: 0x%02X -> 0x%02X\n",
+            (unsigned long long) found, writerPc, addr, old, *target);
+}
+
+/**
+ * Print the instruction count and the instruction about to execute.
+ */
+static void print_position() {
+    char disasm[64] = "outside the text segment";
+    if(pc % 4 == 0 && (uint32_t) pc - TEXT_ADDRESS < textSize) {
+        decode_disasm(read_word(pc), pc, disasm, sizeof(disasm));
+    }
+    fprintf(stderr, "At instruction %llu, pc=0x%X: %s\n", (unsigned long long) instCount, pc, disasm);
+}
+
+static void print_regs() {
+    fprintf(stderr, "instructions=%llu pc=0x%08X hi=0x%08X lo=0x%08X\n",
+            (unsigned long long) instCount, pc, hi, lo);
+    for(int i=0; i<NUM_REGISTERS; i++) {
+        fprintf(stderr, "$%-2d=0x%08X%s", i, registers[i], i % 4 == 3 ? "\n" : "  ");
+    }
+}
+
+void timetravel_debug(err_code err) {
+    if(instCount > highWater) {
+        highWater = instCount;
+    }
+    FILE* in = fopen("/dev/tty", "r");
+    if(in == NULL) {
+        in = stdin;
+    }
+
+    fprintf(stderr, "\nStopped after %llu instructions. Type help for commands.\n",
+            (unsigned long long) instCount);
+    char line[256];
+    while(fprintf(stderr, "(gsim) "), fgets(line, sizeof(line), in) != NULL) {
+        char cmd[32] = "";
+        unsigned long long arg = 1;
+        int n = sscanf(line, "%31s %lli", cmd, (long long*) &arg);
+        if(n < 1) {
+            continue;
+        }
+
+        if(strcmp(cmd, "back") == 0 || strcmp(cmd, "b") == 0) {
+            go_to(arg > instCount ? 0 : instCount - arg);
+        } else if(strcmp(cmd, "forward") == 0 || strcmp(cmd, "f") == 0) {
+            go_to(instCount + arg);
+        } else if(strcmp(cmd, "goto") == 0 && n == 2) {
+            go_to(arg);
+        } else if(strcmp(cmd, "lastwrite") == 0 && n == 2) {
+            last_write((uint32_t) arg);
+        } else if(strcmp(cmd, "regs") == 0) {
+            print_regs();
+            continue;
+        } else if(strcmp(cmd, "mem") == 0 && n == 2) {
+            if(getRealAddr((uint32_t) arg) == NULL) {
+                fprintf(stderr, "0x%08X is not a valid address\n", (uint32_t) arg);
+            } else {
+                fprintf(stderr, "0x%08X: 0x%08X\n", (uint32_t) arg, read_word((uint32_t) arg));
+            }
+            continue;
+        } else if(strcmp(cmd, "quit") == 0 || strcmp(cmd, "q") == 0) {
+            break;
+        } else {
+            fprintf(stderr, "Commands: back [N], forward [N], goto N, lastwrite ADDR, "
+                            "regs, mem ADDR, quit\n");
+            continue;
+        }
+        print_position();
+        if(instCount == highWater) {
+            sim_report_error(err);
+            fprintf(stderr, "\n");
+        }
+    }
+
+    if(in != stdin) {
+        fclose(in);
+    }
+}
+
+void timetravel_exit() {
+    for(int i=0; i<numSnapshots; i++) {
+        release(&snapshots[i]);
+    }
+    for(int s=0; s<NUM_SEGMENTS; s++) {
+        for(size_t p=0; p<segPages[s]; p++) {
+            drop(latest[s][p]);
+        }
+        free(latest[s]);
+        free(dirty[s]);
+    }
+    free(dirtyList);
+    dirtyList = NULL;
+    numDirty = 0;
+    dirtyCap = 0;
+    free(zeroPage);
+    zeroPage = NULL;
+    numSnapshots = 0;
+    interval = 0;
+    dirtyTracking = 0;
+}
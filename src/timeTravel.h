@@ -0,0 +1,80 @@
+#ifndef GSIM_TIMETRAVEL_H
+#define GSIM_TIMETRAVEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "simulator.h"
+
+/**
+ * Reverse execution.
+ *
+ * While enabled, the machine state is snapshotted every few instructions.
+ * Snapshots share the copies of pages that were not written since the
+ * previous snapshot, so each one costs a register file plus the pages the
+ * program dirtied. Syscalls are logged (see sysRecord.h), which makes
+ * re-executing from a snapshot deterministic and silent. Going back to an
+ * earlier instruction restores the nearest snapshot before it and replays
+ * forward.
+ *
+ * When the program stops on an error, a prompt on the terminal allows
+ * moving through the recorded history:
+ *   back [N]         step back N instructions (default 1)
+ *   forward [N]      step forward N instructions (default 1)
+ *   goto N           go to the state after N instructions
+ *   lastwrite ADDR   go back to just after the last write to ADDR
+ *   regs             print the registers
+ *   mem ADDR         print the word at ADDR
+ *   quit             leave the simulator
+ */
+
+/**
+ * Nonzero while stores must report the pages they touch through
+ * timetravel_dirty().
+ */
+extern int dirtyTracking;
+
+/**
+ * Start taking snapshots. Must be called once the segments are set up.
+ * @param interval - Number of instructions between snapshots
+ */
+void timetravel_enable(uint64_t interval);
+
+/**
+ * @return Nonzero if snapshots are being taken
+ */
+int timetravel_enabled();
+
+/**
+ * Instruction count of the next time-travel event.
+ * @param now - Instructions executed so far
+ * @return Count of the next snapshot or end of replayed history after
+ *          now, or UINT64_MAX if time travel is disabled
+ */
+uint64_t timetravel_next(uint64_t now);
+
+/**
+ * Handle the event due at the current instruction count: take a snapshot
+ * and stop suppressing output once execution leaves replayed history.
+ */
+void timetravel_event();
+
+/**
+ * Mark the pages backing a host memory range as written.
+ * @param realAddr - Host address of the first byte written
+ * @param len - Number of bytes written
+ */
+void timetravel_dirty(byte* realAddr, size_t len);
+
+/**
+ * Interactive history browser, entered when the program stopped.
+ * @param err - Code the program stopped with
+ */
+void timetravel_debug(err_code err);
+
+/**
+ * Release all snapshots.
+ */
+void timetravel_exit();
+
+#endif // GSIM_TIMETRAVEL_H
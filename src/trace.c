@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define OUT_BUF_SIZE 65536
+#define WRITER_IDLE_NS 100000
+
+trace_ring* traceRing;
+
+static FILE* traceFile;
+static pthread_t writerThread;
+static int writerStop;
+
+// Delta encoding state, only touched by the writer thread
+static uint32_t lastPc;
+static uint32_t lastReg[TRACE_REG_LO + 1];
+static uint32_t lastAddr;
+
+
+static unsigned int put_varint(unsigned char* dest, int32_t value) {
+    uint32_t zz = ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    unsigned int len = 0;
+    while(zz >= 0x80) {
+        dest[len++] = (unsigned char) (zz | 0x80);
+        zz >>= 7;
+    }
+    dest[len++] = (unsigned char) zz;
+    return len;
+}
+
+static unsigned int encode_event(unsigned char* dest, uint64_t event) {
+    uint32_t value = (uint32_t) event;
+    unsigned int arg = (unsigned int) (event >> 32) & 0x3F;
+    unsigned int len;
+
+    switch(event & ((uint64_t) 3 << 62)) {
+        case TRACE_EV_PC:
+            if(value == lastPc + 4) {
+                dest[0] = TRACE_TAG_PC_SEQ;
+                len = 1;
+            } else {
+                dest[0] = TRACE_TAG_PC_JUMP;
+                len = 1 + put_varint(&dest[1], (int32_t) (value - lastPc - 4));
+            }
+            lastPc = value;
+            return len;
+        case TRACE_EV_REG:
+            dest[0] = TRACE_TAG_REG | arg;
+            len = 1 + put_varint(&dest[1], (int32_t) (value - lastReg[arg]));
+            lastReg[arg] = value;
+            return len;
+        case TRACE_EV_MEM:
+            dest[0] = TRACE_TAG_MEM | arg;
+            len = 1 + put_varint(&dest[1], (int32_t) (value - lastAddr));
+            lastAddr = value;
+            return len;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Drain every event published so far.
+ * @return Number of events written
+ */
+static uint64_t drain(unsigned char* out) {
+    trace_ring* ring = traceRing;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    uint64_t count = head - tail;
+    size_t used = 0;
+
+    while(tail != head) {
+        used += encode_event(&out[used], ring->events[tail & (TRACE_RING_SIZE - 1)]);
+        tail++;
+        if(used > OUT_BUF_SIZE - 16) {
+            fwrite(out, 1, used, traceFile);
+            used = 0;
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    fwrite(out, 1, used, traceFile);
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+static void* writer_main(void* arg) {
+    (void) arg;
+    unsigned char* out = malloc(OUT_BUF_SIZE);
+    struct timespec idle = {0, WRITER_IDLE_NS};
+
+    while(!__atomic_load_n(&writerStop, __ATOMIC_ACQUIRE)) {
+        if(drain(out) == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain(out);
+    free(out);
+    return NULL;
+}
+
+int trace_open(const char* fileName) {
+    traceFile = fopen(fileName, "wb");
+    if(traceFile == NULL) {
+        return -1;
+    }
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), traceFile);
+    fputc(TRACE_VERSION, traceFile);
+
+    traceRing = calloc(1, sizeof(trace_ring));
+    writerStop = 0;
+    if(traceRing == NULL || pthread_create(&writerThread, NULL, writer_main, NULL) != 0) {
+        free(traceRing);
+        traceRing = NULL;
+        fclose(traceFile);
+        traceFile = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void trace_close() {
+    if(traceRing == NULL) {
+        return;
+    }
+    __atomic_store_n(&writerStop, 1, __ATOMIC_RELEASE);
+    pthread_join(writerThread, NULL);
+    fclose(traceFile);
+    free(traceRing);
+    traceRing = NULL;
+}
+
+void trace_wait() {
+    trace_ring* ring = traceRing;
+    while(ring->head - (ring->cachedTail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) == TRACE_RING_SIZE) {
+        sched_yield();
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef GSIM_TRACE_H
+#define GSIM_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Execution tracing.
+ *
+ * The simulator pushes raw fixed size events into a single-producer,
+ * single-consumer ring buffer; a background writer thread drains it,
+ * delta-encodes the events and writes them to the trace file. Recording an
+ * event is a single store plus an index bump, so the guest-side cost stays
+ * at a few stores per instruction.
+ *
+ * Trace file format (decoded by gsim-trace):
+ *   header   "GSIMTRC" followed by one version byte
+ *   records  one tag byte, optionally followed by a zigzag LEB128 varint
+ *
+ *   0x00           next instruction, pc = previous pc + 4
+ *   0x01 <delta>   next instruction, pc = previous pc + 4 + delta
+ *   0x40 | r <d>   register r written, value = previous value of r + d
+ *                  (r 0-31 are the GPRs, 32 is $hi and 33 is $lo)
+ *   0x80 | s<<2 | l <d>
+ *                  memory access of 2^l bytes (s set for a store),
+ *                  address = previous access address + d
+ */
+
+#define TRACE_MAGIC "GSIMTRC"
+#define TRACE_VERSION 1
+
+#define TRACE_TAG_PC_SEQ 0x00
+#define TRACE_TAG_PC_JUMP 0x01
+#define TRACE_TAG_REG 0x40
+#define TRACE_TAG_MEM 0x80
+#define TRACE_TAG_MEM_STORE 0x04
+
+#define TRACE_REG_HI 32
+#define TRACE_REG_LO 33
+
+/*
+ * Raw ring buffer events. The upper 32 bits hold the event kind and its
+ * small argument (register number or access size), the lower 32 bits the
+ * pc, register value or address.
+ */
+#define TRACE_EV_PC ((uint64_t) 1 << 62)
+#define TRACE_EV_REG ((uint64_t) 2 << 62)
+#define TRACE_EV_MEM ((uint64_t) 3 << 62)
+
+#define TRACE_RING_SIZE (1 << 16)   // Events, must be a power of two
+
+typedef struct trace_ring {
+    uint64_t events[TRACE_RING_SIZE];
+    uint64_t head;          // Next slot written by the simulator
+    uint64_t cachedTail;    // Simulator's last view of tail
+    char pad[64];
+    uint64_t tail;          // Next slot read by the writer thread
+} trace_ring;
+
+extern trace_ring* traceRing;
+
+/**
+ * Open the trace file and start the writer thread.
+ * @param fileName - Path of the trace file to create
+ * @return 0 on success, -1 if the file could not be opened or the writer
+ *          could not be started
+ */
+int trace_open(const char* fileName);
+
+/**
+ * Flush all pending events, stop the writer thread and close the file.
+ */
+void trace_close();
+
+/**
+ * Wait until the writer thread has made room in the ring buffer.
+ */
+void trace_wait();
+
+static inline void trace_push(uint64_t event) {
+    trace_ring* ring = traceRing;
+    if(ring->head - ring->cachedTail == TRACE_RING_SIZE) {
+        trace_wait();
+    }
+    ring->events[ring->head & (TRACE_RING_SIZE - 1)] = event;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void trace_pc(uint32_t pc) {
+    trace_push(TRACE_EV_PC | pc);
+}
+
+static inline void trace_reg(unsigned int regNum, uint32_t value) {
+    trace_push(TRACE_EV_REG | ((uint64_t) regNum << 32) | value);
+}
+
+static inline void trace_mem(uint32_t addr, unsigned int sizeLog2, int isStore) {
+    trace_push(TRACE_EV_MEM | ((uint64_t) (sizeLog2 | (isStore ? TRACE_TAG_MEM_STORE : 0)) << 32) | addr);
+}
+
+#endif // GSIM_TRACE_H
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "trace.h"
+
+/*
+ * gsim-trace: print a binary execution trace written by gsim --trace.
+ * One line per instruction with its register writes and memory accesses.
+ */
+
+static int get_varint(FILE* file, int32_t* value) {
+    uint32_t zz = 0;
+    int shift = 0;
+    int c;
+    do {
+        c = fgetc(file);
+        if(c == EOF || shift > 28) {
+            return -1;
+        }
+        zz |= (uint32_t) (c & 0x7F) << shift;
+        shift += 7;
+    } while(c & 0x80);
+    *value = (int32_t) ((zz >> 1) ^ -(zz & 1));
+    return 0;
+}
+
+static const char* regName(unsigned int regNum) {
+    static const char* names[] = {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+        "hi", "lo"
+    };
+    return regNum <= TRACE_REG_LO ? names[regNum] : "?";
+}
+
+int main(int argc, char* argv[]) {
+    if(argc != 2) {
+        fprintf(stderr, "Usage: gsim-trace tracefile\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if(file == NULL) {
+        fprintf(stderr, "File \"%s\" does not exist!\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    if(fread(magic, 1, sizeof(magic), file) != sizeof(magic)
+       || memcmp(magic, TRACE_MAGIC, sizeof(magic) - 1) != 0
+       || magic[sizeof(magic) - 1] != TRACE_VERSION) {
+        fprintf(stderr, "\"%s\" is not a gsim trace file\n", argv[1]);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    uint32_t pc = 0;
+    uint32_t regs[TRACE_REG_LO + 1] = {0};
+    uint32_t addr = 0;
+    uint64_t count = 0;
+    int32_t delta;
+    int tag;
+
+    while((tag = fgetc(file)) != EOF) {
+        if(tag == TRACE_TAG_PC_SEQ || tag == TRACE_TAG_PC_JUMP) {
+            delta = 0;
+            if(tag == TRACE_TAG_PC_JUMP && get_varint(file, &delta) != 0) {
+                break;
+            }
+            pc += 4 + delta;
+            printf("%s%llu\t0x%08X", count ? "\n" : "", (unsigned long long) count, pc);
+            count++;
+        } else if((tag & 0xC0) == TRACE_TAG_REG) {
+            unsigned int regNum = tag & 0x3F;
+            if(regNum > TRACE_REG_LO || get_varint(file, &delta) != 0) {
+                break;
+            }
+            regs[regNum] += delta;
+            printf("\t$%s=0x%08X", regName(regNum), regs[regNum]);
+        } else if((tag & 0xC0) == TRACE_TAG_MEM) {
+            if(get_varint(file, &delta) != 0) {
+                break;
+            }
+            addr += delta;
+            printf("\t%s%d[0x%08X]", tag & TRACE_TAG_MEM_STORE ? "st" : "ld", 1 << (tag & 3), addr);
+        } else {
+            break;
+        }
+    }
+    if(count) {
+        printf("\n");
+    }
+
+    int truncated = tag != EOF;
+    fclose(file);
+    if(truncated) {
+        fprintf(stderr, "Corrupt trace record after %llu instructions\n", (unsigned long long) count);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "watchpoints.h"
+
+#define WATCH_MAX_LEN 8     // Bytes of a watchpoint, printed as one value
+#define TRAP_FLAG 0x100     // EFLAGS bit single-stepping the host
+#define FAULT_WRITE 0x2     // Page fault error code bit of writes
+
+#if defined(__x86_64__) && defined(__linux__)
+#define CAN_SINGLE_STEP 1
+#else
+#define CAN_SINGLE_STEP 0
+#endif
+
+
+extern byte* data;
+extern CPU_LOCAL byte* stack;
+
+extern size_t dataSize;
+extern CPU_LOCAL size_t stackSize;
+
+extern CPU_LOCAL reg pc;
+extern CPU_LOCAL uint64_t instCount;
+
+typedef struct watchpoint {
+    uint32_t addr;
+    uint32_t len;
+    int read;
+    int write;
+    byte* host;                 // First byte, set by watch_start()
+    byte old[WATCH_MAX_LEN];    // Contents before the access being stepped
+} watchpoint;
+
+static watchpoint watches[WATCH_MAX];
+static int numWatches;
+static uintptr_t pageSize;
+static byte* openPage;      // Page unprotected for the host instruction being stepped
+
+
+int watch_add(const char* spec) {
+    if(numWatches == WATCH_MAX) {
+        return -1;
+    }
+    watchpoint* w = &watches[numWatches];
+    char* end;
+    w->addr = strtoul(spec, &end, 0);
+    w->len = WATCH_DEFAULT_LEN;
+    w->read = 0;
+    w->write = 1;
+    if(end == spec) {
+        return -1;
+    }
+    if(*end == ':' && isdigit((unsigned char) end[1])) {
+        w->len = strtoul(end + 1, &end, 0);
+    }
+    if(*end == ':') {
+        const char* mode = end + 1;
+        w->read = strchr(mode, 'r') != NULL;
+        w->write = strchr(mode, 'w') != NULL;
+        end += 1 + strspn(mode, "rw");
+    }
+    if(*end != '\0' || w->len == 0 || w->len > WATCH_MAX_LEN || (!w->read && !w->write)) {
+        return -1;
+    }
+    numWatches++;
+    return 0;
+}
+
+int watch_enabled() {
+    return numWatches > 0;
+}
+
+static byte* page_of(const byte* p) {
+    return (byte*) ((uintptr_t) p & ~(pageSize - 1));
+}
+
+static int on_page(const watchpoint* w, const byte* page) {
+    return page_of(w->host) == page;
+}
+
+/**
+ * @return Protection of a page given the watchpoints on it
+ */
+static int page_prot(const byte* page) {
+    int prot = PROT_READ | PROT_WRITE;
+    for(int i=0; i<numWatches; i++) {
+        if(on_page(&watches[i], page)) {
+            prot &= watches[i].read ? PROT_NONE : PROT_READ;
+        }
+    }
+    return prot;
+}
+
+static unsigned long long value_of(const byte* p, uint32_t len) {
+    unsigned long long v = 0;
+    for(uint32_t i=0; i<len; i++) {
+        v = v << 8 | p[i];
+    }
+    return v;
+}
+
+static char* put_str(char* out, const char* str) {
+    while(*str != '\0') {
+        *out++ = *str++;
+    }
+    return out;
+}
+
+/**
+ * @param digits - Digits to print at least, leading zeros included
+ */
+static char* put_hex(char* out, unsigned long long v, int digits) {
+    char buf[16];
+    int n = 0;
+    do {
+        buf[n++] = "0123456789ABCDEF"[v & 0xF];
+        v >>= 4;
+    } while(v != 0 || n < digits);
+    while(n > 0) {
+        *out++ = buf[--n];
+    }
+    return out;
+}
+
+static char* put_dec(char* out, unsigned long long v) {
+    char buf[20];
+    int n = 0;
+    do {
+        buf[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v != 0);
+    while(n > 0) {
+        *out++ = buf[--n];
+    }
+    return out;
+}
+
+/**
+ * Print a hit from a signal handler, where stdio and snprintf() are not
+ * safe to call.
+ * @param old - Contents before a write, NULL for a read
+ */
+static void report(const watchpoint* w, const byte* old) {
+    char msg[160];
+    int digits = 2 * w->len;
+    char* out = put_hex(put_str(msg, "Watchpoint 0x"), w->addr, 1);
+    if(old != NULL) {
+        out = put_hex(put_str(out, ": write 0x"), value_of(old, w->len), digits);
+        out = put_str(out, " -> 0x");
+    } else {
+        out = put_str(out, ": read 0x");
+    }
+    out = put_hex(out, value_of(w->host, w->len), digits);
+    out = put_hex(put_str(out, " at pc=0x"), (uint32_t) pc, 1);
+    out = put_dec(put_str(out, ", instruction "), instCount);
+    *out++ = '\n';
+    if(write(STDERR_FILENO, msg, out - msg) < 0) {
+        return;
+    }
+}
+
+#if CAN_SINGLE_STEP
+
+/**
+ * Access to a protected page: report reads, open the page and step the
+ * access.
+ */
+static void on_fault(int sig, siginfo_t* info, void* context) {
+    (void) sig;
+    byte* addr = info->si_addr;
+    byte* page = page_of(addr);
+    if(openPage != NULL || page_prot(page) == (PROT_READ | PROT_WRITE)) {
+        // Not ours, fault again without the handler
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    ucontext_t* uc = context;
+    int isWrite = (uc->uc_mcontext.gregs[REG_ERR] & FAULT_WRITE) != 0;
+    mprotect(page, pageSize, PROT_READ | PROT_WRITE);
+    for(int i=0; i<numWatches; i++) {
+        watchpoint* w = &watches[i];
+        if(!on_page(w, page)) {
+            continue;
+        }
+        if(!isWrite && w->read && addr + 3 >= w->host && addr < w->host + w->len) {
+            report(w, NULL);
+        }
+        memcpy(w->old, w->host, w->len);
+    }
+    openPage = page;
+    uc->uc_mcontext.gregs[REG_EFL] |= TRAP_FLAG;
+}
+
+/**
+ * Access stepped: report writes and protect the page again.
+ */
+static void on_step(int sig, siginfo_t* info, void* context) {
+    (void) sig;
+    (void) info;
+    if(openPage == NULL) {
+        signal(SIGTRAP, SIG_DFL);
+        return;
+    }
+    ucontext_t* uc = context;
+    uc->uc_mcontext.gregs[REG_EFL] &= ~TRAP_FLAG;
+    for(int i=0; i<numWatches; i++) {
+        watchpoint* w = &watches[i];
+        if(on_page(w, openPage) && w->write && memcmp(w->old, w->host, w->len) != 0) {
+            report(w, w->old);
+        }
+    }
+    mprotect(openPage, pageSize, page_prot(openPage));
+    openPage = NULL;
+}
+
+#endif
+
+/**
+ * @return Nonzero if the len bytes at host lie in seg
+ */
+static int in_segment(const byte* host, uint32_t len, const byte* seg, size_t size) {
+    return host >= seg && host + len <= seg + size;
+}
+
+int watch_start() {
+    if(!CAN_SINGLE_STEP) {
+        return -1;
+    }
+    pageSize = sysconf(_SC_PAGESIZE);
+    for(int i=0; i<numWatches; i++) {
+        watchpoint* w = &watches[i];
+        w->host = getRealAddr(w->addr);
+        if(w->host == NULL || page_of(w->host) != page_of(w->host + w->len - 1)
+           || !(in_segment(w->host, w->len, data, dataSize) || in_segment(w->host, w->len, stack, stackSize))) {
+            return -1;
+        }
+    }
+
+#if CAN_SINGLE_STEP
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = on_fault;
+    sigaction(SIGSEGV, &sa, NULL);
+    sa.sa_sigaction = on_step;
+    sigaction(SIGTRAP, &sa, NULL);
+#endif
+
+    for(int i=0; i<numWatches; i++) {
+        byte* page = page_of(watches[i].host);
+        if(mprotect(page, pageSize, page_prot(page)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef GSIM_WATCHPOINTS_H
+#define GSIM_WATCHPOINTS_H
+
+#include "simulator.h"
+
+/**
+ * Data watchpoints on guest memory (gsim --watch ADDR[:LEN][:rw]).
+ *
+ * A watchpoint covers the LEN bytes an access of that size at ADDR touches,
+ * in the data segment or the stack. The host pages holding watched bytes
+ * are protected with mprotect(), so the run loop and the syscall handlers
+ * access every other page as usual, at no cost. An access to a protected
+ * page faults; the fault handler opens the page, single-steps the host
+ * instruction with the trap flag and protects the page again. Reads that
+ * start up to 3 bytes before a watched range and end in it are reported as
+ * reads of it. Writes are reported when they change the watched bytes,
+ * with their old and new value. Reports go to stderr as they happen, with
+ * the guest pc and instruction count of the access.
+ *
+ * Single-stepping needs an x86-64 Linux host. Snapshots, checkpoints and
+ * other CPUs would fault on the protected pages too, so watchpoints cannot
+ * be combined with them.
+ */
+
+#define WATCH_MAX 16
+#define WATCH_DEFAULT_LEN 4
+
+/**
+ * Add a watchpoint, before the program is loaded.
+ * @param spec - ADDR[:LEN][:MODE], MODE being r, w or rw (default w)
+ * @return 0 on success, -1 if spec is malformed or too many are set
+ */
+int watch_add(const char* spec);
+
+/**
+ * Protect the watched pages, once the program is loaded.
+ * @return 0 on success, -1 if a watchpoint is outside the data segment
+ *          and the stack, or the host cannot single-step
+ */
+int watch_start();
+
+/**
+ * @return Nonzero if any watchpoint was added
+ */
+int watch_enabled();
+
+#endif // GSIM_WATCHPOINTS_H